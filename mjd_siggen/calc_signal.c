@@ -67,6 +67,14 @@ kT/e ~ 0.007/V ~ 0.07 mm/Vcm, => close enough to 0.12, okay
 /* prototypes for module-private functions*/
 //static int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup);
 static double charge_trapping( double q, MJD_Siggen_Setup* setup); //trapping
+static double charge_trapping_sens(double q, double *dq, MJD_Siggen_Setup* setup);
+static int calc_signals(point pt, float *signal_out, int nsig, MJD_Siggen_Setup *setup);
+static int shape_signal(float *signal, float *signal_out, float *sum, float *tmp,
+                        int active, MJD_Siggen_Setup *setup);
+static int drift_charge(point pt, float *signal, int nsig, float q, MJD_Siggen_Setup *setup);
+static path_record *record_path(float q, int t, point pt, vector v, MJD_Siggen_Setup *setup);
+static int steps_to_surface(point pt, vector v, int t, int max, float q, int record,
+                            float *last, MJD_Siggen_Setup *setup);
 
 /* signal_calc_init
 read setup from configuration file,
@@ -94,6 +102,7 @@ int signal_calc_init(char *config_file_name, MJD_Siggen_Setup *setup) {
     error("Path malloc failed\n");
     return -1;
   }
+  setup->path_step = 1;
 
   tell("Setup of signal calculation done\n");
   return 0;
@@ -105,24 +114,46 @@ returns -1 if outside crystal
 if signal_out == NULL => no signal is stored
 */
 int get_signal(point pt, float *signal_out, MJD_Siggen_Setup *setup) {
-  static float *signal, *sum, *tmp;
-  static int tsteps = 0;
-  float w, x, y;
+  return calc_signals(pt, signal_out, 1, setup);
+}
+
+/* get_signals
+calculate the signals for point pt on the point contact and on the
+setup->num_wpot_extra other electrodes, from the same drift of the charges;
+signal_out[0..ntsteps_out-1] is the point-contact signal, followed by
+the signal of each other electrode in turn
+returns -1 if outside crystal
+*/
+int get_signals(point pt, float *signal_out, MJD_Siggen_Setup *setup) {
+  return calc_signals(pt, signal_out, 1 + setup->num_wpot_extra, setup);
+}
+
+static int calc_signals(point pt, float *signal_out, int nsig, MJD_Siggen_Setup *setup) {
+  float *signal, *sum, *tmp;
   char  tmpstr[MAX_LINE];
-  int   j, k, l, dt, err, comp_f;
-
-  /* first time -- allocate signal and sum arrays */
-  if (tsteps != setup->time_steps_calc) {
-    tsteps = setup->time_steps_calc;
-    if ((signal = (float *) malloc(tsteps*sizeof(*signal))) == NULL ||
-    (tmp    = (float *) malloc(tsteps*sizeof(*tmp))) == NULL ||
-    (sum    = (float *) malloc(tsteps*sizeof(*sum))) == NULL) {
+  int   j, k, err, active, n, tsteps, used;
+
+  /* first time -- allocate signal and sum arrays, kept in setup->sig_work */
+  tsteps = setup->time_steps_calc;
+  if (setup->sig_work == NULL || setup->sig_work_tsteps != tsteps || setup->sig_work_nsig < nsig) {
+    free(setup->sig_work);
+    if ((setup->sig_work = (float *) malloc((nsig+2)*tsteps*sizeof(float))) == NULL) {
       error("malloc failed in get_signal\n");
+      setup->sig_work_tsteps = setup->sig_work_nsig = 0;
       return -1;
     }
+    setup->sig_work_tsteps = tsteps;
+    setup->sig_work_nsig = nsig;
+    setup->sig_work_used = tsteps;
   }
+  signal = setup->sig_work;
+  tmp = signal + setup->sig_work_nsig*tsteps;
+  sum = tmp + tsteps;
 
-  for (j = 0; j < tsteps; j++) signal[j] = 0.0;
+  /* only the steps written by the last call need clearing */
+  for (k = 0; k < setup->sig_work_nsig; k++)
+    for (j = 0; j < setup->sig_work_used; j++) signal[k*tsteps + j] = 0.0;
+  setup->sig_work_used = used = 0;
 
   if (outside_detector(pt, setup)) {
     TELL_CHATTY("Point %s is outside detector!\n", pt_to_str(tmpstr, MAX_LINE, pt));
@@ -130,19 +161,47 @@ int get_signal(point pt, float *signal_out, MJD_Siggen_Setup *setup) {
   }
   TELL_CHATTY("Calculating signal for %s...\n", pt_to_str(tmpstr, MAX_LINE, pt));
 
-  memset(setup->dpath_e, 0, tsteps*sizeof(point));
-  memset(setup->dpath_h, 0, tsteps*sizeof(point));
+  setup->drift_steps = 0;
+  err = drift_charge(pt, signal, nsig, ELECTRON_CHARGE, setup);
+  active = setup->drift_steps;
+  setup->drift_steps = 0;
+  err = drift_charge(pt, signal, nsig, HOLE_CHARGE, setup);
+  if (setup->drift_steps > active) active = setup->drift_steps;
+  if (active < 1) active = 1;
+  used = active;
+
+  for (k = 0; k < nsig; k++) {
+    /* change from current signal to charge signal, i.e.
+    each time step contains the summed signals of all previous time steps;
+    it stays constant after the active steps */
+    for (j = 1; j < active; j++) signal[k*tsteps + j] += signal[k*tsteps + j-1];
+
+    if (signal_out != NULL) {
+      n = shape_signal(signal + k*tsteps, signal_out + k*setup->ntsteps_out, sum, tmp, active, setup);
+      if (n > used) used = n;
+    }
+  }
+  setup->sig_work_used = used;
 
-  err = make_signal(pt, signal, ELECTRON_CHARGE, setup);
-  err = make_signal(pt, signal, HOLE_CHARGE, setup);
   /* make_signal returns 0 for success; require hole signal but not electron */
+  if (err) return -1;
+  return 1;
+}
 
-  /* change from current signal to charge signal, i.e.
-  each time step contains the summed signals of all previous time steps */
-  for (j = 1; j < tsteps; j++) signal[j] += signal[j-1];
-
-  if (signal_out != NULL) {
+/* shape_signal
+convolute the charge signal with the charge cloud size and diffusion, compress
+it to the output time steps in signal_out, and do the RC integration for the preamp;
+signal is constant from step active - 1 on, and is only read (and written) as far
+as needed; sum and tmp are work arrays of time_steps_calc elements
+returns the number of steps of signal that were written
+*/
+static int shape_signal(float *signal, float *signal_out, float *sum, float *tmp,
+                        int active, MJD_Siggen_Setup *setup) {
+  float w, x, y, c, c_out;
+  int   j, k, l, dt, comp_f, tsteps = setup->time_steps_calc, span, len = active, spread;
 
+    c = signal[active-1];
+    span = active;       // signal is c from here on
     if (setup->charge_cloud_size > 0.001 || setup->use_diffusion) {
       /* convolute with a Gaussian to correct for charge cloud size
       and initial velocity
@@ -175,23 +234,31 @@ int get_signal(point pt, float *signal_out, MJD_Siggen_Setup *setup) {
               l = setup->preamp_tau/setup->step_time_calc;
             }
             // TELL_CHATTY(">> l: %d\n", l);
-            for (j = 0; j < tsteps; j++) {
+            /* the passes below spread the non-constant part by up to spread steps;
+            working on 2*spread steps past active keeps the first active + spread exact */
+            for (spread = 0, k = l; k < 2*dt; k+=l) spread += k;
+            span = active + spread;
+            len = active + 2*spread;
+            if (len >= tsteps) len = span = tsteps;
+            for (j = active; j < len; j++) signal[j] = c;
+            for (j = 0; j < len; j++) {
               sum[j] = 1.0;
               tmp[j] = signal[j];
             }
             for (k = l; k < 2*dt; k+=l) {
               x = ((float) k)/w;
               y = exp(-x*x);
-              for (j = 0; j < tsteps - k; j++){
+              for (j = 0; j < len - k; j++){
                 sum[j] += y;
                 tmp[j] += signal[j+k] * y;
                 sum[j+k] += y;
                 tmp[j+k] += signal[j] * y;
               }
-              for (j = 0; j < tsteps; j++){
+              for (j = 0; j < len; j++){
                 signal[j] = tmp[j]/sum[j];
               }
             }
+            for (j = span; j < len; j++) signal[j] = c;
           }
         }
 
@@ -199,39 +266,328 @@ int get_signal(point pt, float *signal_out, MJD_Siggen_Setup *setup) {
         truncate the signal if time_steps_calc % ntsteps_out != 0 */
         comp_f = setup->time_steps_calc/setup->ntsteps_out;
         for (j = 0; j < setup->ntsteps_out; j++) signal_out[j] = 0;
-        for (j = 0; j < setup->ntsteps_out*comp_f; j++)
+        for (j = 0; j < setup->ntsteps_out*comp_f && j < span; j++)
         signal_out[j/comp_f] += signal[j]/comp_f;
+        /* the rest of the output step holding step span - 1, and all later ones, are c */
+        if (j < setup->ntsteps_out*comp_f) {
+          for (; j % comp_f; j++) signal_out[j/comp_f] += c/comp_f;
+          for (c_out = 0, k = 0; k < comp_f; k++) c_out += c/comp_f;
+          for (j /= comp_f; j < setup->ntsteps_out; j++) signal_out[j] = c_out;
+        }
 
         /* do RC integration for preamp risetime */
         if (setup->preamp_tau/setup->step_time_out >= 0.1f)
         rc_integrate(signal_out, signal_out,
           setup->preamp_tau/setup->step_time_out, setup->ntsteps_out);
-        }
-
-        /* make_signal returns 0 for success; require hole signal but not electron */
-        if (err) return -1;
-        return 1;
-      }
+        return len;
+}
 
       /* make_signal
       Generates the signal originating at point pt, for charge q
       returns 0 for success
       */
 int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
-        static float wpot, wpot_old, dwpot;
+        return drift_charge(pt, signal, 1, q, setup);
+      }
+
+      /* make_signals
+      Generates the signals on the point contact and the other electrodes
+      originating at point pt, for charge q; signal holds 1 + setup->num_wpot_extra
+      signals of time_steps_calc steps each, one after the other
+      returns 0 for success
+      */
+int make_signals(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
+        return drift_charge(pt, signal, 1 + setup->num_wpot_extra, q, setup);
+      }
+
+      /* make_signal_sens
+      Generates the signal originating at point pt for charge q, as make_signal(),
+      and its derivatives with respect to the SENS_* parameters (mjd_siggen.h) in
+      dsignal[p*time_steps_calc + t], by propagating the derivatives of the drift
+      path along with it (forward mode); see drift_velocity_sens() in fields.c.
+      The number of steps to the crystal edge after leaving the field grid is
+      taken as fixed. (r,z) field grid and point contact WP only.
+      returns 0 for success
+      */
+int make_signal_sens(point pt, float *signal, float *dsignal, float q, MJD_Siggen_Setup *setup) {
+        char   tmpstr[MAX_LINE];
+        point  new_pt;
+        vector v, dx;
+        float  dv_dx[3][3], dv_dp[SENS_NPAR][3], dpt[SENS_NPAR][3], dpt_new[3];
+        float  wpot = 0, wpot_old = 0, dwp[3], dw[SENS_NPAR], dw_old[SENS_NPAR], dwpot, ddwpot, last, f;
+        double q_mult = 1, dq_trap = 0;
+        int    ntsteps, i, j, p, t, n, collect2pc, low_field=0;
+        path_record *rec = NULL;
+
+        if (setup->field3) {
+          TELL_NORMAL("make_signal_sens needs the (r,z) field grid\n");
+          return -1;
+        }
+        new_pt = pt;
+        collect2pc = ((q > 0 && setup->impurity_z0 < 0) ||  // holes for p-type
+                      (q < 0 && setup->impurity_z0 > 0));   // electrons for n-type
+        ntsteps = setup->time_steps_calc;
+        for (p = 0; p < SENS_NPAR; p++) {
+          dpt[p][0] = dpt[p][1] = dpt[p][2] = 0;
+          dw_old[p] = 0;
+        }
+        dpt[SENS_X][0] = dpt[SENS_Y][1] = dpt[SENS_Z][2] = 1;
+        if (q > 0) setup->path_len_h = 0;
+        else setup->path_len_e = 0;
+
+        for (t = 0; drift_velocity_sens(new_pt, q, &v, dv_dx, dv_dp, setup) >= 0; t++) {
+          if (setup->path_step) rec = record_path(q, t, new_pt, v, setup);
+          if (t >= ntsteps - 2) {
+            if (collect2pc || wpot > WP_THRESH_ELECTRONS) {
+              TELL_CHATTY("\nExceeded maximum number of time steps (%d)\n", ntsteps);
+              low_field = 1;
+            }
+            break;
+          }
+          if (wpotential_sens(new_pt, &wpot, dwp, setup) != 0) {
+            TELL_NORMAL("\nCan calculate velocity but not WP at %s!\n",
+            pt_to_str(tmpstr, MAX_LINE, new_pt));
+            return -1;
+          }
+          if (rec) rec->wp = wpot;
+          for (p = 0; p < SENS_NPAR; p++)
+            dw[p] = dwp[0]*dpt[p][0] + dwp[1]*dpt[p][1] + dwp[2]*dpt[p][2];
+          if (t > 0) {
+            signal[t] += q*q_mult*(wpot - wpot_old);
+            for (p = 0; p < SENS_NPAR; p++)
+              dsignal[p*ntsteps + t] += q*q_mult*(dw[p] - dw_old[p]);
+            dsignal[SENS_TRAP*ntsteps + t] += q*dq_trap*(wpot - wpot_old);
+          }
+          if (wpot >= 0.999 && (wpot - wpot_old) < 0.0002) {
+            low_field = 1;
+            break;
+          }
+          if (t == 0){ setup->initial_wpot = wpot;}
+          wpot_old = wpot;
+          for (p = 0; p < SENS_NPAR; p++) dw_old[p] = dw[p];
+
+          /* d(new_pt)/dp = d(pt)/dp + dt * (dv/dx . d(pt)/dp + dv/dp) */
+          for (p = 0; p < SENS_NPAR; p++) {
+            for (i = 0; i < 3; i++) {
+              dpt_new[i] = dv_dp[p][i];
+              for (j = 0; j < 3; j++) dpt_new[i] += dv_dx[i][j]*dpt[p][j];
+            }
+            for (i = 0; i < 3; i++) dpt[p][i] += setup->step_time_calc*dpt_new[i];
+          }
+          dx = vector_scale(v, setup->step_time_calc);
+          new_pt = vector_add(new_pt, dx);
+          q_mult = charge_trapping_sens(q_mult, &dq_trap, setup);
+        }
+        if (t == 0) {
+          TELL_CHATTY("The starting point %s is outside the field.\n",
+          pt_to_str(tmpstr, MAX_LINE, pt));
+          return -1;
+        }
+
+        if (!low_field) {
+          /* outside the electric grid; drift to the crystal boundary as in drift_charge() */
+          n = steps_to_surface(vector_sub(new_pt, dx), v, t, ntsteps - t, q,
+                               setup->path_step, &last, setup);
+          if (n == 0){
+            if (q > 0 || wpot > WP_THRESH_ELECTRONS) {
+              TELL_CHATTY("Exceeded maximum number of time steps (%d)\n", ntsteps);
+              return -1;
+            }
+            n = ntsteps -t;
+            last = 1;
+          }
+          dwpot = (wpot > 0.3 ? 1.0 - wpot : -wpot)/(n - 1 + last);
+          for (i = 0; i < n; i++){
+            f = (i < n-1 ? 1 : last);
+            signal[i+t] += q*q_mult*dwpot*f;
+            for (p = 0; p < SENS_NPAR; p++) {
+              ddwpot = -dw_old[p]/(n - 1 + last);
+              dsignal[p*ntsteps + i+t] += q*q_mult*ddwpot*f;
+            }
+            dsignal[SENS_TRAP*ntsteps + i+t] += q*dq_trap*dwpot*f;
+            q_mult = charge_trapping_sens(q_mult, &dq_trap, setup);
+          }
+        }
+        if (q > 0) setup->final_vel = vector_length(v);
+
+        return 0;
+      }
+
+      /* one drift of make_signal_fd(), stepped in lockstep with the others */
+typedef struct {
+        point  pt;
+        vector v, dx;
+        float  wpot, wpot_old;
+        double q_mult;
+        int    t, low_field;
+      } drift_lane;
+
+      /* sens_param
+      address of the SENS_* parameter par in setup (not x, y, z or trap_constant)
+      */
+static float *sens_param(int par, MJD_Siggen_Setup *setup) {
+        switch (par) {
+          case SENS_AVG_IMP:   return &setup->avg_imp;
+          case SENS_IMP_GRAD:  return &setup->imp_grad;
+          case SENS_H100_MU0:  return &setup->v_params->h_100_mu0;
+          case SENS_H100_BETA: return &setup->v_params->h_100_beta;
+          case SENS_H100_E0:   return &setup->v_params->h_100_e0;
+          case SENS_H111_MU0:  return &setup->v_params->h_111_mu0;
+          case SENS_H111_BETA: return &setup->v_params->h_111_beta;
+          case SENS_H111_E0:   return &setup->v_params->h_111_e0;
+        }
+        return NULL;
+      }
+
+      /* drift_lane_step
+      one time step of the drift in lane l, as in drift_charge() for the point contact
+      only; for the base lane (base set), sets initial_wpot and records the drift
+      path if path recording is on; once the lane leaves the field, the rest of its
+      signal is added
+      returns 1 while drifting, 0 when done, -1 for failure
+      */
+static int drift_lane_step(drift_lane *l, float *signal, float q, int collect2pc,
+                           int base, MJD_Siggen_Setup *setup) {
+        int ntsteps = setup->time_steps_calc, n, i, record;
+        float dwpot, last;
+        path_record *rec = NULL;
+
+        record = base && setup->path_step;
+        if (drift_velocity(l->pt, q, &l->v, setup) >= 0) {
+          if (record) rec = record_path(q, l->t, l->pt, l->v, setup);
+          if (l->t >= ntsteps - 2) {
+            if (collect2pc || l->wpot > WP_THRESH_ELECTRONS) l->low_field = 1;
+          } else {
+            if (wpotential(l->pt, &l->wpot, setup) != 0) return -1;
+            if (rec) rec->wp = l->wpot;
+            if (l->t > 0) signal[l->t] += q*l->q_mult*(l->wpot - l->wpot_old);
+            if (l->wpot >= 0.999 && (l->wpot - l->wpot_old) < 0.0002) {
+              l->low_field = 1;
+            } else {
+              if (l->t == 0 && base) setup->initial_wpot = l->wpot;
+              l->wpot_old = l->wpot;
+              l->dx = vector_scale(l->v, setup->step_time_calc);
+              l->pt = vector_add(l->pt, l->dx);
+              l->q_mult = charge_trapping(l->q_mult, setup);
+              l->t++;
+              return 1;
+            }
+          }
+        }
+        if (l->t == 0) return -1;
+        if (l->low_field) return 0;
+
+        /* outside the field grid; drift on to the crystal boundary */
+        n = steps_to_surface(vector_sub(l->pt, l->dx), l->v, l->t, ntsteps - l->t, q,
+                             record, &last, setup);
+        if (n == 0){
+          if (q > 0 || l->wpot > WP_THRESH_ELECTRONS) return -1;
+          n = ntsteps - l->t;
+          last = 1;
+        }
+        dwpot = (l->wpot > 0.3 ? 1.0 - l->wpot : -l->wpot)/(n - 1 + last);
+        for (i = 0; i < n; i++){
+          signal[i + l->t] += q*l->q_mult*dwpot*(i < n-1 ? 1 : last);
+          l->q_mult = charge_trapping(l->q_mult, setup);
+        }
+        return 0;
+      }
+
+      /* make_signal_fd
+      Generates the signal originating at point pt for charge q, as make_signal(),
+      in signal[0..time_steps_calc-1], and the signals for npert changed parameter
+      sets, with SENS_* parameter par[k] (mjd_siggen.h) changed by delta[k], in
+      signal[(k+1)*time_steps_calc + t], for finite-difference derivatives.
+      The 1 + npert drifts are stepped in lockstep, so that they all use the same
+      (nearby) parts of the field tables at each step.
+      returns 0 for success, -1 if the base or any changed drift fails
+      */
+int make_signal_fd(point pt, float *signal, int npert, const int *par, const float *delta,
+                   float q, MJD_Siggen_Setup *setup) {
+        drift_lane *lanes;
+        float  *p = NULL, save = 0;
+        double save_trap = setup->trap_constant;
+        int    k, ret = 0, active, collect2pc, *running, table_ok = setup->h_table_ok;
+
+        collect2pc = ((q > 0 && setup->impurity_z0 < 0) ||  // holes for p-type
+                      (q < 0 && setup->impurity_z0 > 0));   // electrons for n-type
+        for (k = 0; k < npert; k++) {
+          if (par[k] < 0 || par[k] >= SENS_NPAR) return -1;
+        }
+        if (!(lanes = malloc((npert+1)*sizeof(*lanes))) ||
+            !(running = malloc((npert+1)*sizeof(*running)))) {
+          free(lanes);
+          return -1;
+        }
+        if (q > 0) setup->path_len_h = 0;
+        else setup->path_len_e = 0;
+        for (k = 0; k <= npert; k++) {
+          memset(&lanes[k], 0, sizeof(lanes[k]));
+          lanes[k].pt = pt;
+          lanes[k].q_mult = 1;
+          running[k] = 1;
+          if (k == 0) continue;
+          if (par[k-1] == SENS_X) lanes[k].pt.x += delta[k-1];
+          if (par[k-1] == SENS_Y) lanes[k].pt.y += delta[k-1];
+          if (par[k-1] == SENS_Z) lanes[k].pt.z += delta[k-1];
+        }
+
+        for (active = npert+1; active > 0 && ret == 0; ) {
+          for (k = 0; k <= npert && ret == 0; k++) {
+            if (!running[k]) continue;
+            /* put this lane's parameter value in place for its step */
+            if (k > 0) {
+              if (par[k-1] == SENS_TRAP) {
+                setup->trap_constant = save_trap + delta[k-1];
+              } else if ((p = sens_param(par[k-1], setup))) {
+                save = *p;
+                *p = save + delta[k-1];
+                /* h_table is not for perturbed hole parameters */
+                if (par[k-1] >= SENS_H100_MU0 && par[k-1] <= SENS_H111_E0) setup->h_table_ok = 0;
+              }
+            }
+            running[k] = drift_lane_step(&lanes[k], signal + k*setup->time_steps_calc,
+                                         q, collect2pc, k == 0, setup);
+            if (k > 0) {
+              setup->trap_constant = save_trap;
+              if (p) *p = save;
+              p = NULL;
+              setup->h_table_ok = table_ok;
+            }
+            if (running[k] < 0) ret = -1;
+            else if (running[k] == 0) active--;
+          }
+        }
+        if (ret == 0 && q > 0) setup->final_vel = vector_length(lanes[0].v);
+        free(lanes);
+        free(running);
+        return ret;
+      }
+
+      /* drift_charge
+      drift charge q from point pt, adding the induced current on each of the
+      first nsig electrodes (the point contact first) to signal[k*time_steps_calc + t],
+      for t < setup->drift_steps only
+      returns 0 for success
+      */
+static int drift_charge(point pt, float *signal, int nsig, float q, MJD_Siggen_Setup *setup) {
+        float  wpot[MAX_ELECTRODES], wpot_old[MAX_ELECTRODES] = {0}, dwpot[MAX_ELECTRODES];
         char   tmpstr[MAX_LINE];
         point  new_pt;
         vector v, dx;
-        float  vel0, vel1 = 0;
+        float  vel0, vel1 = 0, last = 1, f;
         // double diffusion_coeff;
         double repulsion_fact = 0.0, ds2, ds3, dv, ds_dt;
-        int    ntsteps, i, t, n, collect2pc, low_field=0;
+        int    ntsteps, i, k, kmax, t, n, collect2pc, low_field=0;
 
         double q_mult = 1;
+        path_record *rec = NULL;
 
         new_pt = pt;
         collect2pc = ((q > 0 && setup->impurity_z0 < 0) ||  // holes for p-type
         (q < 0 && setup->impurity_z0 > 0));   // electrons for n-type
+        if (q > 0) setup->path_len_h = 0;
+        else setup->path_len_e = 0;
         /*
         if (q > 0) {
         diffusion_coeff = TWO_TIMES_DIFFUSION_COEF_H;
@@ -241,12 +597,7 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
     */
     ntsteps = setup->time_steps_calc;
     for (t = 0; drift_velocity(new_pt, q, &v, setup) >= 0; t++) {
-      //charge trapping
-      if (q > 0) {
-        setup->dpath_h[t] = new_pt;
-      } else {
-        setup->dpath_e[t] = new_pt;
-      }
+      if (setup->path_step) rec = record_path(q, t, new_pt, v, setup);
       if (collect2pc) {
         if (t == 0) {
           vel1 = setup->final_vel = setup->initial_vel = vector_length(v);
@@ -300,7 +651,7 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
           TELL_CHATTY("pt: (%.2f %.2f %.2f), v: (%e %e %e)",
           new_pt.x, new_pt.y, new_pt.z, v.x, v.y, v.z);
           if (t >= ntsteps - 2) {
-            if (collect2pc || wpot > WP_THRESH_ELECTRONS) {
+            if (collect2pc || wpot[0] > WP_THRESH_ELECTRONS) {
               /* for p-type, this is hole or electron+high wp */
               TELL_CHATTY("\nExceeded maximum number of time steps (%d)\n", ntsteps);
               low_field = 1;
@@ -308,25 +659,31 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
             }
             break;
           }
-          if (wpotential(new_pt, &wpot, setup) != 0) {
+          if ((nsig > 1 ? wpotentials(new_pt, wpot, setup) : wpotential(new_pt, wpot, setup)) != 0) {
             TELL_NORMAL("\nCan calculate velocity but not WP at %s!\n",
             pt_to_str(tmpstr, MAX_LINE, new_pt));
+            setup->drift_steps = t;
             return -1;
           }
-          TELL_CHATTY(" -> wp: %.4f\n", wpot);
-          if (t > 0) signal[t] += q*q_mult*(wpot - wpot_old);
+          TELL_CHATTY(" -> wp: %.4f\n", wpot[0]);
+          if (rec) rec->wp = wpot[0];
+          if (t > 0) {
+            for (k = 0; k < nsig; k++)
+              signal[k*ntsteps + t] += q*q_mult*(wpot[k] - wpot_old[k]);
+          }
           // FIXME? Hack added by DCR to deal with undepleted point contact
-          if (wpot >= 0.999 && (wpot - wpot_old) < 0.0002) {
+          if (wpot[0] >= 0.999 && (wpot[0] - wpot_old[0]) < 0.0002) {
             low_field = 1;
             break;
           }
-          if (t == 0){ setup->initial_wpot = wpot;}
-          wpot_old = wpot;
+          if (t == 0){ setup->initial_wpot = wpot[0];}
+          for (k = 0; k < nsig; k++) wpot_old[k] = wpot[k];
 
           dx = vector_scale(v, setup->step_time_calc);
           new_pt = vector_add(new_pt, dx);
           q_mult = charge_trapping(q_mult, setup); //FIXME
         }
+        setup->drift_steps = (t < ntsteps ? t+1 : ntsteps);
         if (t == 0) {
           TELL_CHATTY("The starting point %s is outside the field.\n",
           pt_to_str(tmpstr, MAX_LINE, pt));
@@ -340,36 +697,42 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
           pt_to_str(tmpstr, MAX_LINE, new_pt), q);
 
           /* now we are outside the electric grid. figure out how much we must
-          drift to get to the crystal boundary */
-          for (n = 0; n+t < ntsteps; n++){
-            new_pt = vector_add(new_pt, dx);
-            if (q > 0) setup->dpath_h[t+n] = new_pt;
-            else setup->dpath_e[t+n] = new_pt;
-            if (outside_detector(new_pt, setup)) break;
-          }
-          if (n == 0) n = 1; /* always drift at least one more step */
+          drift from the last point in it to get to the crystal boundary */
+          n = steps_to_surface(vector_sub(new_pt, dx), v, t, ntsteps - t, q,
+                               setup->path_step, &last, setup);
           // TELL_CHATTY(
           TELL_NORMAL("q: %.1f t: %d n: %d ((%.2f %.2f %.2f)=>(%.2f %.2f %.2f))\n",
           q, t, n, pt.x, pt.y, pt.z, new_pt.x, new_pt.y, new_pt.z);
 
-          if (n + t >= ntsteps){
-            if (q > 0 || wpot > WP_THRESH_ELECTRONS) { /* hole or electron+high wp */
+          if (n == 0){
+            if (q > 0 || wpot[0] > WP_THRESH_ELECTRONS) { /* hole or electron+high wp */
+              setup->drift_steps = t;
               TELL_CHATTY("Exceeded maximum number of time steps (%d)\n", ntsteps);
               return -1;  /* FIXME DCR: does this happen? could this be improved? */
             }
             n = ntsteps -t;
+            last = 1;
           }
-          /* make WP go gradually to 1 or 0 */
-          if (wpot > 0.3) {
-            dwpot = (1.0 - wpot)/n;
-          } else {
-            dwpot = - wpot/n;
+          /* make WP go gradually to 1 or 0; the charge is collected
+             by the electrode with the largest WP */
+          for (kmax = 0, k = 1; k < nsig; k++)
+            if (wpot[k] > wpot[kmax]) kmax = k;
+          for (k = 0; k < nsig; k++) {
+            if (k == kmax && wpot[k] > 0.3) {
+              dwpot[k] = (1.0 - wpot[k])/(n - 1 + last);
+            } else {
+              dwpot[k] = - wpot[k]/(n - 1 + last);
+            }
           }
 
+          setup->drift_steps = t + n;
           /*now drift the final n steps*/
           dx = vector_scale(v, setup->step_time_calc);
           for (i = 0; i < n; i++){
-            signal[i+t] += q*q_mult*dwpot;
+            /* the surface is reached within the last step */
+            f = (i < n-1 ? 1 : last);
+            for (k = 0; k < nsig; k++)
+              signal[k*ntsteps + i+t] += q*q_mult*dwpot[k]*f;
             q_mult = charge_trapping(q_mult, setup); //FIXME
           }
 
@@ -383,6 +746,61 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
       }
 
 
+      /* record_path
+      store point pt of the drift of charge q, at time step t with velocity v, in
+      the drift path (and its record, if any) if t is a multiple of setup->path_step
+      returns the record, with wp = -1 for the caller to fill in, or NULL
+      */
+static path_record *record_path(float q, int t, point pt, vector v, MJD_Siggen_Setup *setup) {
+        path_record *rec;
+        int i;
+
+        if (t % setup->path_step) return NULL;
+        i = t / setup->path_step;
+        if (q > 0) {
+          setup->dpath_h[i] = pt;
+          setup->path_len_h = i+1;
+          rec = setup->dpath_rec_h;
+        } else {
+          setup->dpath_e[i] = pt;
+          setup->path_len_e = i+1;
+          rec = setup->dpath_rec_e;
+        }
+        if (rec == NULL) return NULL;
+        rec += i;
+        rec->t = t * setup->step_time_calc;
+        rec->r = sqrt(pt.x*pt.x + pt.y*pt.y);
+        rec->z = pt.z;
+        rec->v = vector_length(v);
+        rec->wp = -1;
+        return rec;
+      }
+
+
+      /* steps_to_surface
+      number of time steps n, up to max, for charge q to drift from pt, its last point
+      in the field at time step t-1, to the crystal surface at velocity v, recording
+      the path from time step t if record is set. The surface is reached within
+      the last of these steps, after the fraction *last of it
+      returns n, or 0 if the surface is not reached within max steps
+      */
+static int steps_to_surface(point pt, vector v, int t, int max, float q, int record,
+                            float *last, MJD_Siggen_Setup *setup) {
+        vector dx;
+        float  s;
+        int    i, n;
+
+        dx = vector_scale(v, setup->step_time_calc);
+        s = boundary_crossing(pt, dx, max, setup);
+        if (s <= 0) return 0;
+        n = (int) ceil(s);
+        *last = s - (n - 1);
+        for (i = 1; record && i <= n; i++)
+          record_path(q, t + i-1, vector_add(pt, vector_scale(dx, (i < n ? i : s))), v, setup);
+        return n;
+      }
+
+
       static double charge_trapping(double q, MJD_Siggen_Setup* setup){
         double trapped;
 
@@ -398,6 +816,25 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
       }
 
 
+      /* charge_trapping_sens
+      charge_trapping() for one time step, also updating *dq, the derivative
+      of q with respect to trap_constant
+      */
+      static double charge_trapping_sens(double q, double *dq, MJD_Siggen_Setup* setup){
+        double a, b = 1;
+
+        if (setup->trap_constant == 0){return q;}
+
+        a = exp( -setup->step_time_calc/1000/setup->trap_constant );
+        if (setup->release_constant != 0){
+          b = exp( -setup->step_time_calc / setup->release_constant );
+        }
+        /* q -> q*a, then q -> q*b + (1-b) for the released charge */
+        *dq = b*(a * *dq + q*a*setup->step_time_calc/1000/
+                 (setup->trap_constant*setup->trap_constant));
+        return charge_trapping(q, setup);
+      }
+
       int rc_integrate(float *s_in, float *s_out, float tau, int time_steps){
         int   j;
         float s_in_old, s;  /* DCR: added so that it's okay to
@@ -423,6 +860,8 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
       */
       int signal_calc_finalize(MJD_Siggen_Setup *setup){
         fields_finalize(setup);
+        free(setup->sig_work);
+        setup->sig_work = NULL;
         free(setup->dpath_h);
         free(setup->dpath_e);
         return 0;
@@ -430,11 +869,11 @@ int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup) {
 
       int drift_path_e(point **pp, MJD_Siggen_Setup *setup){
         *pp = setup->dpath_e;
-        return setup->time_steps_calc;
+        return setup->path_len_e;
       }
       int drift_path_h(point **pp, MJD_Siggen_Setup *setup){
         *pp = setup->dpath_h;
-        return setup->time_steps_calc;
+        return setup->path_len_h;
       }
 
       /* tell
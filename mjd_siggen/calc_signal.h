@@ -21,6 +21,8 @@
 #define WP_THRESH 0.55
 #define WP_THRESH_ELECTRONS 1e-4 /*electrons are considered collected if
 				   they stop drifting where the wp is < this*/
+#define MAX_ELECTRODES 16 /* max number of electrodes (point contact + others)
+			     for get_signals() and make_signals() */
 
 typedef struct {
   float *s;
@@ -44,6 +46,33 @@ int get_signal(point pt, float *signal, MJD_Siggen_Setup *setup);
 
 int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup);
 
+/* get_signals calculate the signals for point pt on the point contact and on
+ * the setup->num_wpot_extra other electrodes (see set_wpot_extra() in fields.h),
+ * from a single drift of the charges. signal is assumed to have at least
+ * (1 + num_wpot_extra) * (number of time steps) elements, one signal after the other
+ * returns -1 if outside crystal
+ */
+int get_signals(point pt, float *signal, MJD_Siggen_Setup *setup);
+
+int make_signals(point pt, float *signal, float q, MJD_Siggen_Setup *setup);
+
+/* make_signal_sens calculates the (current) signal of charge q from point pt, as
+ * make_signal(), and its derivatives with respect to the SENS_* parameters
+ * (see mjd_siggen.h) in dsignal[p*time_steps_calc + t], which is assumed to
+ * have at least SENS_NPAR * time_steps_calc elements
+ * (r,z) field grid only; returns -1 if outside crystal
+ */
+int make_signal_sens(point pt, float *signal, float *dsignal, float q, MJD_Siggen_Setup *setup);
+
+/* make_signal_fd calculates the (current) signal of charge q from point pt, as
+ * make_signal(), and the signals for npert parameter sets that each change the
+ * SENS_* parameter par[k] by delta[k], all drifted in lockstep. signal is assumed to
+ * have at least (1 + npert) * time_steps_calc elements: the base signal first
+ * returns -1 if outside crystal
+ */
+int make_signal_fd(point pt, float *signal, int npert, const int *par, const float *delta,
+                   float q, MJD_Siggen_Setup *setup);
+
 /* signal_calc_finalize
  * Clean up
  */
@@ -56,7 +85,8 @@ int rc_integrate(float *s_in, float *s_out, float tau, int time_steps);
 
 /*drift paths for last calculated signal.
   after the call, "path" will point at a 1D array containing the points
-  (one per time step) of the drift path. 
+  (one per setup->path_step time steps) of the drift path; returns the number of points.
+  paths are only recorded if setup->path_step > 0 (set to 1 by signal_calc_init).
   freeing that pointer will break the code.
 */
 int drift_path_e(point **path, MJD_Siggen_Setup *setup);
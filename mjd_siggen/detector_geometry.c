@@ -1,85 +1,304 @@
 /* detector_geometry_ppc.c -- for "ppc" geometry
  * Karin Lagergren
  *
- * This module keeps track of the detector geometry
+ * This module keeps track of the detector geometry; the PPC, BEGe, ICPC and
+ * coaxial families are all described by the geometry parameters of
+ * MJD_Siggen_Setup (see mjd_siggen.h), as in mjd_fieldgen
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "detector_geometry.h"
+#include "calc_signal.h"
 #include "point.h"
 #include "cyl_point.h"
 
 
 #define SQ(x) ((x)*(x))
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+static int outside_rz(float r, float rp, float z, MJD_Siggen_Setup *setup);
+static float surface_distance(float r, float z, MJD_Siggen_Setup *setup);
+static int geometry_current(MJD_Siggen_Setup *setup);
+static float raster_distance(float r, float z, MJD_Siggen_Setup *setup);
+
 /* outside_detector
    returns 1 if pt is outside the detector, 0 if inside detector
 */
 int outside_detector(point pt, MJD_Siggen_Setup *setup){
-  float r, z, br, a;
+  float r, rp, d;
+
+  r = sqrt(SQ(pt.x)+SQ(pt.y));
+  d = raster_distance(r, pt.z, setup);
+  if (d != 0) return d < 0;
+  /* the point contact may be off-axis, for 3-D fields */
+  rp = r;
+  if (setup->pc_x_offset != 0 || setup->pc_y_offset != 0)
+    rp = sqrt(SQ(pt.x - setup->pc_x_offset) + SQ(pt.y - setup->pc_y_offset));
+  return outside_rz(r, rp, pt.z, setup);
+}
+
+int outside_detector_cyl(cyl_pt pt, MJD_Siggen_Setup *setup){
+  float d;
+
+  d = raster_distance(pt.r, pt.z, setup);
+  if (d != 0) return d < 0;
+  return outside_rz(pt.r, pt.r, pt.z, setup);
+}
+
+/* outside_rz
+   the exact test for outside_detector(), at radius r from the axis and
+   radius rp from the point contact axis
+*/
+static int outside_rz(float r, float rp, float z, MJD_Siggen_Setup *setup){
+  float br, a;
 
-  z = pt.z;
   if (z >= setup->zmax || z < 0) return 1;
 
-  r = sqrt(SQ(pt.x)+SQ(pt.y));
   if (r > setup->rmax) return 1;
   br = setup->top_bullet_radius;
   if (z > setup->zmax - br &&
       r > (setup->rmax - br) + sqrt(SQ(br)- SQ(z-(setup->zmax - br)))) return 1;
   if (setup->pc_radius > 0 &&
-      z <= setup->pc_length && r <= setup->pc_radius) {
+      z <= setup->pc_length && rp <= setup->pc_radius) {
     if (!setup->bulletize_PC) return 1;
     if (setup->pc_length > setup->pc_radius) {
       a = setup->pc_length - setup->pc_radius;
-      if (z < a || SQ(z-a) + SQ(r) < SQ(setup->pc_radius)) return 1;
+      if (z < a || SQ(z-a) + SQ(rp) < SQ(setup->pc_radius)) return 1;
     } else {
       a = setup->pc_radius - setup->pc_length;
-      if (r < a || SQ(z) + SQ(r-a) < SQ(setup->pc_length)) return 1;
+      if (rp < a || SQ(z) + SQ(rp-a) < SQ(setup->pc_length)) return 1;
     }
     return 0;
   }
   if (setup->taper_length > 0 && z < setup->taper_length &&
-      r > setup->zmax - setup->taper_length + z) return 1;
+      r > setup->rmax - setup->taper_length + z) return 1;
   if (setup->ditch_depth > 0 && z < setup->ditch_depth  &&
       setup->ditch_thickness > 0 && setup->wrap_around_radius > 0 &&
       r < setup->wrap_around_radius &&
       r > setup->wrap_around_radius - setup->ditch_thickness) return 1;
+  /* ICPC well */
+  if (setup->hole_length > 0 && r < setup->hole_radius &&
+      z > setup->zmax - setup->hole_length) return 1;
 
   return 0;
 }
 
-int outside_detector_cyl(cyl_pt pt, MJD_Siggen_Setup *setup){
-  float r, z, br, a;
-
-  z = pt.z;
-  if (z >= setup->zmax || z < 0) return 1;
+/* surface_distance
+   signed distance from (r,z) to the detector surface, > 0 inside, < 0 outside,
+   or a value closer to zero. The crystal is the cylinder less the shapes cut
+   from it (top bulletization, point contact, taper, ditch and well), each of which is
+   an intersection or union of half-planes and discs, so the distance is built
+   from the min() and max() of their signed distances
+*/
+static float surface_distance(float r, float z, MJD_Siggen_Setup *setup){
+  float d, s, a, br;
 
-  r = pt.r;
-  if (r > setup->rmax) return 1;
+  /* the cylinder */
+  d = MIN(z, setup->zmax - z);
+  d = MIN(d, setup->rmax - r);
+  /* top bulletization: outside the disc, in the corner */
   br = setup->top_bullet_radius;
-  if (z > setup->zmax - br &&
-      r > (setup->rmax - br) + sqrt(SQ(br)- SQ(z-(setup->zmax - br)))) return 1;
-  if (setup->pc_radius > 0 &&
-      z <= setup->pc_length && r <= setup->pc_radius) {
-    if (!setup->bulletize_PC) return 1;
-    if (setup->pc_length > setup->pc_radius) {
-      a = setup->pc_length - setup->pc_radius;
-      if (z < a || SQ(z-a) + SQ(r) < SQ(setup->pc_radius)) return 1;
+  if (br > 0) {
+    s = MIN(z - (setup->zmax - br), r - (setup->rmax - br));
+    s = MIN(s, sqrt(SQ(r - (setup->rmax - br)) + SQ(z - (setup->zmax - br))) - br);
+    d = MIN(d, -s);
+  }
+  /* point contact */
+  if (setup->pc_radius > 0) {
+    if (setup->pc_x_offset != 0 || setup->pc_y_offset != 0) {
+      /* off-axis; anywhere within its reach around the axis may be in it */
+      s = sqrt(SQ(setup->pc_x_offset) + SQ(setup->pc_y_offset)) + setup->pc_radius;
+      s = MIN(s - r, setup->pc_length - z);
+      d = MIN(d, (s > 0 ? 0 : -s));
     } else {
-      a = setup->pc_radius - setup->pc_length;
-      if (r < a || SQ(z) + SQ(r-a) < SQ(setup->pc_length)) return 1;
+      s = MIN(setup->pc_radius - r, setup->pc_length - z);
+      if (setup->bulletize_PC) {
+        if (setup->pc_length > setup->pc_radius) {
+          a = setup->pc_length - setup->pc_radius;
+          s = MIN(s, MAX(a - z, setup->pc_radius - sqrt(SQ(r) + SQ(z - a))));
+        } else {
+          a = setup->pc_radius - setup->pc_length;
+          s = MIN(s, MAX(a - r, setup->pc_length - sqrt(SQ(z) + SQ(r - a))));
+        }
+      }
+      d = MIN(d, -s);
     }
-    return 0;
   }
-  if (setup->taper_length > 0 && z < setup->taper_length &&
-      r > setup->zmax - setup->taper_length + z) return 1;
-  if (setup->ditch_depth > 0 && z < setup->ditch_depth  &&
-      setup->ditch_thickness > 0 && setup->wrap_around_radius > 0 &&
-      r < setup->wrap_around_radius &&
-      r > setup->wrap_around_radius - setup->ditch_thickness) return 1;
+  /* taper */
+  if (setup->taper_length > 0) {
+    s = MIN(setup->taper_length - z,
+            (r - z - (setup->rmax - setup->taper_length)) / sqrt(2.0));
+    d = MIN(d, -s);
+  }
+  /* ditch */
+  if (setup->ditch_depth > 0 && setup->ditch_thickness > 0 && setup->wrap_around_radius > 0) {
+    s = MIN(setup->ditch_depth - z, setup->wrap_around_radius - r);
+    s = MIN(s, r - (setup->wrap_around_radius - setup->ditch_thickness));
+    d = MIN(d, -s);
+  }
+  /* ICPC well */
+  if (setup->hole_length > 0 && setup->hole_radius > 0) {
+    s = MIN(setup->hole_radius - r, z - (setup->zmax - setup->hole_length));
+    d = MIN(d, -s);
+  }
+  return d;
+}
 
+/* geometry_current
+   returns 1 if setup->geom_sd was calculated for the present geometry
+*/
+static int geometry_current(MJD_Siggen_Setup *setup){
+  float *k = setup->geom_key;
+
+  return (setup->geom_sd != NULL &&
+          k[0]  == setup->xtal_length &&  k[1]  == setup->xtal_radius &&
+          k[2]  == setup->top_bullet_radius && k[3] == setup->pc_length &&
+          k[4]  == setup->pc_radius &&    k[5]  == setup->taper_length &&
+          k[6]  == setup->wrap_around_radius && k[7] == setup->ditch_depth &&
+          k[8]  == setup->ditch_thickness && k[9] == setup->pc_x_offset &&
+          k[10] == setup->pc_y_offset &&  k[11] == setup->rmax &&
+          k[12] == setup->zmax &&         k[13] == setup->bulletize_PC &&
+          k[14] == setup->hole_length &&  k[15] == setup->hole_radius);
+}
+
+/* geometry_setup
+   rasterize the signed distance to the detector surface on a uniform (r,z)
+   grid of step GEOM_STEP, in setup->geom_sd, for detector_distance()
+   returns 0 for success, -1 for failure
+*/
+int geometry_setup(MJD_Siggen_Setup *setup){
+  float *k = setup->geom_key, *sd;
+  int   i, j, rlen, zlen;
+
+  rlen = (int) ceil(setup->rmax/GEOM_STEP) + 1;
+  zlen = (int) ceil(setup->zmax/GEOM_STEP) + 1;
+  if (rlen < 2 || zlen < 2) return -1;
+  if (setup->geom_sd == NULL || rlen*zlen != setup->geom_rlen*setup->geom_zlen) {
+    if ((sd = realloc(setup->geom_sd, rlen*zlen*sizeof(*sd))) == NULL) {
+      error("realloc failed in geometry_setup\n");
+      return -1;
+    }
+    setup->geom_sd = sd;
+  }
+  setup->geom_rlen = rlen;
+  setup->geom_zlen = zlen;
+  for (i = 0; i < rlen; i++)
+    for (j = 0; j < zlen; j++)
+      setup->geom_sd[i*zlen + j] = surface_distance(i*GEOM_STEP, j*GEOM_STEP, setup);
+
+  k[0]  = setup->xtal_length;    k[1]  = setup->xtal_radius;
+  k[2]  = setup->top_bullet_radius; k[3] = setup->pc_length;
+  k[4]  = setup->pc_radius;      k[5]  = setup->taper_length;
+  k[6]  = setup->wrap_around_radius; k[7] = setup->ditch_depth;
+  k[8]  = setup->ditch_thickness; k[9] = setup->pc_x_offset;
+  k[10] = setup->pc_y_offset;    k[11] = setup->rmax;
+  k[12] = setup->zmax;           k[13] = setup->bulletize_PC;
+  k[14] = setup->hole_length;    k[15] = setup->hole_radius;
+  return 0;
+}
+
+/* raster_distance
+   distance from (r,z) to the detector surface interpolated from geom_sd, less
+   the largest interpolation error, so that the surface is at least that far
+   away; 0 for points near the surface or beyond the raster
+*/
+static float raster_distance(float r, float z, MJD_Siggen_Setup *setup){
+  float fr, fz, *sd, d;
+  int   i, j, zlen;
+
+  if (!geometry_current(setup) && geometry_setup(setup) != 0) return 0;
+  fr = r/GEOM_STEP;
+  fz = z/GEOM_STEP;
+  if (!(fz >= 0) || fr >= setup->geom_rlen - 1 || fz >= setup->geom_zlen - 1) return 0;
+  i = (int) fr;
+  j = (int) fz;
+  fr -= i;
+  fz -= j;
+  zlen = setup->geom_zlen;
+  sd = setup->geom_sd + i*zlen + j;
+  d = (1-fr)*((1-fz)*sd[0] + fz*sd[1]) + fr*((1-fz)*sd[zlen] + fz*sd[zlen+1]);
+  /* the distance changes by at most one cell diagonal from the nearest grid point */
+  if (d > GEOM_MARGIN)  return d - GEOM_MARGIN;
+  if (d < -GEOM_MARGIN) return d + GEOM_MARGIN;
   return 0;
 }
+
+float detector_distance(point pt, MJD_Siggen_Setup *setup){
+  return raster_distance(sqrt(SQ(pt.x)+SQ(pt.y)), pt.z, setup);
+}
+
+/* inside_detector_mask
+   sets mask[i] to 1 for each of the n points (r[i], phi[i], z[i]) inside the
+   detector, and to 0 for those outside; phi may be NULL if the geometry is
+   axially symmetric (no point contact offset)
+   returns the number of points inside
+*/
+int inside_detector_mask(const float *r, const float *phi, const float *z, int n,
+                         unsigned char *mask, MJD_Siggen_Setup *setup){
+  point pt;
+  float d;
+  int   i, ninside = 0, sym;
+
+  sym = (setup->pc_x_offset == 0 && setup->pc_y_offset == 0);
+  if (phi == NULL && !sym) return -1;
+  for (i = 0; i < n; i++) {
+    if (!(r[i] >= 0 && z[i] >= 0)) {
+      mask[i] = 0;
+      continue;
+    }
+    d = raster_distance(r[i], z[i], setup);
+    if (d != 0) {
+      mask[i] = (d > 0);
+    } else if (sym) {
+      mask[i] = !outside_rz(r[i], r[i], z[i], setup);
+    } else {
+      pt.x = r[i]*cos(phi[i]);
+      pt.y = r[i]*sin(phi[i]);
+      pt.z = z[i];
+      mask[i] = !outside_detector(pt, setup);
+    }
+    ninside += mask[i];
+  }
+  return ninside;
+}
+
+/* boundary_crossing
+   number of steps s along dx, from the point pt inside the detector, to where the
+   straight path first leaves it; the path is followed in steps as long as
+   detector_distance() shows to be safe, or of at most one step and half the
+   raster grid near the surface, and the crossing found by bisection of the last
+   returns s in (0, max_steps], or -1 if the path stays inside for max_steps
+*/
+float boundary_crossing(point pt, vector dx, float max_steps, MJD_Siggen_Setup *setup){
+  float len, h, s_in = 0, s_out, s, d;
+  int   i;
+
+  len = vector_length(dx);
+  if (len <= 0) return -1;
+  h = (len < 0.5f*GEOM_STEP ? len : 0.5f*GEOM_STEP);
+  for (;;) {
+    d = detector_distance(vector_add(pt, vector_scale(dx, s_in)), setup);
+    s = s_in + (d > h ? d : h)/len;
+    if (s > max_steps) {
+      if (s_in >= max_steps) return -1;
+      s = max_steps;
+    }
+    if (outside_detector(vector_add(pt, vector_scale(dx, s)), setup)) break;
+    s_in = s;
+  }
+  s_out = s;
+  for (i = 0; i < GEOM_BISECT && s_out - s_in > GEOM_CROSS_TOL; i++) {
+    s = 0.5f*(s_in + s_out);
+    if (outside_detector(vector_add(pt, vector_scale(dx, s)), setup)) s_out = s;
+    else s_in = s;
+  }
+  return s_out;
+}
 #undef SQ
+#undef MIN
+#undef MAX
@@ -1,7 +1,8 @@
 /* detector_geometry.h -- based on m3d2s.f by I-Yang Lee
  * Karin Lagergren
  *
- * This module keeps track of the detector geometry
+ * This module keeps track of the detector geometry, for all the detector
+ * families described in mjd_siggen.h
  */
 #ifndef _DETECTOR_GEOMETRY_H
 #define _DETECTOR_GEOMETRY_H
@@ -16,4 +17,41 @@
 int outside_detector(point pt, MJD_Siggen_Setup *setup);
 int outside_detector_cyl(cyl_pt pt, MJD_Siggen_Setup *setup);
 
+/* grid step of the rasterized distance to the detector surface, in mm,
+   and the largest error of its interpolation */
+#define GEOM_STEP   0.2f
+#define GEOM_MARGIN (GEOM_STEP*1.4142136f)
+/* bisection steps, and tolerance in time steps, of boundary_crossing() */
+#define GEOM_BISECT     24
+#define GEOM_CROSS_TOL  1e-4f
+
+/* geometry_setup
+   rasterize the signed distance to the detector surface in setup->geom_sd;
+   called as needed by the functions below whenever the geometry changes
+   returns 0 for success, -1 for failure
+*/
+int geometry_setup(MJD_Siggen_Setup *setup);
+
+/* detector_distance
+   distance from pt to the detector surface, positive inside and negative
+   outside; the surface is at least that far away. Returns 0 near the
+   surface, where only outside_detector() can tell
+*/
+float detector_distance(point pt, MJD_Siggen_Setup *setup);
+
+/* inside_detector_mask
+   mask[i] = 1 for the points (r[i], phi[i], z[i]) inside the detector, 0 outside;
+   phi may be NULL for detectors with a centred point contact
+   returns the number of points inside, or -1 if phi is needed but NULL
+*/
+int inside_detector_mask(const float *r, const float *phi, const float *z, int n,
+                         unsigned char *mask, MJD_Siggen_Setup *setup);
+
+/* boundary_crossing
+   number of steps s (not necessarily whole) along dx, from the point pt inside
+   the detector, to the detector surface
+   returns s in (0, max_steps], or -1 if the surface is not reached in max_steps
+*/
+float boundary_crossing(point pt, vector dx, float max_steps, MJD_Siggen_Setup *setup);
+
 #endif /*#ifndef _DETECTOR_GEOMETRY_H*/
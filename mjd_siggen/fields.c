@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stddef.h>
 
 #include "mjd_siggen.h"
 #include "point.h"
@@ -23,6 +24,24 @@
 //#include "../siggen.h"
 
 #define MAX_FNAME_LEN 512
+/* coefficients of the resampled drift velocity table, setup->v_table */
+#define VT_A     0
+#define VT_B     1
+#define VT_C     2
+#define VT_BP    3
+#define VT_CP    4
+#define VT_DVDE  5   // d(v_100)/dE over the interval that starts at each point
+#define VT_NCOEF 6
+#define VT_MAX_LEN 20001
+/* field-magnitude terms of the velocity_type 1 hole model, setup->h_table */
+#define HT_V100   0   // v_100
+#define HT_LAMBDA 1   // v_100 * lambda(k_0)
+#define HT_OMEGA  2   // v_100 * omega(k_0)
+#define HT_NCOEF  3
+#define HT_LEN    1024    // points, log-spaced in |E| from HT_EMIN to HT_EMAX
+#define HT_EMIN   1.0f    // V/cm; fields outside HT_EMIN..HT_EMAX use the exact model
+#define HT_EMAX   1.0e4f
+#define HT_LSTEP  (logf(HT_EMAX/HT_EMIN)/(HT_LEN - 1))
 
 static int nearest_field_grid_index(cyl_pt pt, cyl_int_pt *ipt, MJD_Siggen_Setup *setup);
 static int grid_weights(cyl_pt pt, cyl_int_pt ipt, float out[2][2], MJD_Siggen_Setup *setup);
@@ -31,16 +50,30 @@ static int setup_efield(MJD_Siggen_Setup *setup);
 static int setup_wp(MJD_Siggen_Setup *setup);
 static int setup_velo(MJD_Siggen_Setup *setup);
 static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup);
-
-static int find_hole_velo(float field, float theta, float phi, point* v_spher, MJD_Siggen_Setup* setup );
+static int field_grid_index(float x, float xmin, float step, float *grid, int *lookup,
+                            float lookup_step, int len, float *local_step);
+static int *field_grid_lookup(float *grid, int len, float *lookup_step);
+static int field3_interp(point pt, float e[4], int *corner, float w3[8], MJD_Siggen_Setup *setup);
+static int wpot_interp(point pt, float *wp, int n, MJD_Siggen_Setup *setup);
+static int velocity_from_field(float abse, point cart_en, float q, vector *velo, MJD_Siggen_Setup *setup);
+
+static int find_hole_velo(float field, point en, vector *velo, MJD_Siggen_Setup* setup );
+static void hole_velo_terms(float field, velocity_params *par, float t[HT_NCOEF]);
+static unsigned int layout_mix(unsigned int h, size_t v);
 static float drift_velo_model(float E, float mu_0, float beta, float E_0);
 
 static cyl_pt get_efld_grad(int row, int col,  MJD_Siggen_Setup *setup);
 static cyl_pt get_efld_pc(int row, int col, int grad, int imp, MJD_Siggen_Setup *setup);
+static cyl_pt get_efld_grad_sens(int row, int col, cyl_pt de[2], MJD_Siggen_Setup *setup);
 static float get_wpot_pc(int row, int col,  MJD_Siggen_Setup *setup);
 static int imp_weights( float out[2][2], MJD_Siggen_Setup *setup);
 static int pc_weights( float out[2][2], MJD_Siggen_Setup *setup);
 
+/* last generation given to a field grid, by field_setup() or set_field_grid(); the
+   (setup, generation) pair identifies the grid for the last-point cache of
+   nearest_field_grid_index() */
+static int field_grid_count = 0;
+
 // static float get_wpot_by_index(int row, int col, MJD_Siggen_Setup* setup );
 // static float get_efld_r_by_index(int row, int col, MJD_Siggen_Setup* setup );
 // static float get_efld_z_by_index(int row, int col, MJD_Siggen_Setup* setup );
@@ -58,6 +91,7 @@ int field_setup(MJD_Siggen_Setup *setup){
   setup->zmin  = 0;
   setup->zmax  = setup->xtal_length;
   setup->zstep = setup->xtal_grid;
+  setup->field_grid_gen = ++field_grid_count;
   if (setup->xtal_temp < MIN_TEMP) setup->xtal_temp = MIN_TEMP;
   if (setup->xtal_temp > MAX_TEMP) setup->xtal_temp = MAX_TEMP;
 
@@ -89,16 +123,18 @@ int field_setup(MJD_Siggen_Setup *setup){
 
 static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
   cyl_int_pt ipt;
-  char ptstr[MAX_LINE];
+  char ptstr[MAX_LINE] = "";
   int  i, j, ir, iz, imp, grad;
-  sprintf(ptstr, "(r,z) = (%.1f,%.1f)", pt.r, pt.z);
+  if (setup->verbosity >= CHATTY) sprintf(ptstr, "(r,z) = (%.1f,%.1f)", pt.r, pt.z);
   if (outside_detector_cyl(pt, setup)){
     TELL_CHATTY("point %s is outside crystal\n", ptstr);
     return 0;
   }
-  ipt.r = (pt.r - setup->rmin)/setup->rstep;
+  ipt.r = field_grid_index(pt.r, setup->rmin, setup->rstep, setup->r_grid,
+                           setup->r_grid_lookup, setup->r_lookup_step, setup->rlen, NULL);
   ipt.phi = 0;
-  ipt.z = (pt.z - setup->zmin)/setup->zstep;
+  ipt.z = field_grid_index(pt.z, setup->zmin, setup->zstep, setup->z_grid,
+                           setup->z_grid_lookup, setup->z_lookup_step, setup->zlen, NULL);
   imp = ( setup->avg_imp - setup->min_avg_imp  )/ setup->avg_imp_step  ;
   grad = ( setup->imp_grad - setup->min_imp_grad  )/ setup->imp_grad_step  ;
   int  len, rad;
@@ -172,23 +208,54 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
   returns 0 for success, 1 on failure
   */
   int wpotential(point pt, float *wp, MJD_Siggen_Setup *setup){
-    float w[2][2];
-    int   i, j;
+    return wpot_interp(pt, wp, 0, setup);
+  }
+
+  /* wpotentials
+  gives the (interpolated) weighting potentials at point pt of the point contact,
+  in wp[0], and of the other electrodes set by set_wpot_extra(), in wp[1..num_wpot_extra]
+  returns 0 for success, 1 on failure
+  */
+  int wpotentials(point pt, float *wp, MJD_Siggen_Setup *setup){
+    return wpot_interp(pt, wp, setup->num_wpot_extra, setup);
+  }
+
+  /* wpot_interp
+  weighting potential of the point contact in wp[0], and of the first n
+  extra electrodes in wp[1..n], all from the same grid cell and weights
+  */
+  static int wpot_interp(point pt, float *wp, int n, MJD_Siggen_Setup *setup){
+    float w[2][2], w3[8], e3[4], *p;
+    int   i, j, k, corner;
     cyl_int_pt ipt;
     cyl_pt cyl;
 
+    for (k = 1; k <= n; k++) wp[k] = 0.0;
+    if (setup->field3) {     // 3-D field grid
+      if (field3_interp(pt, e3, &corner, w3, setup) < 0) return 1;
+      wp[0] = e3[3];
+      for (i = 0; i < 8 && n > 0; i++) {
+        p = setup->wpot_extra + n*(corner + (i>>2)*setup->ylen3*setup->zlen3 +
+                                   ((i>>1)&1)*setup->zlen3 + (i&1));
+        for (k = 0; k < n; k++) wp[k+1] += w3[i]*p[k];
+      }
+      return 0;
+    }
     // cyl = cart_to_cyl(pt);  // do not need to know phi, so save call to atan
     cyl.r = sqrt(pt.x*pt.x + pt.y*pt.y);
     cyl.z = pt.z;
 
     if (nearest_field_grid_index(cyl, &ipt, setup) < 0) return 1;
     grid_weights(cyl, ipt, w, setup);
-    *wp = 0.0;
+    wp[0] = 0.0;
     for (i = 0; i < 2; i++){
       for (j = 0; j < 2; j++){
         // *wp += w[i][j]* get_wpot_by_index(ipt.r+i, ipt.z+j, setup );
         // *wp += w[i][j]* setup->wpot[ipt.r+i][ipt.z+j];
-          *wp +=  w[i][j]*get_wpot_pc(ipt.r+i, ipt.z+j,  setup);
+          wp[0] +=  w[i][j]*get_wpot_pc(ipt.r+i, ipt.z+j,  setup);
+          if (n == 0) continue;
+          p = setup->wpot_extra + n*((ipt.r+i)*setup->zlen + ipt.z+j);
+          for (k = 0; k < n; k++) wp[k+1] += w[i][j]*p[k];
       }
     }
     // printf("higher wpot %f\n", *wp);
@@ -200,10 +267,7 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
     point  cart_en;
     cyl_pt e, en, cyl;
     cyl_int_pt ipt;
-    int   i, sign;
-    float abse, absv, f, a, b, c;
-    float bp, cp, en4, en6;
-    struct velocity_lookup *v_lookup1, *v_lookup2;
+    float abse, e3[4];
 
     /*  DCR: replaced this with faster code below, saves calls to atan and tan
     cyl = cart_to_cyl(pt);
@@ -213,39 +277,46 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
     en.phi = cyl.phi;
     cart_en = cyl_to_cart(en);
     */
-    cyl.r = sqrt(pt.x*pt.x + pt.y*pt.y);
-    cyl.z = pt.z;
-    cyl.phi = 0;
-    if (nearest_field_grid_index(cyl, &ipt, setup) < 0) return -1;
-    e = efield(cyl, ipt, setup);
-    abse = vector_norm_cyl(e, &en);
-    if (cyl.r > 0.001) {
-      cart_en.x = en.r * pt.x/cyl.r;
-      cart_en.y = en.r * pt.y/cyl.r;
+    if (setup->field3) {     // 3-D field grid
+      if (field3_interp(pt, e3, NULL, NULL, setup) < 0) return -1;
+      abse = sqrt(e3[0]*e3[0] + e3[1]*e3[1] + e3[2]*e3[2]);
+      if (abse > 0) {
+        cart_en.x = e3[0]/abse;
+        cart_en.y = e3[1]/abse;
+        cart_en.z = e3[2]/abse;
+      } else {
+        cart_en.x = cart_en.y = cart_en.z = 0;
+      }
     } else {
-      cart_en.x = cart_en.y = 0;
+      cyl.r = sqrt(pt.x*pt.x + pt.y*pt.y);
+      cyl.z = pt.z;
+      cyl.phi = 0;
+      if (nearest_field_grid_index(cyl, &ipt, setup) < 0) return -1;
+      e = efield(cyl, ipt, setup);
+      abse = vector_norm_cyl(e, &en);
+      if (cyl.r > 0.001) {
+        cart_en.x = en.r * pt.x/cyl.r;
+        cart_en.y = en.r * pt.y/cyl.r;
+      } else {
+        cart_en.x = cart_en.y = 0;
+      }
+      cart_en.z = en.z;
     }
-    cart_en.z = en.z;
-
-    if (q == 1){
-      if (setup->velocity_type == 1){
-        //    drift_velocity_python(pt, e, cart_en, q, velo, setup);
-
-        //      printf("velo params: %f, %f, %f\n",  setup->v_params->h_100_mu0, setup->v_params->h_100_beta, setup->v_params->h_100_e0);
-
-        //phi and theta are the directions of the e-field
-        float phi = atan2(cart_en.y,cart_en.x);
-        float theta = acos(cart_en.z  );
 
-        //This is unseemly, but velo_local is in rotated coordinates
-        point velo_local;
-        find_hole_velo(abse, theta, phi, &velo_local, setup);
+    return velocity_from_field(abse, cart_en, q, velo, setup);
+  }
 
-        //rotate back
-        velo->x = cos(phi)*sin(theta)*velo_local.x + cos(phi)*cos(theta)*velo_local.y - sin(phi)*velo_local.z;
-        velo->y = sin(phi)*sin(theta)*velo_local.x + sin(phi)*cos(theta)*velo_local.y + cos(phi)*velo_local.z;
-        velo->z = cos(theta)*velo_local.x - sin(theta)*velo_local.y;
+  /* velocity_from_field
+  drift velocity for charge q in a field of strength abse (V/cm) along the unit vector cart_en
+  */
+  static int velocity_from_field(float abse, point cart_en, float q, vector *velo, MJD_Siggen_Setup *setup){
+    int   i, n, sign;
+    float absv, f, a, b, c;
+    float bp, cp, en4, en6, *tab;
 
+    if (q == 1){
+      if (setup->velocity_type == 1){
+        find_hole_velo(abse, cart_en, velo, setup);
         return 0;
       }
       else{
@@ -253,26 +324,20 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
       }
     }
 
-    /* find location in table to interpolate from */
-    for (i = 0; i < setup->v_lookup_len - 2 && abse > setup->v_lookup[i+1].e; i++);
-    v_lookup1 = setup->v_lookup + i;
-    v_lookup2 = setup->v_lookup + i+1;
-    f = (abse - v_lookup1->e)/(v_lookup2->e - v_lookup1->e);
-    if (q > 0){
-      a = (v_lookup2->ha - v_lookup1->ha)*f+v_lookup1->ha;
-      b = (v_lookup2->hb- v_lookup1->hb)*f+v_lookup1->hb;
-      c = (v_lookup2->hc - v_lookup1->hc)*f+v_lookup1->hc;
-      bp = (v_lookup2->hbp- v_lookup1->hbp)*f+v_lookup1->hbp;
-      cp = (v_lookup2->hcp - v_lookup1->hcp)*f+v_lookup1->hcp;
-      setup->dv_dE = (v_lookup2->h100 - v_lookup1->h100)/(v_lookup2->e - v_lookup1->e);
-    }else{
-      a = (v_lookup2->ea - v_lookup1->ea)*f+v_lookup1->ea;
-      b = (v_lookup2->eb- v_lookup1->eb)*f+v_lookup1->eb;
-      c = (v_lookup2->ec - v_lookup1->ec)*f+v_lookup1->ec;
-      bp = (v_lookup2->ebp- v_lookup1->ebp)*f+v_lookup1->ebp;
-      cp = (v_lookup2->ecp - v_lookup1->ecp)*f+v_lookup1->ecp;
-      setup->dv_dE = (v_lookup2->e100 - v_lookup1->e100)/(v_lookup2->e - v_lookup1->e);
-    }
+    /* find location in the uniform table to interpolate from;
+    fields beyond its end are extrapolated from the last interval */
+    if (setup->v_table == NULL && resample_velocity_table(setup) != 0) return -1;
+    n = setup->v_table_len;
+    f = abse/setup->v_table_step;
+    i = (f < n - 2 ? (int) f : n - 2);
+    f -= i;
+    tab = setup->v_table + (q > 0 ? 0 : VT_NCOEF*n) + i;
+    a  = (tab[VT_A*n + 1]  - tab[VT_A*n])*f  + tab[VT_A*n];
+    b  = (tab[VT_B*n + 1]  - tab[VT_B*n])*f  + tab[VT_B*n];
+    c  = (tab[VT_C*n + 1]  - tab[VT_C*n])*f  + tab[VT_C*n];
+    bp = (tab[VT_BP*n + 1] - tab[VT_BP*n])*f + tab[VT_BP*n];
+    cp = (tab[VT_CP*n + 1] - tab[VT_CP*n])*f + tab[VT_CP*n];
+    setup->dv_dE = tab[VT_DVDE*n];
     /* velocity can vary from the direction of the el. field
     due to effect of crystal axes */
     #define POW4(x) ((x)*(x)*(x)*(x))
@@ -293,6 +358,210 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
     return 0;
   }
 
+  /* field_sens
+  (E_r, E_z) at pt from the (r,z) grid, as in efield(), in e[2], and its derivatives
+  de[k] with respect to r, z, avg_imp and imp_grad (k = 0..3), from the derivatives
+  of the grid_weights() and imp_weights() interpolation weights
+  returns <0 if pt is outside the field
+  */
+  static int field_sens(cyl_pt pt, float e[2], float de[4][2], MJD_Siggen_Setup *setup){
+    cyl_int_pt ipt;
+    cyl_pt ec, dec[2];
+    float  w[2][2], dw[2][2][2], a, b, dr, dz;
+    int    i, j, k;
+
+    if (nearest_field_grid_index(pt, &ipt, setup) < 0) return -1;
+    grid_weights(pt, ipt, w, setup);
+    dr = (setup->r_grid ? setup->r_grid[ipt.r+1] - setup->r_grid[ipt.r] : setup->rstep);
+    dz = (setup->z_grid ? setup->z_grid[ipt.z+1] - setup->z_grid[ipt.z] : setup->zstep);
+    a = w[1][0] + w[1][1];   // fractional position in the cell along r
+    b = w[0][1] + w[1][1];   // and along z
+    for (i = 0; i < 2; i++) {
+      for (j = 0; j < 2; j++) {
+        dw[0][i][j] = (i ? 1.0 : -1.0) * (j ? b : 1.0 - b) / dr;
+        dw[1][i][j] = (j ? 1.0 : -1.0) * (i ? a : 1.0 - a) / dz;
+      }
+    }
+
+    e[0] = e[1] = 0;
+    for (k = 0; k < 4; k++) de[k][0] = de[k][1] = 0;
+    for (i = 0; i < 2; i++){
+      for (j = 0; j < 2; j++){
+        ec = get_efld_grad_sens(ipt.r + i, ipt.z + j, dec, setup);
+        e[0] += ec.r*w[i][j];
+        e[1] += ec.z*w[i][j];
+        for (k = 0; k < 2; k++) {
+          de[k][0] += ec.r*dw[k][i][j];
+          de[k][1] += ec.z*dw[k][i][j];
+          de[k+2][0] += dec[k].r*w[i][j];
+          de[k+2][1] += dec[k].z*w[i][j];
+        }
+      }
+    }
+    return 0;
+  }
+
+  /* velocity_of_evec
+  drift velocity for charge q in the field e[3] (cartesian, V/cm)
+  */
+  static int velocity_of_evec(float e[3], float q, vector *velo, MJD_Siggen_Setup *setup){
+    point cart_en;
+    float abse;
+
+    abse = sqrt(e[0]*e[0] + e[1]*e[1] + e[2]*e[2]);
+    if (abse > 0) {
+      cart_en.x = e[0]/abse;
+      cart_en.y = e[1]/abse;
+      cart_en.z = e[2]/abse;
+    } else {
+      cart_en.x = cart_en.y = cart_en.z = 0;
+    }
+    return velocity_from_field(abse, cart_en, q, velo, setup);
+  }
+
+  /* drift_velocity_sens
+  drift velocity for charge q at pt, as drift_velocity(), and its derivatives
+  dv_dx[i][j] = dv_i/dx_j and dv_dp[p][i] = dv_i/d(parameter p), for the SENS_*
+  parameters (see mjd_siggen.h; the entries for x, y, z and trap_constant are 0)
+  the derivatives of the field are analytic; those of the velocity model, with
+  respect to the field vector and the hole mobility parameters, are central
+  differences of the model alone, which needs no field lookups
+  (r,z) field grid only; returns -1 for failure or a 3-D field grid
+  */
+  int drift_velocity_sens(point pt, float q, vector *velo, float dv_dx[3][3],
+                          float dv_dp[SENS_NPAR][3], MJD_Siggen_Setup *setup){
+    cyl_pt cyl;
+    vector vp, vm;
+    float  e[2], de[4][2], ec[3], dec_dx[3][3], dec_dp[2][3], dv_de[3][3], h, c, s, save;
+    float  *hole_par[6];
+    int    i, j, k, table_ok;
+
+    if (setup->field3) return -1;
+    cyl.r = sqrt(pt.x*pt.x + pt.y*pt.y);
+    cyl.z = pt.z;
+    cyl.phi = 0;
+    if (field_sens(cyl, e, de, setup) < 0) return -1;
+
+    /* field and its derivatives in cartesian coordinates */
+    if (cyl.r > 0.001) {
+      c = pt.x/cyl.r;
+      s = pt.y/cyl.r;
+    } else {
+      c = s = 0;
+    }
+    ec[0] = e[0]*c;
+    ec[1] = e[0]*s;
+    ec[2] = e[1];
+    dec_dx[0][0] = de[0][0]*c*c + (cyl.r > 0.001 ? e[0]*s*s/cyl.r : 0);
+    dec_dx[0][1] = de[0][0]*c*s - (cyl.r > 0.001 ? e[0]*c*s/cyl.r : 0);
+    dec_dx[1][0] = dec_dx[0][1];
+    dec_dx[1][1] = de[0][0]*s*s + (cyl.r > 0.001 ? e[0]*c*c/cyl.r : 0);
+    dec_dx[0][2] = de[1][0]*c;
+    dec_dx[1][2] = de[1][0]*s;
+    dec_dx[2][0] = de[0][1]*c;
+    dec_dx[2][1] = de[0][1]*s;
+    dec_dx[2][2] = de[1][1];
+    for (k = 0; k < 2; k++) {
+      dec_dp[k][0] = de[k+2][0]*c;
+      dec_dp[k][1] = de[k+2][0]*s;
+      dec_dp[k][2] = de[k+2][1];
+    }
+
+    /* Jacobian of the velocity model with respect to the field vector */
+    h = 1e-3*sqrt(e[0]*e[0] + e[1]*e[1]) + 1e-3;
+    for (j = 0; j < 3; j++) {
+      save = ec[j];
+      ec[j] = save + h;
+      velocity_of_evec(ec, q, &vp, setup);
+      ec[j] = save - h;
+      velocity_of_evec(ec, q, &vm, setup);
+      ec[j] = save;
+      dv_de[0][j] = (vp.x - vm.x)/(2*h);
+      dv_de[1][j] = (vp.y - vm.y)/(2*h);
+      dv_de[2][j] = (vp.z - vm.z)/(2*h);
+    }
+
+    for (i = 0; i < 3; i++) {
+      for (j = 0; j < 3; j++) {
+        dv_dx[i][j] = 0;
+        for (k = 0; k < 3; k++) dv_dx[i][j] += dv_de[i][k]*dec_dx[k][j];
+      }
+    }
+    for (k = 0; k < SENS_NPAR; k++) dv_dp[k][0] = dv_dp[k][1] = dv_dp[k][2] = 0;
+    for (k = 0; k < 2; k++) {
+      for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) dv_dp[SENS_AVG_IMP + k][i] += dv_de[i][j]*dec_dp[k][j];
+      }
+    }
+
+    /* hole mobility parameters only enter the velocity_type 1 hole model */
+    if (q == 1 && setup->velocity_type == 1) {
+      hole_par[0] = &setup->v_params->h_100_mu0;
+      hole_par[1] = &setup->v_params->h_100_beta;
+      hole_par[2] = &setup->v_params->h_100_e0;
+      hole_par[3] = &setup->v_params->h_111_mu0;
+      hole_par[4] = &setup->v_params->h_111_beta;
+      hole_par[5] = &setup->v_params->h_111_e0;
+      table_ok = setup->h_table_ok;
+      setup->h_table_ok = 0;   // h_table is not for the perturbed values
+      for (k = 0; k < 6; k++) {
+        save = *hole_par[k];
+        h = 1e-3*fabs(save) + 1e-6;
+        *hole_par[k] = save + h;
+        velocity_of_evec(ec, q, &vp, setup);
+        *hole_par[k] = save - h;
+        velocity_of_evec(ec, q, &vm, setup);
+        *hole_par[k] = save;
+        dv_dp[SENS_H100_MU0 + k][0] = (vp.x - vm.x)/(2*h);
+        dv_dp[SENS_H100_MU0 + k][1] = (vp.y - vm.y)/(2*h);
+        dv_dp[SENS_H100_MU0 + k][2] = (vp.z - vm.z)/(2*h);
+      }
+      setup->h_table_ok = table_ok;
+    }
+
+    /* last, so that dv_dE and v_over_E are left as for drift_velocity() */
+    return drift_velocity(pt, q, velo, setup);
+  }
+
+  /* wpotential_sens
+  weighting potential of the point contact at pt, as wpotential(), and its
+  gradient dwp[3] with respect to (x, y, z)
+  (r,z) field grid only; returns 0 for success, 1 on failure
+  */
+  int wpotential_sens(point pt, float *wp, float dwp[3], MJD_Siggen_Setup *setup){
+    float w[2][2], a, b, dr, dz, wc, dw_dr = 0, dw_dz = 0;
+    int   i, j;
+    cyl_int_pt ipt;
+    cyl_pt cyl;
+
+    if (setup->field3) return 1;
+    cyl.r = sqrt(pt.x*pt.x + pt.y*pt.y);
+    cyl.z = pt.z;
+    if (nearest_field_grid_index(cyl, &ipt, setup) < 0) return 1;
+    grid_weights(cyl, ipt, w, setup);
+    dr = (setup->r_grid ? setup->r_grid[ipt.r+1] - setup->r_grid[ipt.r] : setup->rstep);
+    dz = (setup->z_grid ? setup->z_grid[ipt.z+1] - setup->z_grid[ipt.z] : setup->zstep);
+    a = w[1][0] + w[1][1];
+    b = w[0][1] + w[1][1];
+    *wp = 0.0;
+    for (i = 0; i < 2; i++){
+      for (j = 0; j < 2; j++){
+        wc = get_wpot_pc(ipt.r+i, ipt.z+j, setup);
+        *wp += w[i][j]*wc;
+        dw_dr += (i ? 1.0 : -1.0) * (j ? b : 1.0 - b) / dr * wc;
+        dw_dz += (j ? 1.0 : -1.0) * (i ? a : 1.0 - a) / dz * wc;
+      }
+    }
+    if (cyl.r > 0.001) {
+      dwp[0] = dw_dr*pt.x/cyl.r;
+      dwp[1] = dw_dr*pt.y/cyl.r;
+    } else {
+      dwp[0] = dwp[1] = 0;
+    }
+    dwp[2] = dw_dz;
+    return 0;
+  }
+
   static cyl_pt get_efld_grad(int row, int col,  MJD_Siggen_Setup *setup){
     cyl_pt e = {0,0,0};
     cyl_pt e_tmp;
@@ -328,6 +597,43 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
     return e;
   }
 
+  /* get_efld_grad_sens
+  field at grid point (row, col), as get_efld_grad(), and its derivatives
+  de[0] with respect to avg_imp and de[1] with respect to imp_grad
+  */
+  static cyl_pt get_efld_grad_sens(int row, int col, cyl_pt de[2], MJD_Siggen_Setup *setup){
+    cyl_pt e = {0,0,0};
+    cyl_pt e_tmp;
+    float  w[2][2], imp_f, grad_f, dw;
+    int    i, j, imp, grad;
+
+    de[0].r = de[0].z = de[1].r = de[1].z = 0;
+    if ((setup->num_grads ==1) || (setup->num_imps == 1)){
+      return get_efld_grad(row, col, setup);
+    }
+
+    imp_weights( w, setup);
+    imp = ( setup->avg_imp - setup->min_avg_imp  )/ setup->avg_imp_step  ;
+    grad = ( setup->imp_grad - setup->min_imp_grad  )/ setup->imp_grad_step  ;
+    imp_f = ( setup->avg_imp - setup->min_avg_imp  ) /  setup->avg_imp_step     - imp ;
+    grad_f = ( setup->imp_grad - setup->min_imp_grad)   /  setup->imp_grad_step - grad  ;
+
+    for ( i = 0; i < 2; i++){
+      for ( j = 0; j < 2; j++){
+        e_tmp = get_efld_pc(row, col, grad + i, imp + j,  setup);
+        e.r += e_tmp.r*w[i][j];
+        e.z += e_tmp.z*w[i][j];
+        dw = (j ? 1.0 : -1.0) * (i ? grad_f : 1.0 - grad_f) / setup->avg_imp_step;
+        de[0].r += e_tmp.r*dw;
+        de[0].z += e_tmp.z*dw;
+        dw = (i ? 1.0 : -1.0) * (j ? imp_f : 1.0 - imp_f) / setup->imp_grad_step;
+        de[1].r += e_tmp.r*dw;
+        de[1].z += e_tmp.z*dw;
+      }
+    }
+    return e;
+  }
+
   static cyl_pt get_efld_pc(int row, int col, int grad, int imp, MJD_Siggen_Setup *setup){
     cyl_pt e = {0,0,0};
 
@@ -410,8 +716,16 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
     MJD_Siggen_Setup *setup){
       float r, z;
 
-      r = (pt.r - setup->rmin)/setup->rstep - ipt.r;
-      z = (pt.z - setup->zmin)/setup->zstep - ipt.z;
+      if (setup->r_grid) {   // graded grid
+        r = (pt.r - setup->r_grid[ipt.r]) / (setup->r_grid[ipt.r+1] - setup->r_grid[ipt.r]);
+      } else {
+        r = (pt.r - setup->rmin)/setup->rstep - ipt.r;
+      }
+      if (setup->z_grid) {
+        z = (pt.z - setup->z_grid[ipt.z]) / (setup->z_grid[ipt.z+1] - setup->z_grid[ipt.z]);
+      } else {
+        z = (pt.z - setup->zmin)/setup->zstep - ipt.z;
+      }
 
       out[0][0] = (1.0 - r) * (1.0 - z);
       out[0][1] = (1.0 - r) *        z;
@@ -475,33 +789,45 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
           0 if interpolation is okay
           1 if we can find a point but extrapolation is needed
           */
-          static cyl_pt  last_pt;
-          static cyl_int_pt last_ipt;
-          static int     last_ret = -99;
+          static THREAD_LOCAL cyl_pt  last_pt;
+          static THREAD_LOCAL cyl_int_pt last_ipt;
+          static THREAD_LOCAL int     last_ret = -99, last_gen;
+          static THREAD_LOCAL MJD_Siggen_Setup *last_setup = NULL;
           cyl_pt new_pt;
           int    dr, dz;
           float  d[3] = {0.0, -1.0, 1.0};
+          float  rstep, zstep;  // local grid step sizes around pt
 
-          if (last_ret != -99 &&
+          if (last_ret != -99 && setup == last_setup && setup->field_grid_gen == last_gen &&
             pt.r == last_pt.r && pt.z == last_pt.z) {
               *ipt = last_ipt;
               return last_ret;
             }
             last_pt = pt;
+            last_setup = setup;
+            last_gen = setup->field_grid_gen;
             last_ret = -2;
 
             if (outside_detector_cyl(pt, setup)) {
               last_ret = -1;
             } else{
               new_pt.phi = 0.0;
+              field_grid_index(pt.r, setup->rmin, setup->rstep, setup->r_grid,
+                               setup->r_grid_lookup, setup->r_lookup_step, setup->rlen, &rstep);
+              field_grid_index(pt.z, setup->zmin, setup->zstep, setup->z_grid,
+                               setup->z_grid_lookup, setup->z_lookup_step, setup->zlen, &zstep);
               for (dz=0; dz<3; dz++) {
-                new_pt.z = pt.z + d[dz]*setup->zstep;
+                new_pt.z = pt.z + d[dz]*zstep;
                 for (dr=0; dr<3; dr++) {
-                  new_pt.r = pt.r + d[dr]*setup->rstep;
+                  new_pt.r = pt.r + d[dr]*rstep;
                   if (efield_exists(new_pt, setup)) {
-                    last_ipt.r = (new_pt.r - setup->rmin)/setup->rstep;
+                    last_ipt.r = field_grid_index(new_pt.r, setup->rmin, setup->rstep, setup->r_grid,
+                                                  setup->r_grid_lookup, setup->r_lookup_step,
+                                                  setup->rlen, NULL);
                     last_ipt.phi = 0;
-                    last_ipt.z = (new_pt.z - setup->zmin)/setup->zstep;
+                    last_ipt.z = field_grid_index(new_pt.z, setup->zmin, setup->zstep, setup->z_grid,
+                                                  setup->z_grid_lookup, setup->z_lookup_step,
+                                                  setup->zlen, NULL);
                     *ipt = last_ipt;
                     if (dr == 0 && dz == 0) {
                       last_ret = 0;
@@ -517,22 +843,236 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
             return last_ret;
           }
 
+          /* field_grid_index
+          index of the field grid point at or below x along one axis (r or z),
+          using the uniform step unless a graded grid has been set by set_field_grid();
+          the local grid step at x is returned in *local_step if it is not NULL
+          */
+          static int field_grid_index(float x, float xmin, float step, float *grid, int *lookup,
+                                      float lookup_step, int len, float *local_step){
+            int i;
+
+            if (grid == NULL) {
+              if (local_step) *local_step = step;
+              return (x - xmin)/step;
+            }
+            if (x < grid[0]) {
+              i = (x - grid[0])/(grid[1] - grid[0]);
+            } else if (x >= grid[len-1]) {
+              i = len - 1 + (int) ((x - grid[len-1])/(grid[len-1] - grid[len-2]));
+            } else {
+              // the lookup table bins are no bigger than the smallest grid step
+              i = lookup[(int) ((x - grid[0])/lookup_step)];
+              while (i < len-2 && grid[i+1] <= x) i++;
+            }
+            if (local_step) {
+              if (i < 0) *local_step = grid[1] - grid[0];
+              else if (i >= len-1) *local_step = grid[len-1] - grid[len-2];
+              else *local_step = grid[i+1] - grid[i];
+            }
+            return i;
+          }
+
+          /* field_grid_lookup
+          make the table of grid indices at or below x, in bins of the smallest
+          grid step, for fast lookup of field_grid_index() on a graded grid
+          returns NULL if the grid is not increasing or malloc fails
+          */
+          static int *field_grid_lookup(float *grid, int len, float *lookup_step){
+            int   *lookup, i, j, nbins;
+            float step;
+
+            step = grid[len-1] - grid[0];
+            for (i = 1; i < len; i++){
+              if (grid[i] <= grid[i-1]) return NULL;
+              if (step > grid[i] - grid[i-1]) step = grid[i] - grid[i-1];
+            }
+            nbins = (int) ((grid[len-1] - grid[0])/step) + 1;
+            if ((lookup = malloc(nbins*sizeof(*lookup))) == NULL) return NULL;
+            for (i = j = 0; i < nbins; i++){
+              while (j < len-2 && grid[j+1] <= grid[0] + i*step) j++;
+              lookup[i] = j;
+            }
+            *lookup_step = step;
+            return lookup;
+          }
+
+          /* set_field_grid
+          use the graded grid with rlen radii r_grid[] and zlen heights z_grid[]
+          (in mm, increasing) for the efld and wpot arrays, or go back to the
+          uniform grid of rstep, zstep if r_grid and z_grid are NULL;
+          the grid arrays are not copied, and must be kept by the caller;
+          either way, the grid gets a new generation (setup->field_grid_gen)
+          returns 0 for success, -1 for failure
+          */
+          int set_field_grid(float *r_grid, int rlen, float *z_grid, int zlen, MJD_Siggen_Setup *setup){
+            setup->field_grid_gen = ++field_grid_count;
+            free(setup->r_grid_lookup);
+            free(setup->z_grid_lookup);
+            setup->r_grid = setup->z_grid = NULL;
+            setup->r_grid_lookup = setup->z_grid_lookup = NULL;
+            if (r_grid == NULL || z_grid == NULL) return 0;
+            if (rlen < 2 || zlen < 2 ||
+                (setup->r_grid_lookup = field_grid_lookup(r_grid, rlen, &setup->r_lookup_step)) == NULL ||
+                (setup->z_grid_lookup = field_grid_lookup(z_grid, zlen, &setup->z_lookup_step)) == NULL){
+              error("Invalid graded field grid\n");
+              free(setup->r_grid_lookup);
+              setup->r_grid_lookup = NULL;
+              return -1;
+            }
+            setup->r_grid = r_grid;
+            setup->z_grid = z_grid;
+            setup->rlen = rlen;
+            setup->zlen = zlen;
+            TELL_NORMAL("Graded field grid: %d x %d, steps down to %.3f x %.3f mm\n",
+                        rlen, zlen, setup->r_lookup_step, setup->z_lookup_step);
+            return 0;
+          }
+
+          /* set_field_3d
+          use the 3-D grid field3[xlen][ylen][zlen][4] of (E_x, E_y, E_z in V/cm, WP)
+          for the signal calculation, instead of the (r,z) efld and wpot arrays;
+          grid point [i][j][k] is at (xmin + i*step, ymin + j*step, zmin + k*step) mm,
+          and for each axis flagged in fold (FOLD_X etc) the grid starts at zero and is
+          mirrored to negative values. NULL to go back to the (r,z) arrays.
+          the array is not copied, and must be kept by the caller
+          returns 0 for success, -1 for failure
+          */
+          int set_field_3d(float *field3, int xlen, int ylen, int zlen, float xmin, float ymin, float zmin,
+                           float step, int fold, MJD_Siggen_Setup *setup){
+            setup->field3 = NULL;
+            if (field3 == NULL) return 0;
+            if (xlen < 2 || ylen < 2 || zlen < 2 || step <= 0 ||
+                ((fold & FOLD_X) && xmin != 0) ||
+                ((fold & FOLD_Y) && ymin != 0) ||
+                ((fold & FOLD_Z) && zmin != 0)){
+              error("Invalid 3-D field grid\n");
+              return -1;
+            }
+            setup->field3 = field3;
+            setup->xlen3 = xlen;
+            setup->ylen3 = ylen;
+            setup->zlen3 = zlen;
+            setup->xmin3 = xmin;
+            setup->ymin3 = ymin;
+            setup->zmin3 = zmin;
+            setup->step3 = step;
+            setup->fold3 = fold;
+            TELL_NORMAL("3-D field grid: %d x %d x %d, step %.3f mm, fold %d\n",
+                        xlen, ylen, zlen, step, fold);
+            return 0;
+          }
+
+          /* field3_interp
+          trilinear interpolation of the 3-D field grid at pt;
+          returns E (V/cm) in e[0..2] and the WP in e[3], and if corner and w3
+          are not NULL, the index of the first grid point of the cell in *corner
+          and the weights of its 8 corners ([x][y][z] order) in w3
+          returns 0 for success, -1 if pt is outside the crystal or the grid
+          */
+          static int field3_interp(point pt, float e[4], int *corner, float w3[8], MJD_Siggen_Setup *setup){
+            /* drift_velocity() and wpotential() are called for the same points */
+            static THREAD_LOCAL point  last_pt;
+            static THREAD_LOCAL float  *last_field3 = NULL, last_e[4], last_w3[8];
+            static THREAD_LOCAL int    last_ret = -99, last_corner;
+            float  x[3], f[3], w, *p;
+            int    i, j, c, ix[3], flip = 0;
+            int    zstride = 4, ystride = 4*setup->zlen3, xstride = 4*setup->zlen3*setup->ylen3;
+
+            if (last_ret != -99 && setup->field3 == last_field3 &&
+                pt.x == last_pt.x && pt.y == last_pt.y && pt.z == last_pt.z) {
+              for (c = 0; c < 4; c++) e[c] = last_e[c];
+              if (corner) *corner = last_corner;
+              if (w3) for (c = 0; c < 8; c++) w3[c] = last_w3[c];
+              return last_ret;
+            }
+            last_pt = pt;
+            last_field3 = setup->field3;
+            last_ret = -1;
+            for (c = 0; c < 4; c++) e[c] = last_e[c] = 0;
+            if (outside_detector(pt, setup)) return -1;
+
+            x[0] = pt.x;
+            x[1] = pt.y;
+            x[2] = pt.z;
+            for (c = 0; c < 3; c++) {
+              if ((setup->fold3 & (1<<c)) && x[c] < 0) {
+                x[c] = -x[c];
+                flip |= 1<<c;
+              }
+            }
+            f[0] = (x[0] - setup->xmin3)/setup->step3;
+            f[1] = (x[1] - setup->ymin3)/setup->step3;
+            f[2] = (x[2] - setup->zmin3)/setup->step3;
+            for (c = 0; c < 3; c++) {
+              ix[c] = floor(f[c]);
+              f[c] -= ix[c];
+            }
+            if (ix[0] < 0 || ix[0] + 1 >= setup->xlen3 ||
+                ix[1] < 0 || ix[1] + 1 >= setup->ylen3 ||
+                ix[2] < 0 || ix[2] + 1 >= setup->zlen3) return -1;
+            last_corner = (ix[0]*setup->ylen3 + ix[1])*setup->zlen3 + ix[2];
+
+            /* the two z-corners of each (x,y) pair are adjacent in memory, and
+               the four components of each corner are summed together */
+            p = setup->field3 + 4*last_corner;
+            for (i = 0; i < 2; i++) {
+              for (j = 0; j < 2; j++) {
+                w = (i ? f[0] : 1.0f - f[0]) * (j ? f[1] : 1.0f - f[1]);
+                last_w3[4*i + 2*j]     = w * (1.0f - f[2]);
+                last_w3[4*i + 2*j + 1] = w * f[2];
+                for (c = 0; c < 4; c++)
+                  e[c] += last_w3[4*i + 2*j] * p[i*xstride + j*ystride + c] +
+                          last_w3[4*i + 2*j + 1] * p[i*xstride + j*ystride + zstride + c];
+              }
+            }
+            for (c = 0; c < 3; c++)
+              if (flip & (1<<c)) e[c] = -e[c];
+
+            for (c = 0; c < 4; c++) last_e[c] = e[c];
+            if (corner) *corner = last_corner;
+            if (w3) for (c = 0; c < 8; c++) w3[c] = last_w3[c];
+            last_ret = 0;
+            return 0;
+          }
+
+          /* set_wpot_extra
+          use the n weighting potentials in wpots for the other electrodes of a
+          multi-electrode detector, on the same grid as the main WP: wpots[rlen][zlen][n]
+          for the (r,z) grid, or wpots[xlen3][ylen3][zlen3][n] if a 3-D grid is set;
+          they give signals 1..n from get_signals(); n = 0 or NULL to remove them.
+          the array is not copied, and must be kept by the caller
+          returns 0 for success, -1 for failure
+          */
+          int set_wpot_extra(float *wpots, int n, MJD_Siggen_Setup *setup){
+            setup->wpot_extra = NULL;
+            setup->num_wpot_extra = 0;
+            if (wpots == NULL || n == 0) return 0;
+            if (n < 0 || n >= MAX_ELECTRODES) {
+              error("Number of extra weighting potentials must be less than %d\n", MAX_ELECTRODES);
+              return -1;
+            }
+            setup->wpot_extra = wpots;
+            setup->num_wpot_extra = n;
+            TELL_NORMAL("%d extra weighting potentials\n", n);
+            return 0;
+          }
+
           /* setup_velo
-          set up drift velocity calculations (read in table)
+          set up drift velocity calculations (read in table, and correct it
+          for the temperature with set_velocity_temps())
           */
           static int setup_velo(MJD_Siggen_Setup *setup){
             static int vlook_sz = 0;
-            static struct velocity_lookup *v_lookup;
+            static struct velocity_lookup *v_lookup, *v_corr;
 
             char  line[MAX_LINE], *c;
             FILE  *fp;
-            int   i, v_lookup_len;
-            struct velocity_lookup *tmp, v, v0;
-            float sumb_e, sumc_e, sumb_h, sumc_h;
+            int   v_lookup_len;
+            struct velocity_lookup *tmp;
 
             double be=1.3e7, bh=1.2e7, thetae=200.0, thetah=200.0;  // parameters for temperature correction
             double pwre=-1.680, pwrh=-2.398, mue=5.66e7, muh=1.63e9; //     adopted for Ge   DCR Feb 2015
-            double mu_0_1, mu_0_2, v_s_1, v_s_2, E_c_1, E_c_2, e, f;
 
             if (vlook_sz == 0) {
               vlook_sz = 10;
@@ -627,80 +1167,168 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
             TELL_NORMAL("Drift velocity table has %d rows of data\n", v_lookup_len);
             fclose(fp);
 
-            /*
-            apply temperature dependence to mobilities;
-            see drift_velocities.doc and tempdep.c
-            The drift velocity reduces at higher temperature due to the increasing of
-            scattering with the lattice vibration. We used a model by M. Ali Omar and
-            L. Reggiani (Solid-State Electronics Vol. 30, No. 12 (1987) 1351) to
-            calculate the temperature dependence.
-            */
-            /* electrons */
-            TELL_NORMAL("Adjusting mobilities for temperature, from %.1f to %.1f\n", REF_TEMP, setup->xtal_temp);
-            TELL_CHATTY("Index  field  vel_factor\n");
-            mu_0_1 = mue * pow(REF_TEMP, pwre);
-            v_s_1 = be * sqrt(tanh(0.5 * thetae / REF_TEMP));
-            E_c_1 = v_s_1 / mu_0_1;
-            mu_0_2 = mue * pow(setup->xtal_temp, pwre);
-            v_s_2 = be * sqrt(tanh(0.5 * thetae / setup->xtal_temp));
-            E_c_2 = v_s_2 / mu_0_2;
-            for (i = 0; i < vlook_sz; i++){
-              e = v_lookup[i].e;
-              if (e < 1) continue;
-              f = (v_s_2 * (e/E_c_2) / sqrt(1.0 + (e/E_c_2) * (e/E_c_2))) /
-              (v_s_1 * (e/E_c_1) / sqrt(1.0 + (e/E_c_1) * (e/E_c_1)));
-              v_lookup[i].e100 *= f;
-              v_lookup[i].e110 *= f;
-              v_lookup[i].e111 *= f;
-              TELL_CHATTY("%2d %5.0f %f\n", i, e, f);
-            }
-
-            /* holes */
-            mu_0_1 = muh * pow(REF_TEMP, pwrh);
-            v_s_1 = bh * sqrt(tanh(0.5 * thetah / REF_TEMP));
+            /* keep the table as read, and correct a copy of it for the temperature */
+            if ((tmp = (struct velocity_lookup *)
+            realloc(v_corr, v_lookup_len*sizeof(*v_corr))) == NULL){
+              error("realloc failed in setup_velo\n");
+              return -1;
+            }
+            v_corr = tmp;
+            setup->v_lookup_raw = v_lookup;
+            setup->v_lookup = v_corr;
+            setup->v_lookup_len = v_lookup_len;
+            setup->v_temp_par[0][0] = mue;
+            setup->v_temp_par[0][1] = pwre;
+            setup->v_temp_par[0][2] = be;
+            setup->v_temp_par[0][3] = thetae;
+            setup->v_temp_par[1][0] = muh;
+            setup->v_temp_par[1][1] = pwrh;
+            setup->v_temp_par[1][2] = bh;
+            setup->v_temp_par[1][3] = thetah;
+
+            return set_velocity_temps(setup->xtal_temp, setup->xtal_temp, setup);
+          }
+
+          /* mobility_factor
+          ratio of the drift velocity at field e (V/cm) and temperature temp to that at
+          REF_TEMP, from the model of M. Ali Omar and L. Reggiani (Solid-State Electronics
+          Vol. 30, No. 12 (1987) 1351), with par = (mu_0, power, B, Theta);
+          see drift_velocities.doc and tempdep.c
+          */
+          static double mobility_factor(double e, double temp, double par[4]){
+            double mu_0_1, mu_0_2, v_s_1, v_s_2, E_c_1, E_c_2;
+
+            mu_0_1 = par[0] * pow(REF_TEMP, par[1]);
+            v_s_1 = par[2] * sqrt(tanh(0.5 * par[3] / REF_TEMP));
             E_c_1 = v_s_1 / mu_0_1;
-            mu_0_2 = muh * pow(setup->xtal_temp, pwrh);
-            v_s_2 = bh * sqrt(tanh(0.5 * thetah / setup->xtal_temp));
+            mu_0_2 = par[0] * pow(temp, par[1]);
+            v_s_2 = par[2] * sqrt(tanh(0.5 * par[3] / temp));
             E_c_2 = v_s_2 / mu_0_2;
-            for (i = 0; i < vlook_sz; i++){
-              e = v_lookup[i].e;
-              if (e < 1) continue;
-              f = (v_s_2 * (e/E_c_2) / sqrt(1.0 + (e/E_c_2) * (e/E_c_2))) /
-              (v_s_1 * (e/E_c_1) / sqrt(1.0 + (e/E_c_1) * (e/E_c_1)));
-              v_lookup[i].h100 *= f;
-              v_lookup[i].h110 *= f;
-              v_lookup[i].h111 *= f;
-              TELL_CHATTY("%2d %5.0f %f\n", i, e, f);
-            }
-            /* end of temperature correction */
-
-            for (i = 0; i < vlook_sz; i++){
-              v = v_lookup[i];
-              v_lookup[i].ea =  0.5 * v.e100 -  4 * v.e110 +  4.5 * v.e111;
-              v_lookup[i].eb = -2.5 * v.e100 + 16 * v.e110 - 13.5 * v.e111;
-              v_lookup[i].ec =  3.0 * v.e100 - 12 * v.e110 +  9.0 * v.e111;
-              v_lookup[i].ha =  0.5 * v.h100 -  4 * v.h110 +  4.5 * v.h111;
-              v_lookup[i].hb = -2.5 * v.h100 + 16 * v.h110 - 13.5 * v.h111;
-              v_lookup[i].hc =  3.0 * v.h100 - 12 * v.h110 +  9.0 * v.h111;
-            }
-            v_lookup[0].ebp = v_lookup[0].ecp = v_lookup[0].hbp = v_lookup[0].hcp = 0.0;
+            return (v_s_2 * (e/E_c_2) / sqrt(1.0 + (e/E_c_2) * (e/E_c_2))) /
+                   (v_s_1 * (e/E_c_1) / sqrt(1.0 + (e/E_c_1) * (e/E_c_1)));
+          }
+
+          /* set_velocity_temps
+          recalculate setup->v_lookup from setup->v_lookup_raw for electron temperature
+          e_temp and hole temperature h_temp, then its anisotropy coefficients and v_table
+          returns 0 for success
+          */
+          int set_velocity_temps(float e_temp, float h_temp, MJD_Siggen_Setup *setup){
+            struct velocity_lookup *raw = setup->v_lookup_raw, *v = setup->v_lookup;
+            int    i, len = setup->v_lookup_len;
+            float  sumb_e, sumc_e, sumb_h, sumc_h, de;
+            double fe, fh;
+
+            if (raw == NULL || v == NULL) {
+              error("No drift velocity table read\n");
+              return -1;
+            }
+            /* apply temperature dependence to mobilities */
+            TELL_NORMAL("Adjusting mobilities for temperature, from %.1f to %.1f (e), %.1f (h)\n",
+                        REF_TEMP, e_temp, h_temp);
+            TELL_CHATTY("Index  field  vel_factor_e  vel_factor_h\n");
+            for (i = 0; i < len; i++){
+              fe = fh = 1.0;
+              if (raw[i].e >= 1) {
+                fe = mobility_factor(raw[i].e, e_temp, setup->v_temp_par[0]);
+                fh = mobility_factor(raw[i].e, h_temp, setup->v_temp_par[1]);
+              }
+              v[i].e = raw[i].e;
+              v[i].e100 = raw[i].e100*fe;
+              v[i].e110 = raw[i].e110*fe;
+              v[i].e111 = raw[i].e111*fe;
+              v[i].h100 = raw[i].h100*fh;
+              v[i].h110 = raw[i].h110*fh;
+              v[i].h111 = raw[i].h111*fh;
+              TELL_CHATTY("%2d %5.0f %f %f\n", i, raw[i].e, fe, fh);
+
+              v[i].ea =  0.5 * v[i].e100 -  4 * v[i].e110 +  4.5 * v[i].e111;
+              v[i].eb = -2.5 * v[i].e100 + 16 * v[i].e110 - 13.5 * v[i].e111;
+              v[i].ec =  3.0 * v[i].e100 - 12 * v[i].e110 +  9.0 * v[i].e111;
+              v[i].ha =  0.5 * v[i].h100 -  4 * v[i].h110 +  4.5 * v[i].h111;
+              v[i].hb = -2.5 * v[i].h100 + 16 * v[i].h110 - 13.5 * v[i].h111;
+              v[i].hc =  3.0 * v[i].h100 - 12 * v[i].h110 +  9.0 * v[i].h111;
+            }
+            v[0].ebp = v[0].ecp = v[0].hbp = v[0].hcp = 0.0;
             sumb_e = sumc_e = sumb_h = sumc_h = 0.0;
-            for (i = 1; i < vlook_sz; i++){
-              v0 = v_lookup[i-1];
-              v = v_lookup[i];
-              sumb_e += (v.e - v0.e)*(v0.eb+v.eb)/2;
-              sumc_e += (v.e - v0.e)*(v0.ec+v.ec)/2;
-              sumb_h += (v.e - v0.e)*(v0.hb+v.hb)/2;
-              sumc_h += (v.e - v0.e)*(v0.hc+v.hc)/2;
-              v_lookup[i].ebp = sumb_e/v.e;
-              v_lookup[i].ecp = sumc_e/v.e;
-              v_lookup[i].hbp = sumb_h/v.e;
-              v_lookup[i].hcp = sumc_h/v.e;
-            }
-
-            setup->v_lookup = v_lookup;
-            setup->v_lookup_len = v_lookup_len;
+            for (i = 1; i < len; i++){
+              de = v[i].e - v[i-1].e;
+              sumb_e += de*(v[i-1].eb+v[i].eb)/2;
+              sumc_e += de*(v[i-1].ec+v[i].ec)/2;
+              sumb_h += de*(v[i-1].hb+v[i].hb)/2;
+              sumc_h += de*(v[i-1].hc+v[i].hc)/2;
+              v[i].ebp = sumb_e/v[i].e;
+              v[i].ecp = sumc_e/v[i].e;
+              v[i].hbp = sumb_h/v[i].e;
+              v[i].hcp = sumc_h/v[i].e;
+            }
+
+            return resample_velocity_table(setup);
+          }
+
+          /* resample_velocity_table
+          resample v_lookup onto v_table, a uniform grid in |E| from 0, so that
+          velocity_from_field() can index it directly. The grid step is the smallest
+          interval of v_lookup; when all its fields are multiples of that, as in the
+          usual tables, the linear interpolation of v_lookup is reproduced exactly
+          */
+          int resample_velocity_table(MJD_Siggen_Setup *setup){
+            struct velocity_lookup *v = setup->v_lookup, *v1, *v2;
+            float  step, e, f, *tab, *t;
+            int    i, j, k, n, len = setup->v_lookup_len;
 
+            if (v == NULL || len < 2) {
+              error("No drift velocity table to resample\n");
+              return -1;
+            }
+            step = v[len-1].e - v[0].e;
+            for (i = 1; i < len; i++)
+              if (v[i].e - v[i-1].e > 0 && v[i].e - v[i-1].e < step) step = v[i].e - v[i-1].e;
+            if (!(step > 0)) {
+              error("Drift velocity table fields must increase\n");
+              return -1;
+            }
+            n = (int) ceil(v[len-1].e/step - 0.001) + 1;
+            if (n < 2) n = 2;
+            if (n > VT_MAX_LEN) {
+              n = VT_MAX_LEN;
+              step = v[len-1].e/(n - 1);
+            }
+            if (n != setup->v_table_len || setup->v_table == NULL) {
+              if ((tab = realloc(setup->v_table, 2*VT_NCOEF*n*sizeof(*tab))) == NULL) {
+                error("realloc failed in resample_velocity_table\n");
+                return -1;
+              }
+              setup->v_table = tab;
+              setup->v_table_len = n;
+            }
+            setup->v_table_step = step;
+
+            for (k = 0; k < n; k++) {
+              /* interval of v_lookup as in the original search, and for the
+              derivative, the one that holds the middle of this grid interval */
+              e = k*step;
+              for (i = 0; i < len - 2 && e > v[i+1].e; i++);
+              for (j = 0; j < len - 2 && e + 0.5f*step > v[j+1].e; j++);
+              v1 = v + i;
+              v2 = v + i+1;
+              f = (e - v1->e)/(v2->e - v1->e);
+              t = setup->v_table + k;
+              t[VT_A*n]  = (v2->ha - v1->ha)*f + v1->ha;
+              t[VT_B*n]  = (v2->hb - v1->hb)*f + v1->hb;
+              t[VT_C*n]  = (v2->hc - v1->hc)*f + v1->hc;
+              t[VT_BP*n] = (v2->hbp - v1->hbp)*f + v1->hbp;
+              t[VT_CP*n] = (v2->hcp - v1->hcp)*f + v1->hcp;
+              t[VT_DVDE*n] = (v[j+1].h100 - v[j].h100)/(v[j+1].e - v[j].e);
+              t += VT_NCOEF*n;
+              t[VT_A*n]  = (v2->ea - v1->ea)*f + v1->ea;
+              t[VT_B*n]  = (v2->eb - v1->eb)*f + v1->eb;
+              t[VT_C*n]  = (v2->ec - v1->ec)*f + v1->ec;
+              t[VT_BP*n] = (v2->ebp - v1->ebp)*f + v1->ebp;
+              t[VT_CP*n] = (v2->ecp - v1->ecp)*f + v1->ecp;
+              t[VT_DVDE*n] = (v[j+1].e100 - v[j].e100)/(v[j+1].e - v[j].e);
+            }
+            TELL_CHATTY("Drift velocity table resampled to %d points, %.2f V/cm apart\n", n, step);
             return 0;
           }
 
@@ -869,52 +1497,221 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
             // setup->efld_z = NULL;
             // setup->wpot = NULL;
             // setup->v_lookup = NULL;
+            free(setup->v_table);
+            setup->v_table = NULL;
+            setup->v_table_len = 0;
+            free(setup->h_table);
+            setup->h_table = NULL;
+            free(setup->geom_sd);
+            setup->geom_sd = NULL;
 
             return 1;
           }
 
+          void velocity_table_sizes(MJD_Siggen_Setup *setup, int *v_len, int *h_len){
+            *v_len = (setup->v_table == NULL ? 0 : 2*VT_NCOEF*setup->v_table_len);
+            *h_len = (setup->h_table == NULL ? 0 : HT_NCOEF*HT_LEN);
+          }
+
+          /* layout_mix
+          FNV-1a hash h, continued with the bytes of v
+          */
+          static unsigned int layout_mix(unsigned int h, size_t v){
+            int i;
+
+            for (i = 0; i < (int) sizeof(v); i++) {
+              h ^= (v >> 8*i) & 0xff;
+              h *= 16777619u;
+            }
+            return h;
+          }
+
+          /* setup_layout_key
+          hash of the offset, size and type of each member of MJD_Siggen_Setup and of
+          the velocity structures, and of the table formats used here, for checking
+          that a setup copied as bytes (as by pysiggen's snapshots) was made by a
+          build with the same layout
+          */
+#define LAYOUT_TYPE(x) _Generic((x), int: 1, float: 2, double: 3, char *: 4, int *: 5, float *: 6, \
+                                     default: 0)
+          unsigned int setup_layout_key(void){
+            size_t k[] = {
+#define M(m) offsetof(MJD_Siggen_Setup, m), sizeof(((MJD_Siggen_Setup *) 0)->m), \
+             LAYOUT_TYPE(((MJD_Siggen_Setup *) 0)->m)
+            M(verbosity), M(velocity_type), M(xtal_length), M(xtal_radius),
+            M(top_bullet_radius), M(bottom_bullet_radius), M(pc_length), M(pc_radius),
+            M(taper_length), M(wrap_around_radius), M(ditch_depth),
+            M(ditch_thickness), M(hole_length), M(hole_radius), M(Li_thickness),
+            M(pc_x_offset), M(pc_y_offset), M(xtal_grid), M(xtal_grid_max),
+            M(xtal_grid_grade), M(impurity_z0), M(impurity_gradient),
+            M(impurity_quadratic), M(impurity_surface), M(impurity_radial_add),
+            M(impurity_radial_mult), M(impurity_rpower), M(impurity_x_gradient),
+            M(xtal_HV), M(max_iterations), M(write_field), M(write_WP),
+            M(bulletize_PC), M(drift_name), M(field_name), M(wp_name), M(xtal_temp),
+            M(preamp_tau), M(time_steps_calc), M(step_time_calc), M(step_time_out),
+            M(charge_cloud_size), M(use_diffusion), M(energy), M(coord_type),
+            M(ntsteps_out), M(rmin), M(rmax), M(rstep), M(zmin), M(zmax), M(zstep),
+            M(rlen), M(zlen), M(r_grid), M(z_grid), M(r_grid_lookup),
+            M(z_grid_lookup), M(r_lookup_step), M(z_lookup_step), M(field_grid_gen),
+            M(field3), M(xlen3), M(ylen3), M(zlen3), M(xmin3), M(ymin3), M(zmin3), M(step3), M(fold3),
+            M(geom_sd), M(geom_rlen), M(geom_zlen), M(geom_key), M(v_lookup_len),
+            M(v_lookup), M(v_lookup_raw), M(v_temp_par), M(v_table_len),
+            M(v_table_step), M(v_table), M(v_params), M(h_table), M(h_table_ok),
+            M(efld_r), M(efld_z), M(wpot), M(wpot_extra), M(num_wpot_extra),
+            M(imp_grad), M(avg_imp), M(min_imp_grad), M(min_avg_imp),
+            M(imp_grad_step), M(avg_imp_step), M(min_pclen), M(min_pcrad),
+            M(pclen_step), M(pcrad_step), M(num_imps), M(num_grads), M(num_pcrad),
+            M(num_pclen), M(dpath_e), M(dpath_h), M(path_step), M(path_len_e),
+            M(path_len_h), M(dpath_rec_e), M(dpath_rec_h), M(initial_vel),
+            M(final_vel), M(dv_dE), M(v_over_E), M(final_charge_size),
+            M(trap_constant), M(release_constant), M(initial_wpot), M(drift_steps),
+            M(sig_work), M(sig_work_tsteps), M(sig_work_nsig), M(sig_work_used),
+#undef M
+#define M(m) offsetof(struct velocity_lookup, m), sizeof(((struct velocity_lookup *) 0)->m), \
+             LAYOUT_TYPE(((struct velocity_lookup *) 0)->m)
+            M(e), M(e100), M(e110), M(e111), M(h100), M(h110), M(h111), M(ea), M(eb),
+            M(ec), M(ebp), M(ecp), M(ha), M(hb), M(hc), M(hbp), M(hcp), M(hcorr),
+            M(ecorr),
+#undef M
+#define M(m) offsetof(velocity_params, m), sizeof(((velocity_params *) 0)->m), \
+             LAYOUT_TYPE(((velocity_params *) 0)->m)
+            M(h_100_mu0), M(h_100_beta), M(h_100_e0), M(h_111_mu0), M(h_111_beta),
+            M(h_111_e0), M(k0_0), M(k0_1), M(k0_2), M(k0_3),
+#undef M
+              sizeof(MJD_Siggen_Setup), sizeof(struct velocity_lookup), sizeof(velocity_params),
+              VT_NCOEF, HT_NCOEF, HT_LEN, (size_t) HT_EMIN, (size_t) HT_EMAX};
+            unsigned int h = 2166136261u;
+            int i;
+
+            for (i = 0; i < (int) (sizeof(k)/sizeof(k[0])); i++) h = layout_mix(h, k[i]);
+            return h;
+          }
+#undef LAYOUT_TYPE
+
           void set_temp(float temp, MJD_Siggen_Setup *setup){
             if (temp < MIN_TEMP || temp > MAX_TEMP){
               error("temperature out of range: %f\n", temp);
             }else{
               setup->xtal_temp = temp;
               TELL_NORMAL("temperature set to %f\n", temp);
-              /* re-read velocities and correct them to the new temperature value */
-              setup_velo(setup);
+              /* correct the velocities to the new temperature value, reading them first if needed */
+              if (setup->v_lookup_raw == NULL) setup_velo(setup);
+              else set_velocity_temps(temp, temp, setup);
             }
           }
 
-          static int find_hole_velo(float field, float theta, float phi, point* v_spher, MJD_Siggen_Setup* setup ){
+          /* hole_velo_terms
+          the field-magnitude-only terms of the velocity_type 1 hole model for the
+          parameters par: v_100 in t[HT_V100], and v_100 times the lambda(k_0) and
+          omega(k_0) anisotropy factors in t[HT_LAMBDA], t[HT_OMEGA]
+          */
+          static void hole_velo_terms(float field, velocity_params *par, float t[HT_NCOEF]){
 
             //these are the reggiani numbers
 
-            float v_100 = drift_velo_model(field, setup->v_params->h_100_mu0, setup->v_params->h_100_beta, setup->v_params->h_100_e0);
-            float v_111 = drift_velo_model(field, setup->v_params->h_111_mu0, setup->v_params->h_111_beta, setup->v_params->h_111_e0);
+            float v_100 = drift_velo_model(field, par->h_100_mu0, par->h_100_beta, par->h_100_e0);
+            float v_111 = drift_velo_model(field, par->h_111_mu0, par->h_111_beta, par->h_111_e0);
 
+            t[HT_V100] = v_100;
             if (v_100 == 0){
-              v_spher->x = 0;
-              v_spher->y = 0;
-              v_spher->z = 0;
-              return 0;
+              t[HT_LAMBDA] = t[HT_OMEGA] = 0;
+              return;
             }
 
             float v_rel = v_111 / v_100;
 
-            float k_0_0 =  setup->v_params->k0_0;
-            float k_0_1 =  setup->v_params->k0_1;
-            float k_0_2 =  setup->v_params->k0_2;
-            float k_0_3 =  setup->v_params->k0_3;
-
             // float k_0 = 9.2652 - 26.3467*v_rel + 29.6137*pow(v_rel,2) -12.3689 * pow(v_rel,3);
 
-            float k_0 = k_0_0 + k_0_1*v_rel + k_0_2*pow(v_rel,2)  + k_0_3* pow(v_rel,3);
+            float k_0 = par->k0_0 + v_rel*(par->k0_1 + v_rel*(par->k0_2 + v_rel*par->k0_3));
+
+            float lambda_k0 = k_0*(-0.01322 + k_0*(0.41145 + k_0*(-0.23657 + k_0*0.04077)));
+            float omega_k0 = k_0*(0.006550 + k_0*(-0.19946 + k_0*(0.09859 - k_0*0.01559)));
+
+            t[HT_LAMBDA] = v_100 * lambda_k0;
+            t[HT_OMEGA] = v_100 * omega_k0;
+          }
+
+          /* resample_hole_params
+          tabulate hole_velo_terms() for the current setup->v_params at HT_LEN
+          fields, log-spaced from HT_EMIN to HT_EMAX, in setup->h_table, so that
+          find_hole_velo() only has to add the angular terms. The terms are smooth
+          in log|E|, so linear interpolation on this grid is good to about 1e-5 of
+          the velocity above 100 V/cm. Called by set_hole_params() and set_k0_params(),
+          which sets setup->h_table_ok; code that perturbs setup->v_params (the
+          sensitivity calculations) clears it, and find_hole_velo() then uses the
+          exact model
+          returns 0 for success, -1 for failure
+          */
+          int resample_hole_params(MJD_Siggen_Setup *setup){
+            float t[HT_NCOEF];
+            int   k, j;
+
+            setup->h_table_ok = 0;
+            if (setup->h_table == NULL &&
+                (setup->h_table = malloc(HT_NCOEF*HT_LEN*sizeof(*setup->h_table))) == NULL) {
+              error("malloc failed in resample_hole_params\n");
+              return -1;
+            }
+            for (k = 0; k < HT_LEN; k++) {
+              hole_velo_terms(HT_EMIN*expf(k*HT_LSTEP), setup->v_params, t);
+              for (j = 0; j < HT_NCOEF; j++) setup->h_table[j*HT_LEN + k] = t[j];
+            }
+            setup->h_table_ok = 1;
+            return 0;
+          }
+
+          /* find_hole_velo
+          velocity_type 1 hole drift velocity in a field of strength field (V/cm)
+          along the unit vector en. The anisotropy is usually written in the polar
+          angles (theta, phi) of en, in a frame rotated onto en; here the rotated
+          components are expanded in en.x, en.y, en.z and rotated back, so that
+          with rho2 = en.x^2 + en.y^2,
+            sin^4(theta) sin^2(2 phi) = 4 x^2 y^2,  sin^2(2 theta) = 4 rho2 z^2
+          and the velocity needs no trigonometric functions or square roots
+          returns 1, or 0 for zero velocity
+          */
+          static int find_hole_velo(float field, point en, vector *velo, MJD_Siggen_Setup* setup ){
+            float t[HT_NCOEF], f, *tab, x2, y2, xy2, rho2, vr, vt, vp;
+            int   i, j;
+
+            /* interpolate the field-magnitude terms when the table is current */
+            if (setup->h_table_ok && setup->h_table != NULL &&
+                field >= HT_EMIN && field < HT_EMAX) {
+              f = logf(field/HT_EMIN)/HT_LSTEP;
+              i = (int) f;
+              if (i > HT_LEN - 2) i = HT_LEN - 2;
+              f -= i;
+              for (j = 0; j < HT_NCOEF; j++) {
+                tab = setup->h_table + j*HT_LEN + i;
+                t[j] = (tab[1] - tab[0])*f + tab[0];
+              }
+            } else {
+              hole_velo_terms(field, setup->v_params, t);
+            }
 
-            float lambda_k0 = -0.01322 * k_0 + 0.41145*pow(k_0,2) - 0.23657 * pow(k_0,3) + 0.04077*pow(k_0,4);
-            float omega_k0 = 0.006550*k_0 - 0.19946*pow(k_0,2) + 0.09859*pow(k_0,3) - 0.01559*pow(k_0,4);
+            if (t[HT_V100] == 0){
+              velo->x = 0;
+              velo->y = 0;
+              velo->z = 0;
+              return 0;
+            }
 
-            v_spher->x = v_100 * (1- lambda_k0*( pow(sin(theta),4) * pow(sin(2*phi),2) + pow(sin(2*theta),2) ) );
-            v_spher->y = v_100 * omega_k0 * (2*pow(sin(theta),3)*cos(theta)*pow(sin(2*phi),2) + sin(4*theta) );
-            v_spher->z = v_100 * omega_k0 * pow(sin(theta),3)*sin(4*phi);
+            x2 = en.x*en.x;
+            y2 = en.y*en.y;
+            xy2 = x2*y2;
+            rho2 = x2 + y2;
+            /* along the field (vr), and the theta and phi components divided by
+            sin(theta), which cancels in the rotation back */
+            vr = t[HT_V100] - t[HT_LAMBDA]*4*(xy2 + rho2*en.z*en.z);
+            if (rho2 > 0) {
+              vt = t[HT_OMEGA]*4*en.z*(2*xy2/rho2 + en.z*en.z - rho2);
+              vp = t[HT_OMEGA]*4*en.x*en.y*(x2 - y2)/rho2;
+            } else {
+              vt = vp = 0;
+            }
+            velo->x = en.x*(vr + en.z*vt) - en.y*vp;
+            velo->y = en.y*(vr + en.z*vt) + en.x*vp;
+            velo->z = en.z*vr - rho2*vt;
 
             return 1;
           }
@@ -932,6 +1729,7 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
             setup->v_params->h_111_mu0 = h_111_mu0;
             setup->v_params->h_111_beta = h_111_beta;
             setup->v_params->h_111_e0 = h_111_e0;
+            resample_hole_params(setup);
           }
 
           void set_k0_params(float k0_0, float k0_1, float k0_2, float k0_3, MJD_Siggen_Setup *setup){
@@ -939,4 +1737,5 @@ static int efield_exists(cyl_pt pt, MJD_Siggen_Setup *setup){
             setup->v_params->k0_1 = k0_1;
             setup->v_params->k0_2 = k0_2;
             setup->v_params->k0_3 = k0_3;
+            resample_hole_params(setup);
           }
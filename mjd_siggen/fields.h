@@ -34,16 +34,80 @@ int fields_finalize(MJD_Siggen_Setup *setup);
 */
 int wpotential(point pt, float *wp, MJD_Siggen_Setup *setup);
 
+/* wpotentials
+   gives (interpolated or extrapolated) weighting potentials at point pt of the
+   point contact, in wp[0], and of the other electrodes set by set_wpot_extra(),
+   in wp[1..num_wpot_extra], from the same grid cell and weights.
+   returns 0 for success, 1 on failure.
+*/
+int wpotentials(point pt, float *wp, MJD_Siggen_Setup *setup);
+
+/* wpotential_sens
+   gives the weighting potential at point pt, as wpotential(), and its gradient
+   dwp[3] with respect to (x, y, z)
+   (r,z) field grid only; returns 0 for success, 1 on failure.
+*/
+int wpotential_sens(point pt, float *wp, float dwp[3], MJD_Siggen_Setup *setup);
+
 /* drift_velocity
    calculates drift velocity for charge q at point pt
    returns 0 on success, 1 if successful but extrapolation was needed,
    and -1 for failure
 */
 int drift_velocity(point pt, float q, vector *velocity, MJD_Siggen_Setup *setup);
+/* drift_velocity_sens
+   drift velocity for charge q at point pt, as drift_velocity(), and its
+   derivatives dv_dx[i][j] = dv_i/dx_j and dv_dp[p][i] = dv_i/d(parameter p)
+   for the SENS_* parameters defined in mjd_siggen.h
+   (r,z) field grid only; returns -1 for failure
+*/
+int drift_velocity_sens(point pt, float q, vector *velocity, float dv_dx[3][3],
+                        float dv_dp[SENS_NPAR][3], MJD_Siggen_Setup *setup);
 int drift_velocity_ben(point pt, float q, vector *velocity, MJD_Siggen_Setup *setup);
 
 int read_fields(MJD_Siggen_Setup *setup);
 
+/* set_field_grid
+   use graded grid coordinates r_grid[rlen], z_grid[zlen] (in mm) for the field
+   arrays, instead of the uniform rstep, zstep; NULL for uniform
+   returns 0 for success, -1 for failure
+*/
+int set_field_grid(float *r_grid, int rlen, float *z_grid, int zlen, MJD_Siggen_Setup *setup);
+
+/* set_field_3d
+   use the 3-D grid field3[xlen][ylen][zlen][4] of (E_x, E_y, E_z, WP), with
+   first point at (xmin, ymin, zmin) and grid size step (in mm), instead of
+   the (r,z) arrays; fold is FOLD_X | FOLD_Y | FOLD_Z for mirrored axes.
+   NULL to go back to the (r,z) arrays
+   returns 0 for success, -1 for failure
+*/
+int set_field_3d(float *field3, int xlen, int ylen, int zlen, float xmin, float ymin, float zmin,
+                 float step, int fold, MJD_Siggen_Setup *setup);
+
+/* set_wpot_extra
+   use the n weighting potentials wpots[rlen][zlen][n] (or wpots[xlen][ylen][zlen][n]
+   for a 3-D field grid) for other electrodes, in addition to the point contact;
+   n < MAX_ELECTRODES. NULL to remove them
+   returns 0 for success, -1 for failure
+*/
+int set_wpot_extra(float *wpots, int n, MJD_Siggen_Setup *setup);
+
+/* resample_velocity_table
+   resample the drift velocity table setup->v_lookup (after the temperature
+   correction) onto a uniform field grid, setup->v_table, for drift_velocity();
+   call this whenever v_lookup changes
+   returns 0 for success, -1 for failure
+*/
+int resample_velocity_table(MJD_Siggen_Setup *setup);
+
+/* set_velocity_temps
+   correct the drift velocity table read by field_setup() (setup->v_lookup_raw)
+   for electron temperature e_temp and hole temperature h_temp, in memory,
+   and update the derived coefficients and v_table
+   returns 0 for success, -1 for failure
+*/
+int set_velocity_temps(float e_temp, float h_temp, MJD_Siggen_Setup *setup);
+
 /*set detector temperature. 77F (no correction) is the default
    MIN_TEMP & MAX_TEMP defines allowed range*/
 void set_temp(float temp, MJD_Siggen_Setup *setup);
@@ -51,6 +115,26 @@ void set_temp(float temp, MJD_Siggen_Setup *setup);
 void set_hole_params(float h_100_mu0, float h_100_beta, float h_100_e0, float h_111_mu0, float h_111_beta, float h_111_e0, MJD_Siggen_Setup *setup);
 void set_k0_params(float k0_0, float k0_1, float k0_2, float k0_3, MJD_Siggen_Setup *setup);
 
+/* resample_hole_params
+   tabulate the field-magnitude terms of the velocity_type 1 hole model for the
+   current setup->v_params; called by set_hole_params() and set_k0_params()
+   returns 0 for success, -1 for failure
+*/
+int resample_hole_params(MJD_Siggen_Setup *setup);
+
+/* velocity_table_sizes
+   number of floats in setup->v_table and in setup->h_table (0 if not set up),
+   e.g. for copying the setup with its tables
+*/
+void velocity_table_sizes(MJD_Siggen_Setup *setup, int *v_len, int *h_len);
+
+/* setup_layout_key
+   hash of the layout of MJD_Siggen_Setup, the velocity structures and the
+   velocity tables of this build; equal keys mean that a setup copied as
+   bytes by one build can be used by the other
+*/
+unsigned int setup_layout_key(void);
+
 float get_wpot_by_index(int row, int col,int pcrad, int pclen, MJD_Siggen_Setup* setup );
 float get_efld_r_by_index(int row, int col, int grad, int imp, int pcrad, int pclen,MJD_Siggen_Setup* setup );
 float get_efld_z_by_index(int row, int col, int grad, int imp, int pcrad, int pclen,MJD_Siggen_Setup* setup );
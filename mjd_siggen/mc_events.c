@@ -0,0 +1,188 @@
+/* mc_events.c -- signals of multi-site events
+ *
+ * This module sums the signals of the energy depositions (hits) that make up
+ * each event of a Monte-Carlo simulation, e.g. from Geant4. Each thread works
+ * on its own copy of the setup structure, which holds the work arrays and
+ * last-drift results of the signal calculation; the fields, velocity tables
+ * and geometry raster are shared, and only read. Where there are no POSIX
+ * threads, or no thread-local storage (see mjd_siggen.h), NO_THREADS is
+ * defined and the events are calculated in the calling thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mjd_siggen.h"
+#ifndef NO_THREADS
+#include <pthread.h>
+#endif
+#include "mc_events.h"
+#include "calc_signal.h"
+#include "detector_geometry.h"
+#include "fields.h"
+#include "point.h"
+
+#define SQ(x) ((x)*(x))
+
+/* the events to calculate, shared by the threads */
+typedef struct {
+  const point *pos;
+  const float *energy;
+  const int   *first;
+  int   nevents;
+  int   max_hits;           // largest number of hits in one event
+  float cluster_size;
+  float *signal_out;
+  int   *nfailed;
+  MJD_Siggen_Setup *setup;
+  int   next;               // next event to calculate
+  int   err;                // set to -1 by a thread that fails
+#ifndef NO_THREADS
+  pthread_mutex_t lock;
+#endif
+} event_job;
+
+static int cluster_hits(const point *pos, const float *energy, int n, float size,
+                        point *cpos, float *cen);
+static void *event_worker(void *arg);
+
+int get_event_signals(const point *pos, const float *energy, const int *first, int nevents,
+                      float cluster_size, float *signal_out, int *nfailed, int nthreads,
+                      MJD_Siggen_Setup *setup){
+  event_job job;
+  int   i, n;
+#ifndef NO_THREADS
+  pthread_t *threads;
+#endif
+
+  if (nevents <= 0) return 0;
+  job.pos = pos;
+  job.energy = energy;
+  job.first = first;
+  job.nevents = nevents;
+  job.cluster_size = cluster_size;
+  job.signal_out = signal_out;
+  job.nfailed = nfailed;
+  job.setup = setup;
+  job.next = 0;
+  job.err = 0;
+  job.max_hits = 0;
+  for (i = 0; i < nevents; i++) {
+    n = first[i+1] - first[i];
+    if (n < 0) return -1;
+    if (n > job.max_hits) job.max_hits = n;
+  }
+
+  /* tables that the signal calculation would otherwise set up on first use */
+  if (geometry_setup(setup) != 0) return -1;
+  if (setup->v_table == NULL && resample_velocity_table(setup) != 0) return -1;
+
+#ifdef NO_THREADS
+  (void) nthreads;
+  event_worker(&job);
+#else
+  if (nthreads > nevents) nthreads = nevents;
+  if (nthreads < 1) nthreads = 1;
+  if ((threads = malloc(nthreads*sizeof(*threads))) == NULL) {
+    error("malloc failed in get_event_signals\n");
+    return -1;
+  }
+  pthread_mutex_init(&job.lock, NULL);
+  n = 0;
+  if (nthreads > 1)
+    for (; n < nthreads; n++)
+      if (pthread_create(&threads[n], NULL, event_worker, &job) != 0) break;
+  if (n == 0) event_worker(&job);  // a single thread, or none could be started
+  for (i = 0; i < n; i++) pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&job.lock);
+  free(threads);
+#endif
+  return job.err;
+}
+
+/* event_worker
+   calculates the signals of the events of job->next onwards, until there are
+   none left
+*/
+static void *event_worker(void *arg){
+  event_job *job = arg;
+  MJD_Siggen_Setup setup = *job->setup;
+  point *cpos;
+  float *sig, *cen, *out;
+  int   i, j, k, nc, nout = setup.ntsteps_out;
+
+  /* this thread's own work arrays, and no drift path recording */
+  setup.sig_work = NULL;
+  setup.path_step = 0;
+  setup.dpath_rec_e = setup.dpath_rec_h = NULL;
+  sig  = malloc(nout*sizeof(*sig));
+  cpos = malloc((job->max_hits + 1)*sizeof(*cpos));
+  cen  = malloc((job->max_hits + 1)*sizeof(*cen));
+  if (sig == NULL || cpos == NULL || cen == NULL) {
+    error("malloc failed in get_event_signals\n");
+    job->err = -1;
+    free(sig);
+    free(cpos);
+    free(cen);
+    return NULL;
+  }
+
+  for (;;) {
+#ifndef NO_THREADS
+    pthread_mutex_lock(&job->lock);
+#endif
+    k = job->next++;
+#ifndef NO_THREADS
+    pthread_mutex_unlock(&job->lock);
+#endif
+    if (k >= job->nevents) break;
+
+    out = job->signal_out + (size_t) k*nout;
+    memset(out, 0, nout*sizeof(*out));
+    nc = cluster_hits(job->pos + job->first[k], job->energy + job->first[k],
+                      job->first[k+1] - job->first[k], job->cluster_size, cpos, cen);
+    if (job->nfailed) job->nfailed[k] = 0;
+    for (i = 0; i < nc; i++) {
+      if (get_signal(cpos[i], sig, &setup) < 0) {
+        if (job->nfailed) job->nfailed[k]++;
+        continue;
+      }
+      for (j = 0; j < nout; j++) out[j] += cen[i]*sig[j];
+    }
+  }
+  free(setup.sig_work);
+  free(sig);
+  free(cpos);
+  free(cen);
+  return NULL;
+}
+
+/* cluster_hits
+   merges each of the n hits (pos[i], energy[i]) into the first cluster whose
+   energy-weighted centre is closer than size, or starts a new cluster with it
+   returns the number of clusters, with their centres in cpos and energies in cen
+*/
+static int cluster_hits(const point *pos, const float *energy, int n, float size,
+                        point *cpos, float *cen){
+  float e;
+  int   i, c, nc = 0;
+
+  for (i = 0; i < n; i++) {
+    if (!(energy[i] > 0)) continue;
+    for (c = 0; c < nc; c++)
+      if (SQ(pos[i].x - cpos[c].x) + SQ(pos[i].y - cpos[c].y) +
+          SQ(pos[i].z - cpos[c].z) < SQ(size)) break;
+    if (c == nc) {
+      cpos[nc] = pos[i];
+      cen[nc++] = energy[i];
+      continue;
+    }
+    e = cen[c] + energy[i];
+    cpos[c].x = (cen[c]*cpos[c].x + energy[i]*pos[i].x)/e;
+    cpos[c].y = (cen[c]*cpos[c].y + energy[i]*pos[i].y)/e;
+    cpos[c].z = (cen[c]*cpos[c].z + energy[i]*pos[i].z)/e;
+    cen[c] = e;
+  }
+  return nc;
+}
+#undef SQ
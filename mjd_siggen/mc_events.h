@@ -0,0 +1,29 @@
+/* mc_events.h -- signals of multi-site events
+ *
+ * This module sums the signals of the energy depositions (hits) that make up
+ * each event of a Monte-Carlo simulation, calculating the events in parallel
+ */
+#ifndef _MC_EVENTS_H
+#define _MC_EVENTS_H
+
+#include "point.h"
+#include "mjd_siggen.h"
+
+/* get_event_signals
+   calculates the signals of nevents events, the hits of event k being
+   pos[i], energy[i] for first[k] <= i < first[k+1]. Hits closer than
+   cluster_size (mm) to the energy-weighted centre of an earlier cluster of
+   the same event are merged into it. The signal of each cluster, as from
+   get_signal(), is scaled by its energy and added to signal_out[k*ntsteps_out + t].
+   The number of clusters of event k whose signal could not be calculated
+   (e.g. outside the detector) is put in nfailed[k], if nfailed is not NULL.
+   The events are shared among nthreads threads, each working on its own
+   copy of setup, which is not changed; with NO_THREADS (mjd_siggen.h), they
+   are calculated in the calling thread.
+   returns 0 for success, -1 for failure
+*/
+int get_event_signals(const point *pos, const float *energy, const int *first, int nevents,
+                      float cluster_size, float *signal_out, int *nfailed, int nthreads,
+                      MJD_Siggen_Setup *setup);
+
+#endif /*#ifndef _MC_EVENTS_H*/
@@ -7,6 +7,15 @@
       - added intelligent coarse grid / refinement of grid
       - added interpolation of RC and LC positions on the grid
    June 2016: added optional bulletization of point contact
+   added search for the depletion voltage (-d option), using warm starts
+      of the relaxation from the potential at the previous bias
+   added capacitance vs. bias sweep (-s option), with the undepleted
+      region treated as part of the point contact for the WP
+   added optional solution of the WP by preconditioned conjugate gradients (-g option)
+   added optional graded grid (xtal_grid_max > xtal_grid in the config file),
+      fine near the point contact, ditch and taper and coarser in the bulk
+   added optional 3-D fields and WP on a Cartesian grid (-3 option), for an
+      off-axis point contact and/or an impurity gradient across the crystal
 
    TO DO:
       - add other bulletizations
@@ -25,9 +34,73 @@
 
 #define MAX_ITS 50000     // default max number of iterations for relaxation
 #define MAX_ITS_FACTOR 2  // factor by which max iterations is reduced as grid is refined
+#define DEPL_VOLTS_PREC 1.0  // precision in volts of the depletion voltage search
+#define DEPL_MAX_DOUBLE 4    // max number of times to double the bias when looking for full depletion
 
 int report_config(FILE *fp_out, char *config_file_name);
 
+static int  mesh_setup(MJD_Siggen_Setup *setup);
+static int  graded_axis(int *x, int n, int *f, int nf, float grade, int kmax);
+static void grid_setup(MJD_Siggen_Setup *setup, float grid, float dLC_min);
+static void refine_grid(int ratio);
+static void set_permittivity(void);
+static int  ev_calc(MJD_Siggen_Setup *setup, float BV, int warm);
+static int  wp_calc(MJD_Siggen_Setup *setup, int warm);
+static int  wp_relax(int max_its, float *sum_dif_out);
+static int  wp_pcg(int istep, int max_its, float *sum_dif_out);
+static int  cg_setup(void);
+static void save_level(double **save, int diff);
+static double capacitance(float grid, double *alt_cap);
+static int  find_depletion(MJD_Siggen_Setup *setup, float BV, float *depl_volts, float *pinch_volts);
+static int  cv_sweep(MJD_Siggen_Setup *setup, float BV, float step_volts, char *config_file_name);
+static int  field3_calc(MJD_Siggen_Setup *setup, float BV, int WV, int WP, char *config_file_name);
+
+/* arrays and geometry shared by the relaxation routines;
+   arrays are malloc'ed in main() for the finest grid
+     double v[2][L+5][R+5];
+     double eps[L+1][R+1], eps_dr[L+1][R+1], eps_dz[L+1][R+1];
+     double vfraction[L+1][R+1], s1[R], s2[R], drrc[LC+2], drrc[LC+2];
+     double v_save[3][L+1][R+1], v_prev[L+1][R+1], wp_save[3][L+1][R+1];
+     char   undepleted[R+1][L+1];
+     int    bulk[L+1][R+1], rrc[LC+2];
+*/
+static double **v[2], **eps, **eps_dr, **eps_dz, **vfraction, *s1, *s2, *sz1, *sz2;
+static double **v_save[3];  // EV from the previous call to ev_calc(), for each grid step
+static double **v_prev;     // EV from the call before that, on the first grid step
+static double **wp_save[3]; // WP from the previous call to wp_calc(), for each grid step
+static char   **undepleted;
+static int    **bulk, *rrc;
+static float  *drrc, *frrc;
+static double *imp_ra, *imp_rm, *imp_z;
+
+static int    R = 0;   // radius of detector, in grid lengths
+static int    L = 0;   // length of detector, in grid lengths
+static int    RC = 0;  // radius of central contact, in grid lengths
+static int    LC = 0;  // length of central contact, in grid lengths
+static int    LT = 0;  // length of taper, in grid lengths
+static int    RO = 0;  // radius of wrap-around outer (Li) contact, in grid lengths
+static int    LO = 0;  // length of ditch next to wrap-around outer (Li) contact, in grid lengths
+static int    WO = 0;  // width of ditch next to wrap-around outer (Li) contact, in grid lengths
+static int    LH = 0;  // depth of ICPC well, in grid lengths
+static int    RH = 0;  // radius of ICPC well, in grid lengths
+static float  N = 1;   // charge density at z=0 in units of e+10/cm3
+static float  M = 0;   // charge density gradient, in units of e+10/cm4
+static int    LL, RR;  // length and radius on the finest grid
+static float  dRC, dLC, fLC=0, gridstep[3];
+
+static int    old, new=0;          // indices into v[] of the last two iterations
+static int    fully_depleted=0;
+static int    pinched_off=0;       // set if the undepleted region includes a pinch-off bubble
+static float  bubble_volts=0;
+static double undepleted_vol=0;    // volume of undepleted region, in mm3
+static float  saved_BV;            // bias of the potential stored in v_save[]
+static float  prev_BV;             // bias of the potential stored in v_prev
+static int    have_prev = 0;       // set if v_prev holds a potential
+static int    quiet = 0;           // set to suppress reports of the relaxation iterations
+static int    wp_cg = 0;           // set to solve for the WP by conjugate gradients instead of relaxation
+static int    graded = 0;          // set for a graded grid (single grid step of varying size)
+static int    *ir, *iz;            // positions of the grid points in units of xtal_grid
+
 
 int main(int argc, char **argv)
 {
@@ -35,47 +108,39 @@ int main(int argc, char **argv)
   MJD_Siggen_Setup setup;
 
   /* --- default values, normally over-ridden by values in a *.conf file --- */
-  int   R = 0;   // radius of detector, in grid lengths
-  int   L = 0;   // length of detector, in grid lengths
-  int   RC = 0;  // radius of central contact, in grid lengths
-  int   LC = 0;  // length of central contact, in grid lengths
-  int   LT = 0;  // length of taper, in grid lengths
-  int   RO = 0;  // radius of wrap-around outer (Li) contact, in grid lengths
-  int   LO = 0;  // length of ditch next to wrap-around outer (Li) contact, in grid lengths
-  int   WO = 0;  // width of ditch next to wrap-around outer (Li) contact, in grid lengths
   float BV = 0;  // bias voltage
-  float N = 1;   // charge density at z=0 in units of e+10/cm3
-  float M = 0;   // charge density gradient, in units of e+10/cm4
 
   int   WV = 0;  // 0: do not write the V and E values to ppc_ev.dat
                  // 1: write the V and E values to ppc_ev.dat
                  // 2: write the V and E values for both +r, -r (for gnuplot, NOT for siggen)
   int   WP = 0;  // 0: do not calculate the weighting potential
                  // 1: calculate the WP and write the values to ppc_wp.dat
+  int   WD = 0;  // 0: do not search for the depletion voltage
+                 // 1: find the depletion voltage, then calculate the field at BV
+  float CV = 0;  // 0: do not calculate capacitance vs. bias
+                 // >0: step size in volts for capacitance vs. bias, from CV to BV
+  int   WG = 0;  // 0: calculate the WP by relaxation
+                 // 1: calculate the WP by preconditioned conjugate gradients
+  int   W3 = 0;  // 0: calculate the fields on the (r,z) grid
+                 // 1: calculate the fields on a 3-D (x,y,z) grid
   /* ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  --- */
 
-  double **v[2], **eps, **eps_dr, **eps_dz, **vfraction, *s1, *s2;
-  char   **undepleted, config_file_name[256];
-  int    **bulk, *rrc;
-  float  *drrc, *frrc;
-  double eps_sum, v_sum, mean, min, f, f1z, f2z, f1r, f2r;
-  double e_over_E = 11.31; // e/epsilon
-                           // for 1 mm2, charge units 1e10 e/cm3, espilon = 16*epsilon0
-  float  dif, sum_dif=0, max_dif, a, b, c, grid = 0.5, dRC, dLC, fLC=0;
-  float  E_r, E_z, bubble_volts=0, cs, gridstep[3];
-  int    i, j, r, z, iter, old, new=0, zz, rr, istep, max_its;
+  char   config_file_name[256];
+  double esum, esum2;
+  float  E_r, E_z, grid = 0.5, cs, depl_volts = 0, pinch_volts = 0;
+  int    i, j, r, z;
   FILE   *file;
-  time_t t0=0, t1, t2=0;
-  double esum, esum2, pi=3.14159, Epsilon=(8.85*16.0/1000.0);  // permittivity of Ge in pF/mm
-  double pinched_sum1, pinched_sum2, *imp_ra, *imp_rm, *imp_z, S=0;
-  int    gridfact, fully_depleted=0, LL=L, RR=R, zmax, rmax;
 
   if (argc%2 != 1) {
     printf("Possible options:\n"
 	   "      -c config_file_name\n"
 	   "      -b bias_volts\n"
 	   "      -w {0,1}    (do_not/do write the field file)\n"
-	   "      -p {0,1}    (do_not/do write the WP file)\n");
+	   "      -p {0,1}    (do_not/do write the WP file)\n"
+	   "      -d {0,1}    (do_not/do search for the depletion voltage)\n"
+	   "      -s step_volts  (calculate capacitance vs. bias in steps of step_volts)\n"
+	   "      -g {0,1}    (WP by relaxation/conjugate gradients)\n"
+	   "      -3 {0,1}    ((r,z)/3-D fields)\n");
     return 1;
   }
 
@@ -97,6 +162,8 @@ int main(int argc, char **argv)
       RO = lrint(setup.wrap_around_radius/grid);
       LO = lrint(setup.ditch_depth/grid);
       WO = lrint(setup.ditch_thickness/grid);
+      LH = lrint(setup.hole_length/grid);
+      RH = lrint(setup.hole_radius/grid);
       // LiT = lrint(setup.Li_thickness/grid);
       N  = setup.impurity_z0;
       M  = setup.impurity_gradient;
@@ -110,12 +177,24 @@ int main(int argc, char **argv)
       WV = atoi(argv[i+1]);   // write-out options
     } else if (strstr(argv[i], "-p")) {
       WP = atoi(argv[i+1]);   // weighting-potential options
+    } else if (strstr(argv[i], "-d")) {
+      WD = atoi(argv[i+1]);   // depletion voltage options
+    } else if (strstr(argv[i], "-s")) {
+      CV = fabs(atof(argv[i+1]));  // capacitance vs. bias step size
+    } else if (strstr(argv[i], "-g")) {
+      WG = atoi(argv[i+1]);   // WP solver options
+    } else if (strstr(argv[i], "-3")) {
+      W3 = atoi(argv[i+1]);   // 3-D field options
     } else {
       printf("Possible options:\n"
 	     "      -c config_file_name\n"
 	     "      -b bias_volts\n"
 	     "      -w {0,1,2}    (for WV options)\n"
-	     "      -p {0,1}      (for WP options)\n");
+	     "      -p {0,1}      (for WP options)\n"
+	     "      -d {0,1}      (do_not/do search for the depletion voltage)\n"
+	     "      -s step_volts (calculate capacitance vs. bias in steps of step_volts)\n"
+	     "      -g {0,1}      (WP by relaxation/conjugate gradients)\n"
+	     "      -3 {0,1}      ((r,z)/3-D fields)\n");
       return 1;
     }
   }
@@ -126,24 +205,29 @@ int main(int argc, char **argv)
 	   "      -c config_file_name\n"
 	   "      -b bias_volts\n"
 	   "      -w {0,1,2}    (for WV options)\n"
-	   "      -p {0,1}      (for WP options)\n");
+	   "      -p {0,1}      (for WP options)\n"
+	   "      -d {0,1}      (do_not/do search for the depletion voltage)\n"
+	   "      -s step_volts (calculate capacitance vs. bias in steps of step_volts)\n"
+	   "      -g {0,1}      (WP by relaxation/conjugate gradients)\n"
+	   "      -3 {0,1}      ((r,z)/3-D fields)\n");
     return 1;
   }
+  if (mesh_setup(&setup)) return 1;
   if (L*R > 2500*2500) {
     printf("Error: Crystal size divided by grid size is too large!\n");
     return 1;
   }
   if (WV < 0 || WV > 2) WV = 0;
 
-  if (RO <= 0.0 || RO >= R) {
-    RO = R - LT;    // inner radius of taper, in grid lengths
+  if (RO <= 0.0 || RO >= ir[R]) {
+    RO = ir[R] - LT;    // inner radius of taper, in grid lengths
     printf("\n\n"
 	   " Crystal: Radius x Length: %.1f x %.1f mm\n"
 	   "   Taper: %.1f mm\n"
 	   "No wrap-around contact or ditch...\n"
 	   "Bias: %.0f V\n"
 	   "Impurities: (%.3f + %.3fz) e10/cm3\n\n",
-	   grid * (float) R, grid * (float) L, grid * (float) LT,
+	   grid * (float) ir[R], grid * (float) iz[L], grid * (float) LT,
 	   BV, N, M);
   } else {
     printf("\n\n"
@@ -152,9 +236,12 @@ int main(int argc, char **argv)
 	   "Wrap-around: Radius x ditch x gap:  %.1f x %.1f x %.1f mm\n"
 	   "       Bias: %.0f V\n"
 	   " Impurities: (%.3f + %.3fz) e10/cm3\n\n",
-	   grid * (float) R, grid * (float) L, grid * (float) LT,
+	   grid * (float) ir[R], grid * (float) iz[L], grid * (float) LT,
 	   grid * (float) RO, grid * (float) LO, grid * (float) WO, BV, N, M);
   }
+  if (LH > 0)
+    printf("      Well: Radius x depth: %.1f x %.1f mm\n",
+	   grid * (float) RH, grid * (float) LH);
   if (setup.bulletize_PC)
     printf("   Contact: Radius x length: %.1f x %.1f mm, bulletized\n\n",
 	   grid * (float) RC, grid * (float) LC);
@@ -173,13 +260,12 @@ int main(int argc, char **argv)
     N = -N;
   }
 
-  /* malloc arrays
-     float v[2][L+5][R+5];
-     float eps[L+1][R+1], eps_dr[L+1][R+1], eps_dz[L+1][R+1];
-     float vfraction[L+1][R+1], s1[R], s2[R], drrc[LC+2], drrc[LC+2];
-     char  undepleted[R+1][L+1];
-     int   bulk[L+1][R+1], rrc[LC+2];
-  */
+  if (W3) {
+    if (WD || CV > 0) printf("Note: -d and -s are not available for 3-D fields\n");
+    return field3_calc(&setup, BV, WV, WP, config_file_name);
+  }
+
+  /* malloc arrays */
   if ((v[0]   = malloc((L+5)*sizeof(*v[0]))) == NULL ||
       (v[1]   = malloc((L+5)*sizeof(*v[1]))) == NULL ||
       (eps    = malloc((L+1)*sizeof(*eps)))  == NULL ||
@@ -195,7 +281,9 @@ int main(int argc, char **argv)
       (drrc  = malloc((LC+2)*sizeof(*drrc))) == NULL ||
       (frrc  = malloc((LC+2)*sizeof(*frrc))) == NULL ||
       (s1 = malloc((R+1)*sizeof(*s1))) == NULL ||
-      (s2 = malloc((R+1)*sizeof(*s2))) == NULL) {
+      (s2 = malloc((R+1)*sizeof(*s2))) == NULL ||
+      (sz1 = malloc((L+1)*sizeof(*sz1))) == NULL ||
+      (sz2 = malloc((L+1)*sizeof(*sz2))) == NULL) {
     printf("Malloc failed\n");
     return 1;
   }
@@ -211,6 +299,27 @@ int main(int argc, char **argv)
     if ((undepleted[j] = malloc((L+1)*sizeof(**undepleted))) == NULL) ERR;
     memset(undepleted[j], ' ', (L+1)*sizeof(**undepleted));
   }
+  if (WD || CV > 0) {  // potentials to warm-start the relaxation when changing the bias
+    for (i=0; i<3; i++) {
+      if ((v_save[i] = malloc((L+1)*sizeof(*v_save[i]))) == NULL) ERR;
+      for (j=0; j<L+1; j++) if ((v_save[i][j] = malloc((R+1)*sizeof(**v_save[i]))) == NULL) ERR;
+    }
+    if ((v_prev = malloc((L+1)*sizeof(*v_prev))) == NULL) ERR;
+    for (j=0; j<L+1; j++) if ((v_prev[j] = malloc((R+1)*sizeof(**v_prev))) == NULL) ERR;
+  }
+  if (CV > 0) {
+    for (i=0; i<3; i++) {
+      if ((wp_save[i] = malloc((L+1)*sizeof(*wp_save[i]))) == NULL) ERR;
+      for (j=0; j<L+1; j++) if ((wp_save[i][j] = malloc((R+1)*sizeof(**wp_save[i]))) == NULL) ERR;
+    }
+  }
+  if (WG && WP) {
+    if (cg_setup()) {
+      printf("Malloc failed\n");
+      return 1;
+    }
+    wp_cg = 1;
+  }
   for (r=0; r<R+1; r++) {
     imp_ra[r] = 0.0;
     imp_rm[r] = 1.0;
@@ -232,6 +341,25 @@ int main(int argc, char **argv)
     s1[r] = 1.0 + 0.5 / (double) r;   //  for r+1
     s2[r] = 1.0 - 0.5 / (double) r;   //  for r-1
   }
+  for (z=0; z<L+1; z++) sz1[z] = sz2[z] = 1.0;  // for z+1, z-1
+  if (graded) {
+    /* on a graded grid, the weights are the areas of the faces of the voxel
+       over the distances to the neighbours, divided by the voxel volume;
+       in units of xtal_grid, so that they reduce to the values above on a uniform grid */
+    double rp, rm, dz;
+    for (r=0; r<R; r++) {
+      rp = 0.5 * (double) (ir[r] + ir[r+1]);
+      rm = (r > 0 ? 0.5 * (double) (ir[r-1] + ir[r]) : 0.0);
+      s1[r] = 2.0 * rp / ((rp*rp - rm*rm) * (double) (ir[r+1] - ir[r]));
+      s2[r] = 2.0 * rm / ((rp*rp - rm*rm) * (double) (r > 0 ? ir[r] - ir[r-1] : 1));
+    }
+    sz1[0] = sz2[0] = 1.0 / (double) ((iz[1] - iz[0]) * (iz[1] - iz[0]));  // reflection at z=0
+    for (z=1; z<L; z++) {
+      dz = 0.5 * (double) (iz[z+1] - iz[z-1]);
+      sz1[z] = 1.0 / (dz * (double) (iz[z+1] - iz[z]));
+      sz2[z] = 1.0 / (dz * (double) (iz[z] - iz[z-1]));
+    }
+  }
 
   /*
     If grid is too small compared to the crystal size, then it will take too
@@ -240,7 +368,11 @@ int main(int argc, char **argv)
   */
   cs = sqrt(setup.xtal_length * setup.xtal_radius);
   i = 1 + ((int) (cs/grid)) / 100;
-  if (i < 2) {
+  if (graded) {
+    gridstep[0] = grid;
+    gridstep[1] = gridstep[2] = 0;
+    printf("Graded grid size: %.4f to %.4f\n", grid, setup.xtal_grid_max);
+  } else if (i < 2) {
     gridstep[0] = grid;
     gridstep[1] = gridstep[2] = 0;
     printf("Single grid size: %.4f\n", grid);
@@ -259,16 +391,380 @@ int main(int argc, char **argv)
 	   gridstep[0], gridstep[1], grid, i, j);
   }
 
-  /* to be safe, initialize overall potential to bias voltage */
-  for (z=0; z<LL+1; z++) {
-    for (r=0; r<RR+1; r++) {
-      v[0][z][r] = v[1][z][r] = BV;
+  if (WD && find_depletion(&setup, BV, &depl_volts, &pinch_volts)) return 1;
+  if (CV > 0 && cv_sweep(&setup, BV, CV, config_file_name)) return 1;
+  // now go on to the potential at the requested bias, starting from the last one if any
+  if (ev_calc(&setup, BV, (WD || CV > 0))) return 1;
+  grid = setup.xtal_grid;
+
+  if (WV) {
+    if (setup.impurity_z0 > 0) {
+      // swap voltages back to negative for n-type material
+      for (r=0; r<R+1; r++) {
+	for (z=0; z<L+1; z++) {
+	  v[new][z][r] = -v[new][z][r];
+	}
+      }
+    }
+    // write potential and field to output file
+    if (!(file = fopen(setup.field_name, "w"))) {
+      printf("ERROR: Cannot open file %s for electric field...\n", setup.field_name);
+      return 1;
+    } else {
+      printf("Writing electric field data to file %s\n", setup.field_name);
+    }
+    /* copy configuration parameters to output file */
+    report_config(file, config_file_name);
+    fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", BV);
+    if (fully_depleted) {
+      fprintf(file, "# Detector is fully depleted.\n");
+    } else {
+      fprintf(file, "# Detector is not fully depleted.\n");
+      if (bubble_volts > 0.0f) fprintf(file, "# Pinch-off bubble at %.0f V potential\n", bubble_volts);
+    }
+    if (WD) fprintf(file, "# Depletion voltage: %.0f V\n", depl_volts);
+    fprintf(file, "#\n## r (mm), z (mm), V (V),  E (V/cm), E_r (V/cm), E_z (V/cm)\n");
+
+    for (r=0; r<R+1; r++) {
+      for (z=0; z<L+1; z++) {
+	// calc E in r-direction
+	if (r==0) {
+	  // E_r = (v[new][z][r] - v[new][z][r+1])/(0.1*grid);
+	  E_r = 0;
+	} else if (r==R) {
+	  E_r = (v[new][z][r-1] - v[new][z][r])/(0.1*grid);
+	} else {
+	  E_r = (v[new][z][r-1] - v[new][z][r+1])/(0.2*grid);
+	}
+	// calc E in z-direction
+	if (z==0) {
+	  E_z = (v[new][z][r] - v[new][z+1][r])/(0.1*grid);
+	} else if (z==L) {
+	  E_z = (v[new][z-1][r] - v[new][z][r])/(0.1*grid);
+	} else {
+	  E_z = (v[new][z-1][r] - v[new][z+1][r])/(0.2*grid);
+	}
+	if (graded) {
+	  // central differences on the graded grid, one-sided at the edges
+	  i = (r < R ? r+1 : R);
+	  j = (r > 0 ? r-1 : 0);
+	  E_r = 0;
+	  if (r > 0) E_r = (v[new][z][j] - v[new][z][i])/(0.1*grid*(float) (ir[i] - ir[j]));
+	  i = (z < L ? z+1 : L);
+	  j = (z > 0 ? z-1 : 0);
+	  E_z = (v[new][j][r] - v[new][i][r])/(0.1*grid*(float) (iz[i] - iz[j]));
+	}
+	fprintf(file, "%7.2f %7.2f %7.1f %7.1f %7.1f %7.1f\n",
+		((float) ir[r])*grid,  ((float) iz[z])*grid, v[new][z][r],
+		sqrt(E_r*E_r + E_z*E_z), E_r, E_z);
+      }
+      fprintf(file, "\n");
+    }
+    fclose(file);
+  }
+
+
+  if (WP == 0) return 0;
+  /*
+    -------------------------------------------------------------------------
+    now calculate the weighting potential for the central contact
+    the WP is also needed for calculating the capacitance
+    -------------------------------------------------------------------------
+  */
+  if (wp_calc(&setup, CV > 0)) return 1;
+  grid = setup.xtal_grid;
+
+  printf("Calculating integrals of weighting field\n");
+  esum = capacitance(grid, &esum2);
+  printf("\n  >>  Calculated capacitance at %.0f V: %.3lf pF\n", BV, esum);
+  if (esum2 > 0) {
+    printf("  >>  Alternative calculation of capacitance: %.3lf pF\n\n", esum2);
+  } else {
+    printf("\n");
+  }
+
+  if (WP == 1) {
+    // write WP values to output file
+    if (!(file = fopen(setup.wp_name, "w"))) {
+      printf("ERROR: Cannot open file %s for weighting potential...\n", setup.wp_name);
+      return 1;
+    } else {
+      printf("Writing weighting potential to file %s\n", setup.wp_name);
+    }
+    /* copy configuration parameters to output file */
+    report_config(file, config_file_name);
+    fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", BV);
+    if (fully_depleted) {
+      fprintf(file, "# Detector is fully depleted.\n");
+    } else {
+      fprintf(file, "# Detector is not fully depleted.\n");
+      if (bubble_volts > 0.0f) fprintf(file, "# Pinch-off bubble at %.0f V potential\n", bubble_volts);
+    }
+    if (WD) fprintf(file, "# Depletion voltage: %.0f V\n", depl_volts);
+    fprintf(file, "#\n## r (mm), z (mm), WP\n");
+    for (r=0; r<R+1; r++) {
+      for (z=0; z<L+1; z++) {
+	fprintf(file, "%7.2f %7.2f %10.6f\n",
+		((float) ir[r])*grid,  ((float) iz[z])*grid, v[new][z][r]);
+      }
+      fprintf(file, "\n");
+    }
+    fclose(file);
+  }
+
+  return 0;
+}
+
+/* mesh_setup
+   set up the positions ir[] and iz[] of the grid points, in units of xtal_grid;
+   on a uniform grid these are just the indices, while on a graded grid
+   (xtal_grid_max > xtal_grid) the grid size is xtal_grid near the point contact,
+   ditch, taper and well, and grows by xtal_grid_grade per unit distance away from them,
+   up to xtal_grid_max; L, R, LL and RR are then the numbers of graded grid steps
+   returns 0 for success
+*/
+static int mesh_setup(MJD_Siggen_Setup *setup) {
+  float grade = setup->xtal_grid_grade;
+  int   fr[8], fz[4], nfr = 2, nfz = 2, nr = R, nz = L, kmax, i;
+
+  kmax = lrint(setup->xtal_grid_max / setup->xtal_grid);
+  graded = (kmax > 1);
+  if (graded) {
+    if (grade <= 0.0f) grade = 0.1f;
+    if (grade > 0.5f) grade = 0.5f;  // limit the ratio of neighbouring grid steps
+    // intervals, in units of xtal_grid, where the grid is kept at the finest size
+    fr[0] = 0;
+    fr[1] = RC + 1;
+    if (RO > 0 && RO < R && WO > 0) {    // ditch
+      fr[nfr++] = RO - WO - 1;
+      fr[nfr++] = RO + 1;
+    }
+    if (LT > 0) {                        // taper
+      fr[nfr++] = R - LT - 1;
+      fr[nfr++] = R;
+    }
+    fz[0] = 0;
+    fz[1] = (LC > LO ? LC : LO);
+    if (fz[1] < LT) fz[1] = LT;
+    fz[1]++;
+    if (LH > 0 && RH > 0) {              // ICPC well
+      fr[nfr++] = RH - 1;
+      fr[nfr++] = RH + 1;
+      fz[nfz++] = L - LH - 1;
+      fz[nfz++] = L;
+    }
+    nr = graded_axis(NULL, R, fr, nfr, grade, kmax);
+    nz = graded_axis(NULL, L, fz, nfz, grade, kmax);
+  }
+  if ((ir = malloc((nr+1)*sizeof(*ir))) == NULL ||
+      (iz = malloc((nz+1)*sizeof(*iz))) == NULL) {
+    printf("Malloc failed\n");
+    return 1;
+  }
+  if (graded) {
+    graded_axis(ir, R, fr, nfr, grade, kmax);
+    graded_axis(iz, L, fz, nfz, grade, kmax);
+    printf("Graded grid: %d x %d points instead of %d x %d\n",
+	   nz+1, nr+1, L+1, R+1);
+    L = LL = nz;
+    R = RR = nr;
+  } else {
+    for (i=0; i<nr+1; i++) ir[i] = i;
+    for (i=0; i<nz+1; i++) iz[i] = i;
+  }
+  return 0;
+}
+
+/* graded_axis
+   fill x[] (if not NULL) with the positions of the points of a graded grid
+   from 0 to n, in units of the finest grid size; each grid step is at most
+   1 + grade * (its distance to the nearest of the nf/2 intervals [f[2i], f[2i+1]]),
+   and at most kmax
+   returns the number of grid steps
+*/
+static int graded_axis(int *x, int n, int *f, int nf, float grade, int kmax) {
+  int p = 0, m = 0, k, j, d, d1;
+
+  if (x) x[0] = 0;
+  while (p < n) {
+    for (k=kmax; k>1; k--) {
+      // distance from [p, p+k] to the nearest interval
+      d = n;
+      for (j=0; j<nf; j+=2) {
+	if (p+k >= f[j] && p <= f[j+1]) {
+	  d1 = 0;
+	} else if (p > f[j+1]) {
+	  d1 = p - f[j+1];
+	} else {
+	  d1 = f[j] - (p+k);
+	}
+	if (d > d1) d = d1;
+      }
+      if (k <= 1 + (int) (grade * (float) d)) break;
+    }
+    if (n - p <= k) {
+      k = n - p;
+    } else if (n - p < 2*k) {  // avoid a short last step
+      k = (n - p + 1) / 2;
+    }
+    p += k;
+    m++;
+    if (x) x[m] = p;
+  }
+  return m;
+}
+
+/* grid_setup
+   recalculate geometry dimensions in units of the grid size,
+   including the (optionally bulletized) point contact radius rrc[z];
+   offsets of the PC length from the middle of a pixel smaller than dLC_min are ignored
+*/
+static void grid_setup(MJD_Siggen_Setup *setup, float grid, float dLC_min) {
+  float a, b, c;
+  int   z;
+
+  if (!graded) {  // on a graded grid, L and R stay the numbers of graded grid steps
+    L  = lrint(setup->xtal_length/grid);
+    R  = lrint(setup->xtal_radius/grid);
+  }
+  // BRT = lrint(setup->top_bullet_radius/grid);
+  // BRB = lrint(setup->bottom_bullet_radius/grid);
+  LC = lrint(setup->pc_length/grid);
+  // distance in grid units from PC length to the middle of the nearest pixel:
+  dLC = setup->pc_length/grid - (float) LC;
+  if (dLC < dLC_min && dLC > -dLC_min) dLC = 0;
+  RC = lrint(setup->pc_radius/grid);
+  // distance in grid units from PC radius to the middle of the nearest pixel:
+  dRC = setup->pc_radius/grid - (float) RC;
+  if (dRC < 0.05 && dRC > -0.05) dRC = 0;
+  /* set up bulletization inside point contact */
+  if (setup->bulletize_PC) {
+    for (z=0; z<=LC; z++) {
+      if (setup->pc_length <= setup->pc_radius) {  // LC <= RC; use LC as bulletization radius
+        a = setup->pc_radius - setup->pc_length;
+        b = z * grid;
+        c = setup->pc_length*setup->pc_length - b*b;
+        if (c < 0.0) c = 0;
+        c = a + sqrt(c);
+      } else {  // LC > RC; use RC as bulletization radius
+        if (z > LC-RC) {
+          a = setup->pc_length - setup->pc_radius;
+          b = z * grid - a;
+          c = setup->pc_radius*setup->pc_radius - b*b;
+          if (c < 0.0) c = 0;
+          c = sqrt(c);
+        } else {
+          c = setup->pc_radius;
+        }
+      }
+      rrc[z] = lrint(c/grid);
+      drrc[z] = c/grid - (float) rrc[z];
+      if (drrc[z] < 0.05 && drrc[z] > -0.05) drrc[z] = 0;
+      frrc[z] = 0;
+      // printf(">> z rrc drrc: %d %d %f\n", z, rrc[z], drrc[z]);
+    }
+    drrc[LC+1] = drrc[LC];
+  } else {  // no bulletization
+    for (z=0; z<=LC+1; z++) {
+      rrc[z] = RC;
+      drrc[z] = dRC;
+      frrc[z] = 0;
+    }
+  }
+
+  LT = lrint(setup->taper_length/grid);
+  RO = lrint(setup->wrap_around_radius/grid);
+  LO = lrint(setup->ditch_depth/grid);
+  WO = lrint(setup->ditch_thickness/grid);
+  LH = lrint(setup->hole_length/grid);
+  RH = lrint(setup->hole_radius/grid);
+  // LiT = lrint(setup->Li_thickness/grid);
+}
+
+/* refine_grid
+   copy/expand the potential in v[1] on the previous (coarser) grid to v[0]
+   on the new finer grid, by linear interpolation;
+   ratio = ratio of the grid sizes, and L, R are still those of the coarse grid
+*/
+static void refine_grid(int ratio) {
+  double f, f1z, f2z, f1r, f2r;
+  int    z, r, zz, rr, zmax, rmax;
+
+  f = 1.0 / (float) ratio;
+  for (z=0; z<L+1; z++) {
+    for (r=0; r<R+1; r++) {
+      f1z = 0.0;
+      zmax = ratio*z+ratio;
+      if (zmax > LL+1) zmax = LL+1;
+      for (zz=ratio*z; zz<zmax; zz++) {
+	f2z = 1.0 - f1z;
+	f1r = 0.0;
+	rmax = ratio*r+ratio;
+	if (rmax > RR+1) rmax = RR+1;
+	for (rr=ratio*r; rr<rmax; rr++) {
+	  f2r = 1.0 - f1r;
+	  v[0][zz][rr] =      // linear interpolation of potential
+	    f2z*f2r*v[1][z][r  ] + f1z*f2r*v[1][z+1][r  ] +
+	    f2z*f1r*v[1][z][r+1] + f1z*f1r*v[1][z+1][r+1];
+	  f1r += f;
+	}
+	f1z += f;
+      }
+    }
+  }
+}
+
+/* boundary conditions and permittivity
+   boundary condition at Ge-vacuum interface:
+   epsilon0 * E_vac = espilon_Ge * E_Ge
+*/
+static void set_permittivity(void) {
+  int z, r;
+
+  for (z=0; z<L+1; z++) {
+    for (r=0; r<R+1; r++) {
+      eps[z][r] = eps_dz[z][r] = eps_dr[z][r] = 16;   // permittivity inside Ge
+      if (iz[z] < LO  && ir[r] < RO && ir[r] > RO-WO-1) eps[z][r] =  1;  // permittivity inside vacuum
+      if (r > 0) eps_dr[z][r-1] = (eps[z][r-1]+eps[z][r])/2.0f;
+      if (z > 0) eps_dz[z-1][r] = (eps[z-1][r]+eps[z][r])/2.0f;
+    }
+  }
+}
+
+/* ev_calc
+   calculate the potential at bias BV by relaxation, going through the grid sizes
+   in gridstep[]; sets fully_depleted, pinched_off, bubble_volts and undepleted_vol
+   if warm != 0, start from the potential calculated in the previous call
+     (requires that v_save[] be allocated), with the change in the potential
+     on each grid interpolated from the next coarser grid; on the first grid,
+     the change is extrapolated from the two previous calls, which is exact
+     while the detector is fully depleted
+   returns 0 for success
+*/
+static int ev_calc(MJD_Siggen_Setup *setup, float BV, int warm) {
+  double eps_sum, v_sum, mean, min, f, S=0;
+  double e_over_E = 11.31; // e/epsilon
+                           // for 1 mm2, charge units 1e10 e/cm3, espilon = 16*epsilon0
+  float  dif, sum_dif=0, max_dif, a, b, grid;
+  int    i, r, z, iter, istep, max_its;
+  FILE   *file;
+  time_t t0=0, t1, t2=0;
+
+  if (warm && v_save[0] == NULL) warm = 0;
+  for (r=0; r<RR+1; r++) memset(undepleted[r], ' ', (LL+1)*sizeof(**undepleted));
+
+  if (!warm) {
+    /* to be safe, initialize overall potential to bias voltage */
+    for (z=0; z<LL+1; z++) {
+      for (r=0; r<RR+1; r++) {
+	v[0][z][r] = v[1][z][r] = BV;
+      }
     }
   }
-  if (setup.verbosity >= CHATTY)
+  if (setup->verbosity >= CHATTY)
     t0 = t2 = time(NULL);  // for calculating elapsed time later...
   max_its = MAX_ITS;
-  if (setup.max_iterations > 0) max_its = setup.max_iterations;
+  if (setup->max_iterations > 0) max_its = setup->max_iterations;
   /* now set up and perform the relaxation for each of the grid step sizes in turn */
   for (istep=0; istep<3 && gridstep[istep]>0; istep++) {
     grid = gridstep[istep]; // grid size for this go-around
@@ -286,131 +782,77 @@ int main(int argc, char **argv)
       */
       i = (int) (gridstep[istep-1] / gridstep[istep] + 0.5);
       f = 1.0 / (float) i;
-      printf("\ngrid %.4f -> %.4f; ratio = %d %.3f\n\n",
-	     gridstep[istep-1], gridstep[istep], i, f);
-      for (z=0; z<L+1; z++) {
-	for (r=0; r<R+1; r++) {
-	  f1z = 0.0;
-	  zmax = i*z+i;
-	  if (zmax > LL+1) zmax = LL+1;
-	  for (zz=i*z; zz<zmax; zz++) {
-	    f2z = 1.0 - f1z;
-	    f1r = 0.0;
-	    rmax = i*r+i;
-	    if (rmax > RR+1) rmax = RR+1;
-	    for (rr=i*r; rr<rmax; rr++) {
-	      f2r = 1.0 - f1r;
-	      v[0][zz][rr] =      // linear interpolation of potential
-		f2z*f2r*v[1][z][r  ] + f1z*f2r*v[1][z+1][r  ] +
-		f2z*f1r*v[1][z][r+1] + f1z*f1r*v[1][z+1][r+1];
-	      f1r += f;
-	    }
-	    f1z += f;
-	  }
-	}
-      }
+      if (!quiet)
+	printf("\ngrid %.4f -> %.4f; ratio = %d %.3f\n\n",
+	       gridstep[istep-1], gridstep[istep], i, f);
+      refine_grid(i);
     }
 
     // recalculate geometry dimensions in units of the current grid size
-    L  = lrint(setup.xtal_length/grid);
-    R  = lrint(setup.xtal_radius/grid);
-    // BRT = lrint(setup.top_bullet_radius/grid);
-    // BRB = lrint(setup.bottom_bullet_radius/grid);
-    LC = lrint(setup.pc_length/grid);
-    // distance in grid units from PC length to the middle of the nearest pixel:
-    dLC = setup.pc_length/grid - (float) LC;
-    if (dLC < 0.01 && dLC > -0.01) dLC = 0;
-    RC = lrint(setup.pc_radius/grid);
-    // distance in grid units from PC radius to the middle of the nearest pixel:
-    dRC = setup.pc_radius/grid - (float) RC;
-    if (dRC < 0.05 && dRC > -0.05) dRC = 0;
-    /* set up bulletization inside point contact */
-    if (setup.bulletize_PC) {
-      for (z=0; z<=LC; z++) {
-        if (setup.pc_length <= setup.pc_radius) {  // LC <= RC; use LC as bulletization radius
-          a = setup.pc_radius - setup.pc_length;
-          b = z * grid;
-          c = setup.pc_length*setup.pc_length - b*b;
-          if (c < 0.0) c = 0;
-          c = a + sqrt(c);
-        } else {  // LC > RC; use RC as bulletization radius
-          if (z > LC-RC) {
-            a = setup.pc_length - setup.pc_radius;
-            b = z * grid - a;
-            c = setup.pc_radius*setup.pc_radius - b*b;
-            if (c < 0.0) c = 0;
-            c = sqrt(c);
-          } else {
-            c = setup.pc_radius;
-          }
-        }
-        rrc[z] = lrint(c/grid);
-        drrc[z] = c/grid - (float) rrc[z];
-        if (drrc[z] < 0.05 && drrc[z] > -0.05) drrc[z] = 0;
-        frrc[z] = 0;
-        // printf(">> z rrc drrc: %d %d %f\n", z, rrc[z], drrc[z]);
-      }
-      drrc[LC+1] = drrc[LC];
-    } else {  // no bulletization
-      for (z=0; z<=LC+1; z++) {
-        rrc[z] = RC;
-        drrc[z] = dRC;
-        frrc[z] = 0;
-      }
-    }
-    
-    LT = lrint(setup.taper_length/grid);
-    RO = lrint(setup.wrap_around_radius/grid);
-    LO = lrint(setup.ditch_depth/grid);
-    WO = lrint(setup.ditch_thickness/grid);
-    // LiT = lrint(setup.Li_thickness/grid);
+    grid_setup(setup, grid, 0.01);
 
-    S = setup.impurity_surface * e_over_E / grid;
+    S = setup->impurity_surface * e_over_E / grid;
     for (z=0; z<L+1; z++) {
-      imp_z[z] = (N + 0.1 * M * grid * (double) z + 
-		  setup.impurity_quadratic * (1.0 - (double) ((z-L/2)*(z-L/2)) /
-					      (double) (L*L/4))) * e_over_E;
+      imp_z[z] = (N + 0.1 * M * grid * (double) iz[z] +
+		  setup->impurity_quadratic * (1.0 - (double) ((iz[z]-iz[L]/2)*(iz[z]-iz[L]/2)) /
+					      (double) (iz[L]*iz[L]/4))) * e_over_E;
     }
-    if (setup.impurity_rpower > 0.1) {
+    if (setup->impurity_rpower > 0.1) {
       for (r=0; r<R+1; r++) {
-	imp_ra[r] = setup.impurity_radial_add * e_over_E *
-	  pow((double) r / (double) R, setup.impurity_rpower);
-	imp_rm[r] = 1.0 + (setup.impurity_radial_mult - 1.0f) *
-	  pow((double) r / (double) R, setup.impurity_rpower);
+	imp_ra[r] = setup->impurity_radial_add * e_over_E *
+	  pow((double) ir[r] / (double) ir[R], setup->impurity_rpower);
+	imp_rm[r] = 1.0 + (setup->impurity_radial_mult - 1.0f) *
+	  pow((double) ir[r] / (double) ir[R], setup->impurity_rpower);
       }
     }
-    if (setup.verbosity >= NORMAL)
+    if (setup->verbosity >= NORMAL && !quiet)
       printf("grid = %f  RC = %d  dRC = %f  LC = %d  dLC = %f\n\n",
 	     grid, RC, dRC, LC, dLC);
-    if (RO <= 0.0 || RO >= R) RO = R - LT;    // inner radius of taper, in grid lengths
-
-    if (istep == 0) {
+    if (RO <= 0.0 || RO >= ir[R]) RO = ir[R] - LT;    // inner radius of taper, in grid lengths
+
+    if (warm) {
+      if (istep == 0 && have_prev && prev_BV != saved_BV) {
+	/* start from the previous potential, plus the change from the two
+	   previous calls scaled to the change in bias; the potential of a
+	   fully depleted detector is linear in the bias */
+	f = (BV - saved_BV) / (saved_BV - prev_BV);
+	for (z=0; z<L+1; z++) {
+	  for (r=0; r<R+1; r++) {
+	    v[0][z][r] = v_save[0][z][r] + f * (v_save[0][z][r] - v_prev[z][r]);
+	  }
+	}
+      } else if (istep == 0) {
+	/* start from the previous potential, plus a crude guess
+	   at the change resulting from the change in bias */
+	for (z=0; z<L+1; z++) {
+	  a = (float) (iz[z]) / (float) iz[L];
+	  for (r=0; r<R+1; r++) {
+	    v[0][z][r] = v_save[0][z][r] +
+	      (BV - saved_BV) * (a + (1.0f - a) * (float) (ir[r]) / (float) ir[R]);
+	  }
+	}
+      } else {
+	// v[0] now holds the interpolated change in potential on the coarser grid
+	for (z=0; z<L+1; z++) {
+	  for (r=0; r<R+1; r++) v[0][z][r] += v_save[istep][z][r];
+	}
+      }
+    } else if (istep == 0) {
       // no previous coarse relaxation, so make initial wild guess at potential:
       for (z=0; z<L; z++) {
-	a = BV * (float) (z) / (float) L;
+	a = BV * (float) (iz[z]) / (float) iz[L];
 	for (r=0; r<R; r++) {
-	  v[0][z][r] =  a + (BV - a) * (float) (r) / (float) R;
+	  v[0][z][r] =  a + (BV - a) * (float) (ir[r]) / (float) ir[R];
 	}
       }
     }
 
-    /* boundary conditions and permittivity
-       boundary condition at Ge-vacuum interface:
-       epsilon0 * E_vac = espilon_Ge * E_Ge
-    */
-    for (z=0; z<L+1; z++) {
-      for (r=0; r<R+1; r++) {
-	eps[z][r] = eps_dz[z][r] = eps_dr[z][r] = 16;   // permittivity inside Ge
-	if (z < LO  && r < RO && r > RO-WO-1) eps[z][r] =  1;  // permittivity inside vacuum
-	if (r > 0) eps_dr[z][r-1] = (eps[z][r-1]+eps[z][r])/2.0f;
-	if (z > 0) eps_dz[z-1][r] = (eps[z-1][r]+eps[z][r])/2.0f;
-      }
-    }
+    set_permittivity();
 
     for (z=0; z<L+1; z++) {
       for (r=0; r<R+1; r++) {
 	vfraction[z][r] = 1.0;
-	if (z < LO && r < RO && r > RO-WO-1) {
+	if (iz[z] < LO && ir[r] < RO && ir[r] > RO-WO-1) {
 	  vfraction[z][r] = 0.0;
 	}
 	// boundary conditions
@@ -418,8 +860,9 @@ int main(int argc, char **argv)
 	// outside (HV) contact:
 	if (z == L ||
 	    r == R ||
-	    r >= z + R - LT ||       // taper
-	    (z == 0 && r >= RO)) {   // wrap-around
+	    ir[r] >= iz[z] + ir[R] - LT ||  // taper
+	    (LH > 0 && ir[r] <= RH && iz[z] >= iz[L] - LH) ||  // ICPC well
+	    (z == 0 && ir[r] >= RO)) {     // wrap-around
 	  bulk[z][r] = -1;               // value of v[*][z][r] is fixed...
 	  v[0][z][r] = v[1][z][r] = BV;  // at the bias voltage
 	}
@@ -482,16 +925,16 @@ int main(int argc, char **argv)
 	  if (bulk[z][r] < 0) continue;      // outside or inside contact
 
 	  if (bulk[z][r] == 0) {             // normal bulk, no complications
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r];
+	    v_sum = v[old][z+1][r]*eps_dz[z][r]*sz1[z] + v[old][z][r+1]*eps_dr[z][r]*s1[r];
+	    eps_sum = eps_dz[z][r]*sz1[z] + eps_dr[z][r]*s1[r];
 	    min = fminf(v[old][z+1][r], v[old][z][r+1]);
 	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
+	      v_sum += v[old][z-1][r]*eps_dz[z-1][r]*sz2[z];
+	      eps_sum += eps_dz[z-1][r]*sz2[z];
 	      min = fminf(min, v[old][z-1][r]);
 	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
+	      v_sum += v[old][z+1][r]*eps_dz[z][r]*sz1[z];  // reflection symm around z=0
+	      eps_sum += eps_dz[z][r]*sz1[z];
 	    }
 	    if (r > 0) {
 	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
@@ -506,26 +949,26 @@ int main(int argc, char **argv)
 	    /* since the PC radius is not in the middle of a pixel,
 	       use a modified weight for the interpolation to (r-1)
 	     */
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
+	    v_sum = v[old][z+1][r]*eps_dz[z][r]*sz1[z] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
 	            v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*frrc[z];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*frrc[z];
+	    eps_sum = eps_dz[z][r]*sz1[z] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*frrc[z];
 	    min = fminf(v[old][z+1][r], v[old][z][r+1]);
 	    min = fminf(min, v[old][z][r-1]);
 	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
+	      v_sum += v[old][z-1][r]*eps_dz[z-1][r]*sz2[z];
+	      eps_sum += eps_dz[z-1][r]*sz2[z];
 	      min = fminf(min, v[old][z-1][r]);
 	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
+	      v_sum += v[old][z+1][r]*eps_dz[z][r]*sz1[z];  // reflection symm around z=0
+	      eps_sum += eps_dz[z][r]*sz1[z];
 	    }
 	  } else if (bulk[z][r] == 2) {    // interpolated z edge of point contact
 	    /* since the PC length is not in the middle of a pixel,
 	       use a modified weight for the interpolation to (z-1)
 	     */
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
-	            v[old][z-1][r]*eps_dz[z-1][r]*fLC;
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*fLC;
+	    v_sum = v[old][z+1][r]*eps_dz[z][r]*sz1[z] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
+	            v[old][z-1][r]*eps_dz[z-1][r]*sz2[z]*fLC;
+	    eps_sum = eps_dz[z][r]*sz1[z] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*sz2[z]*fLC;
 	    min = fminf(v[old][z+1][r], v[old][z][r+1]);
 	    min = fminf(min, v[old][z-1][r]);
 	    if (r > 0) {
@@ -551,13 +994,21 @@ int main(int argc, char **argv)
 
 	  // calculate the interpolated mean potential and the effect of the space charge
 	  mean = v_sum / eps_sum;
-	  v[new][z][r] = mean + vfraction[z][r] * (imp_z[z]*imp_rm[r] + imp_ra[r]);
-	  if (r == 0)  // special case where volume of voxel is 1/6 of area, not 1/4
-	    v[new][z][r] = mean + (vfraction[z][r] * (imp_z[z]*imp_rm[r] + imp_ra[r])) / 1.5;
-	  if ((z == 0 && r > RC && r < RO-WO) ||        // passivated surface at z = 0
-              (z < LO && (r == RO || r == RO-WO-1)) ||  // passivated surface on sides of ditch
-              (z == LO && r <= RO && r >= RO-WO-1))     // passivated surface at top of ditch
-	    v[new][z][r] += vfraction[z][r] * S;
+	  if (graded) {
+	    /* scale the space charge by the voxel volume over the sum of the weights
+	       (the latter is 4, or 6 for r = 0, on a uniform grid) */
+	    f = 4.0 / (s1[r] + s2[r] + sz1[z] + sz2[z]);
+	    v[new][z][r] = mean + f * vfraction[z][r] * (imp_z[z]*imp_rm[r] + imp_ra[r]);
+	  } else {
+	    f = 1.0;
+	    v[new][z][r] = mean + vfraction[z][r] * (imp_z[z]*imp_rm[r] + imp_ra[r]);
+	    if (r == 0)  // special case where volume of voxel is 1/6 of area, not 1/4
+	      v[new][z][r] = mean + (vfraction[z][r] * (imp_z[z]*imp_rm[r] + imp_ra[r])) / 1.5;
+	  }
+	  if ((z == 0 && r > RC && ir[r] < RO-WO) ||            // passivated surface at z = 0
+              (iz[z] < LO && (ir[r] == RO || ir[r] == RO-WO-1)) || // passivated surface on sides of ditch
+              (iz[z] == LO && ir[r] <= RO && ir[r] >= RO-WO-1))    // passivated surface at top of ditch
+	    v[new][z][r] += f * vfraction[z][r] * S;
 	  // check to see if the pixel is undepleted
 	  if (vfraction[z][r] > 0.45) undepleted[r][z] = '.';
 	  if (v[new][z][r] <= 0.0f) {
@@ -576,52 +1027,83 @@ int main(int argc, char **argv)
 	}
       }
       // report results for some iterations
-      if (iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0)
+      if (!quiet &&
+	  (iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0))
 	printf("%5d %d %d %.10f %.10f\n", iter, old, new, max_dif, sum_dif/(float) (L*R));
       if (max_dif < 0.000000001) break;
     }
 
-    printf("\n>> %d %.16f\n\n", iter, sum_dif);
+    if (!quiet) printf("\n>> %d %.16f\n\n", iter, sum_dif);
 
     fully_depleted = 1;
+    pinched_off = 0;
+    undepleted_vol = 0;
     for (r=0; r<R+1; r++) {
       for (z=0; z<L+1; z++) {
 	if (undepleted[r][z] == '*') {
 	  fully_depleted = 0;
-	  if (v[new][z][r] > 0.001) undepleted[r][z] = 'B';  // identifies pinch-off
+	  // volume of pixel / pi is 2r, or 1/4 for r = 0
+	  if (graded) {
+	    f = 0.5 * (double) (ir[r < R ? r+1 : R] + ir[r]);
+	    a = 0.5 * (double) (ir[r > 0 ? r-1 : 0] + ir[r]);
+	    undepleted_vol += (f*f - a*a) * 0.5 * (double) (iz[z < L ? z+1 : L] - iz[z > 0 ? z-1 : 0]);
+	  } else {
+	    undepleted_vol += (r == 0 ? 0.25 : 2.0 * (double) r);
+	  }
+	  if (v[new][z][r] > 0.001) {
+	    undepleted[r][z] = 'B';  // identifies pinch-off
+	    pinched_off = 1;
+	  }
 	}
       }
     }
-    if (fully_depleted) {
-      printf("Detector is fully depleted.\n");
-    } else {
-      printf("Detector is not fully depleted.\n");
-      if (bubble_volts > 0.0f) printf("Pinch-off bubble at %.0f V potential\n", bubble_volts);
+    undepleted_vol *= 3.14159 * grid*grid*grid;
+    if (!quiet) {
+      if (fully_depleted) {
+	printf("Detector is fully depleted.\n");
+      } else {
+	printf("Detector is not fully depleted.\n");
+	if (bubble_volts > 0.0f) printf("Pinch-off bubble at %.0f V potential\n", bubble_volts);
+      }
     }
-    if (setup.verbosity >= CHATTY) {
+    if (setup->verbosity >= CHATTY) {
       t1 = time(NULL);
       printf("\n ^^^^^^^^^^^^^ %d (%d) s elapsed ^^^^^^^^^^^^^^\n",
 	     (int) (t1 - t0), (int) (t1 - t2));
       t2 = t1;
     }
 
+    if (v_save[0] != NULL) {
+      // save this potential to warm-start the next call
+      if (istep == 0) {
+	// and keep the previous one, to extrapolate the change in bias
+	for (z=0; z<L+1; z++) memcpy(v_prev[z], v_save[0][z], (R+1)*sizeof(**v_prev));
+	prev_BV = saved_BV;
+	have_prev = warm;
+      }
+      save_level(v_save[istep], (warm && istep < 2 && gridstep[istep+1] > 0));
+      saved_BV = BV;
+    }
+
     if (istep == 0) {
       // can reduce # of iterations after first go-around
       max_its /= MAX_ITS_FACTOR;
       // report V and E along the axes r=0 and z=0
-      if (setup.verbosity >= NORMAL) {
+      if (setup->verbosity >= NORMAL && !quiet) {
 	printf("  z(mm)(r=0)      V   E(V/cm) |  r(mm)(z=0)      V   E(V/cm)\n");
 	a = b = v[new][0][0];
 	for (z=0; z<L+1; z++) {
 	  printf("%10.1f %8.1f %8.1f  |",
-		 ((float) z)*grid, v[new][z][0], (v[new][z][0] - a)/(0.1*grid));
+		 ((float) iz[z])*grid, v[new][z][0],
+		 (v[new][z][0] - a)/(0.1*grid*(float) (z > 0 ? iz[z] - iz[z-1] : 1)));
 	  a = v[new][z][0];
 	  if (z > R) {
 	    printf("\n");
 	  } else {
 	    r = z;
 	    printf("%10.1f %8.1f %8.1f\n",
-		   ((float) r)*grid, v[new][0][r], (v[new][0][r] - b)/(0.1*grid));
+		   ((float) ir[r])*grid, v[new][0][r],
+		   (v[new][0][r] - b)/(0.1*grid*(float) (r > 0 ? ir[r] - ir[r-1] : 1)));
 	    b = v[new][0][r];
 	  }
 	}
@@ -636,175 +1118,76 @@ int main(int argc, char **argv)
     }
   }
 
-  if (WV) {
-    if (setup.impurity_z0 > 0) {
-      // swap voltages back to negative for n-type material
-      for (r=0; r<R+1; r++) {
-	for (z=0; z<L+1; z++) {
-	  v[new][z][r] = -v[new][z][r];
-	}
+  return 0;
+}
+
+/* wp_calc
+   calculate the weighting potential of the point contact by relaxation,
+   going through the grid sizes in gridstep[]; undepleted regions found by
+   the previous call to ev_calc() are treated as part of the point contact
+   if warm != 0, start from the WP calculated in the previous call
+     (requires that wp_save[] be allocated)
+   returns 0 for success
+*/
+static int wp_calc(MJD_Siggen_Setup *setup, int warm) {
+  double f;
+  float  sum_dif=0, a, b, c, grid;
+  int    i, r, z, iter, istep, max_its, gridfact;
+  time_t t0=0, t1, t2=0;
+
+  if (!quiet) printf("\nCalculating weighting potential...\n\n");
+  if (setup->verbosity >= CHATTY) t0 = t2 = time(NULL);
+  max_its = MAX_ITS;
+  if (setup->max_iterations > 0) max_its = setup->max_iterations;
+  // max_its = 2*MAX_ITS;  // use twice as many iterations for WP; accuracy is more important?
+  // if (setup->max_iterations > 0) max_its = 2*setup->max_iterations;
+
+  if (warm && wp_save[0] == NULL) warm = 0;
+  if (!warm) {
+    /* to be safe, initialize overall potential to 0 */
+    for (z=0; z<LL+1; z++) {
+      for (r=0; r<RR+1; r++) {
+	v[0][z][r] = v[1][z][r] = 0;
       }
     }
-    // write potential and field to output file
-    if (!(file = fopen(setup.field_name, "w"))) {
-      printf("ERROR: Cannot open file %s for electric field...\n", setup.field_name);
-      return 1;
-    } else {
-      printf("Writing electric field data to file %s\n", setup.field_name);
+  }
+  for (istep=0; istep<3 && gridstep[istep]>0; istep++) {
+    grid = gridstep[istep];
+    old = 1;
+    new = 0;
+    // gridfact = integer ratio of current grid step size to final grid step size
+    gridfact = lrintf(grid / setup->xtal_grid);
+
+    if (istep > 0) {
+      /* the previous calculation was on a coarser grid...
+	 now copy/expand the potential to the new finer grid
+      */
+      i = (int) (gridstep[istep-1] / gridstep[istep] + 0.5);
+      f = 1.0 / (float) i;
+      if (!quiet)
+	printf("\ngrid %.4f -> %.4f; ratio = %d %.3f\n\n",
+	       gridstep[istep-1], gridstep[istep], i, f);
+      refine_grid(i);
     }
-    /* copy configuration parameters to output file */
-    report_config(file, config_file_name);
-    fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", BV);
-    if (fully_depleted) {
-      fprintf(file, "# Detector is fully depleted.\n");
-    } else {
-      fprintf(file, "# Detector is not fully depleted.\n");
-      if (bubble_volts > 0.0f) fprintf(file, "# Pinch-off bubble at %.0f V potential\n", bubble_volts);
-    }
-    fprintf(file, "#\n## r (mm), z (mm), V (V),  E (V/cm), E_r (V/cm), E_z (V/cm)\n");
-
-    for (r=0; r<R+1; r++) {
-      for (z=0; z<L+1; z++) {
-	// calc E in r-direction
-	if (r==0) {
-	  // E_r = (v[new][z][r] - v[new][z][r+1])/(0.1*grid);
-	  E_r = 0;
-	} else if (r==R) {
-	  E_r = (v[new][z][r-1] - v[new][z][r])/(0.1*grid);
-	} else {
-	  E_r = (v[new][z][r-1] - v[new][z][r+1])/(0.2*grid);
-	}
-	// calc E in z-direction
-	if (z==0) {
-	  E_z = (v[new][z][r] - v[new][z+1][r])/(0.1*grid);
-	} else if (z==L) {
-	  E_z = (v[new][z-1][r] - v[new][z][r])/(0.1*grid);
-	} else {
-	  E_z = (v[new][z-1][r] - v[new][z+1][r])/(0.2*grid);
-	}
-	fprintf(file, "%7.2f %7.2f %7.1f %7.1f %7.1f %7.1f\n",
-		((float) r)*grid,  ((float) z)*grid, v[new][z][r],
-		sqrt(E_r*E_r + E_z*E_z), E_r, E_z);
-      }
-      fprintf(file, "\n");
-    }
-    fclose(file);
-  }
-
-
-  if (WP == 0) return 0;
-  /*
-    -------------------------------------------------------------------------
-    now calculate the weighting potential for the central contact
-    the WP is also needed for calculating the capacitance
-    -------------------------------------------------------------------------
-  */
-
-  printf("\nCalculating weighting potential...\n\n");
-  if (setup.verbosity >= CHATTY) t0 = t2 = time(NULL);
-  max_its = MAX_ITS;
-  if (setup.max_iterations > 0) max_its = setup.max_iterations;
-  // max_its = 2*MAX_ITS;  // use twice as many iterations for WP; accuracy is more important?
-  // if (setup.max_iterations > 0) max_its = 2*setup.max_iterations;
 
-  /* to be safe, initialize overall potential to 0 */
-  for (z=0; z<LL+1; z++) {
-    for (r=0; r<RR+1; r++) {
-      v[0][z][r] = v[1][z][r] = 0;
-    }
-  }
-  for (istep=0; istep<3 && gridstep[istep]>0; istep++) {
-    grid = gridstep[istep];
-    old = 1;
-    new = 0;
-    // gridfact = integer ratio of current grid step size to final grid step size
-    gridfact = lrintf(grid / setup.xtal_grid);
+    grid_setup(setup, grid, 0.05);
+    if (!quiet)
+      printf("grid = %f  RC = %d  dRC = %f  LC = %d  dLC = %f\n\n",
+	     grid, RC, dRC, LC, dLC);
+    if (RO <= 0.0 || RO >= ir[R]) RO = ir[R] - LT;    // inner radius of taper, in grid lengths
 
-    if (istep > 0) {
-      /* the previous calculation was on a coarser grid...
-	 now copy/expand the potential to the new finer grid
-      */
-      i = (int) (gridstep[istep-1] / gridstep[istep] + 0.5);
-      f = 1.0 / (float) i;
-      printf("\ngrid %.4f -> %.4f; ratio = %d %.3f\n\n",
-	     gridstep[istep-1], gridstep[istep], i, f);
+    if (warm) {
+      // start from the previous WP, or add the interpolated change to it
       for (z=0; z<L+1; z++) {
 	for (r=0; r<R+1; r++) {
-	  f1z = 0.0;
-	  zmax = i*z+i;
-	  if (zmax > LL+1) zmax = LL+1;
-	  for (zz=i*z; zz<zmax; zz++) {
-	    f2z = 1.0 - f1z;
-	    f1r = 0.0;
-	    rmax = i*r+i;
-	    if (rmax > RR+1) rmax = RR+1;
-	    for (rr=i*r; rr<rmax; rr++) {
-	      f2r = 1.0 - f1r;
-	      v[0][zz][rr] =      // linear interpolation
-		f2z*f2r*v[1][z][r  ] + f1z*f2r*v[1][z+1][r  ] +
-		f2z*f1r*v[1][z][r+1] + f1z*f1r*v[1][z+1][r+1];
-	      f1r += f;
-	    }
-	    f1z += f;
+	  if (istep == 0) {
+	    v[0][z][r] = v[1][z][r] = wp_save[0][z][r];
+	  } else {
+	    v[0][z][r] += wp_save[istep][z][r];
 	  }
 	}
       }
-    }
-
-    L  = lrint(setup.xtal_length/grid);
-    R  = lrint(setup.xtal_radius/grid);
-    // BRT = lrint(setup.top_bullet_radius/grid);
-    // BRB = lrint(setup.bottom_bullet_radius/grid);
-    LC = lrint(setup.pc_length/grid);
-    dLC = setup.pc_length/grid - (float) LC;
-    if (dLC < 0.05 && dLC > -0.05) dLC = 0;
-    RC = lrint(setup.pc_radius/grid);
-    dRC = setup.pc_radius/grid - (float) RC;
-    if (dRC < 0.05 && dRC > -0.05) dRC = 0;
-    printf("grid = %f  RC = %d  dRC = %f  LC = %d  dLC = %f\n\n",
-	   grid, RC, dRC, LC, dLC);
-    /* set up bulletization inside point contact */
-    if (setup.bulletize_PC) {
-      for (z=0; z<=LC; z++) {
-        if (setup.pc_length <= setup.pc_radius) {  // LC <= RC; use LC as bulletization radius
-          a = setup.pc_radius - setup.pc_length;
-          b = z * grid;
-          c = setup.pc_length*setup.pc_length - b*b;
-          if (c < 0.0) c = 0;
-          c = a + sqrt(c);
-        } else {  // LC > RC; use RC as bulletization radius
-          if (z > LC-RC) {
-            a = setup.pc_length - setup.pc_radius;
-            b = z * grid - a;
-            c = setup.pc_radius*setup.pc_radius - b*b;
-            if (c < 0.0) c = 0;
-            c = sqrt(c);
-          } else {
-            c = setup.pc_radius;
-          }
-        }
-        rrc[z] = lrint(c/grid);
-        drrc[z] = c/grid - (float) rrc[z];
-        if (drrc[z] < 0.05 && drrc[z] > -0.05) drrc[z] = 0;
-        frrc[z] = 0;
-      }
-      drrc[LC+1] = drrc[LC];
-    } else {  // no bulletization
-      for (z=0; z<=LC+1; z++) {
-        rrc[z] = RC;
-        drrc[z] = dRC;
-        frrc[z] = 0;
-      }
-    }
-    
-    LT = lrint(setup.taper_length/grid);
-    RO = lrint(setup.wrap_around_radius/grid);
-    LO = lrint(setup.ditch_depth/grid);
-    WO = lrint(setup.ditch_thickness/grid);
-    // LiT = lrint(setup.Li_thickness/grid);
-    if (RO <= 0.0 || RO >= R) RO = R - LT;    // inner radius of taper, in grid lengths
-
-    if (istep == 0) {
+    } else if (istep == 0) {
       // no previous coarse relaxation, so set initial potential:
       for (z=0; z<L+1; z++) {
 	for (r=0; r<R+1; r++) {
@@ -814,10 +1197,10 @@ int main(int argc, char **argv)
       /*  ----- can comment out this next section to test convergence of WP ----- */
       // perhaps this is a better initial guess than just zero everywhere
       a = LC + RC / 2;
-      b = 2.0f*a / (float) (L + R);
+      b = 2.0f*a / (float) (iz[L] + ir[R]);
       for (z=1; z<L; z++) {
 	for (r=1; r<R; r++) {
-	  c = a / sqrt(z*z + r*r) - b;
+	  c = a / sqrt(iz[z]*iz[z] + ir[r]*ir[r]) - b;
 	  if (c < 0) c = 0;
 	  if (c > 1) c = 1;
 	  v[0][z][r] = v[1][z][r] = c;
@@ -832,18 +1215,7 @@ int main(int argc, char **argv)
       }
     }
 
-    /* boundary conditions and permittivity
-       boundary condition at Ge-vacuum interface:
-       epsilon0 * E_vac = espilon_Ge * E_Ge
-    */
-    for (z=0; z<L+1; z++) {
-      for (r=0; r<R+1; r++) {
-	eps[z][r] = eps_dz[z][r] = eps_dr[z][r] = 16;   // permittivity inside Ge
-	if (z < LO  && r < RO && r > RO-WO-1) eps[z][r] =  1;  // permittivity inside vacuum
-	if (r > 0) eps_dr[z][r-1] = (eps[z][r-1]+eps[z][r])/2.0f;
-	if (z > 0) eps_dz[z-1][r] = (eps[z-1][r]+eps[z][r])/2.0f;
-      }
-    }
+    set_permittivity();
 
     for (z=0; z<L+1; z++) {
       for (r=0; r<R+1; r++) {
@@ -852,8 +1224,9 @@ int main(int argc, char **argv)
 	// outside (HV) contact:
 	if (z == L ||
 	    r == R ||
-	    r >= z + R - LT ||       // taper
-	    (z == 0 && r >= RO)) {   // wrap-around
+	    ir[r] >= iz[z] + ir[R] - LT ||  // taper
+	    (LH > 0 && ir[r] <= RH && iz[z] >= iz[L] - LH) ||  // ICPC well
+	    (z == 0 && ir[r] >= RO)) {     // wrap-around
 	  bulk[z][r] = -1;                 // value of v[*][z][r] is fixed...
 	  v[0][z][r] = v[1][z][r] = 0.0;   // to zero
 	}
@@ -895,95 +1268,141 @@ int main(int argc, char **argv)
       }
     }
 
-    // now do the actual relaxation
-    for (iter=0; iter<max_its; iter++) {
-      if (old == 0) {
-	old = 1;
-	new = 0;
-      } else {
-	old = 0;
-	new = 1;
-      }
-      sum_dif = 0.0f;
-      max_dif = 0.0f;
-      pinched_sum1 = pinched_sum2 = 0.0;
-
-      for (z=0; z<L; z++) {
-	for (r=0; r<R; r++) {
-	  if (bulk[z][r] < 0) continue;      // outside or inside contact
-
-	  if (bulk[z][r] == 0) {            // normal bulk, no complications
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r];
-	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
-	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
-	    }
-	    if (r > 0) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      eps_sum += eps_dr[z][r-1]*s2[r];
-	    } else {
-	      v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
-	      eps_sum += eps_dr[z][r]*s1[r];
-	    }
+    // now do the actual relaxation, or solve directly by conjugate gradients
+    if (wp_cg) {
+      iter = wp_pcg(istep, max_its, &sum_dif);
+    } else {
+      iter = wp_relax(max_its, &sum_dif);
+    }
+    if (iter < 0) return 1;
+    if (!quiet) printf(">> %d %.16f\n\n", iter, sum_dif);
+    if (setup->verbosity >= CHATTY) {
+      t1 = time(NULL);
+      printf(" ^^^^^^^^^^^^^ %d (%d) s elapsed ^^^^^^^^^^^^^^\n",
+	     (int) (t1 - t0), (int) (t1 - t2));
+      t2 = t1;
+    }
+    if (wp_save[0] != NULL)
+      save_level(wp_save[istep], (warm && istep < 2 && gridstep[istep+1] > 0));
+    if (istep == 0) max_its /= MAX_ITS_FACTOR;
+  }
 
-	  } else if (bulk[z][r] == 1) {    // interpolated radial edge of point contact
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
-	      v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*frrc[z];
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*frrc[z];
-	    if (z > 0) {
-	      v_sum += v[old][z-1][r]*eps_dz[z-1][r];
-	      eps_sum += eps_dz[z-1][r];
-	    } else {
-	      v_sum += v[old][z+1][r]*eps_dz[z][r];  // reflection symm around z=0
-	      eps_sum += eps_dz[z][r];
-	    }
-	  } else if (bulk[z][r] == 2) {    // interpolated z edge of point contact
-	    v_sum = v[old][z+1][r]*eps_dz[z][r] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
-	      v[old][z-1][r]*eps_dz[z-1][r]*fLC;
-	    eps_sum = eps_dz[z][r] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*fLC;
-	    if (r > 0) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      eps_sum += eps_dr[z][r-1]*s2[r];
-	    } else {
-	      v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
-	      eps_sum += eps_dr[z][r]*s1[r];
-	    }
-	    if (z == LC && bulk[z-1][r] == 1) {
-	      v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
-	      eps_sum += eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
-	    }
+  return 0;
+}
 
-	  } else if (bulk[z][r] == 3) {   // pinched-off
-	    if (bulk[z+1][r] == 0) {
-	      pinched_sum1 += v[old][z+1][r]*eps_dz[z][r];
-	      pinched_sum2 += eps_dz[z][r];
-	    }
-	    if (bulk[z][r+1] == 0) {
-	      pinched_sum1 += v[old][z][r+1]*eps_dr[z][r]*s1[r];
-	      pinched_sum2 += eps_dr[z][r]*s1[r];
-	    }
-	    if (z > 0 && bulk[z-1][r] == 0) {
-	      pinched_sum1 += v[old][z-1][r]*eps_dz[z-1][r];
-	      pinched_sum2 += eps_dz[z-1][r];
-	    }
-	    if (r > 0 && bulk[z][r-1] == 0) {
-	      pinched_sum1 += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
-	      pinched_sum2 += eps_dr[z][r-1]*s2[r];
-	    }
-	    v_sum = pinched_sum1;
-	    eps_sum = pinched_sum2;
+/* wp_relax
+   relaxation of the WP on the current grid, for up to max_its iterations;
+   the pinched-off region is kept at the mean potential of its boundary
+   returns the number of iterations, or -1 on error
+*/
+static int wp_relax(int max_its, float *sum_dif_out) {
+  double eps_sum, v_sum, mean, pinched_sum1, pinched_sum2;
+  float  dif, sum_dif=0, max_dif;
+  int    r, z, iter;
+
+  // now do the actual relaxation
+  for (iter=0; iter<max_its; iter++) {
+    if (old == 0) {
+      old = 1;
+      new = 0;
+    } else {
+      old = 0;
+      new = 1;
+    }
+    sum_dif = 0.0f;
+    max_dif = 0.0f;
+    pinched_sum1 = pinched_sum2 = 0.0;
+
+    for (z=0; z<L; z++) {
+      for (r=0; r<R; r++) {
+	if (bulk[z][r] < 0) continue;      // outside or inside contact
+
+	if (bulk[z][r] == 0) {            // normal bulk, no complications
+	  v_sum = v[old][z+1][r]*eps_dz[z][r]*sz1[z] + v[old][z][r+1]*eps_dr[z][r]*s1[r];
+	  eps_sum = eps_dz[z][r]*sz1[z] + eps_dr[z][r]*s1[r];
+	  if (z > 0) {
+	    v_sum += v[old][z-1][r]*eps_dz[z-1][r]*sz2[z];
+	    eps_sum += eps_dz[z-1][r]*sz2[z];
+	  } else {
+	    v_sum += v[old][z+1][r]*eps_dz[z][r]*sz1[z];  // reflection symm around z=0
+	    eps_sum += eps_dz[z][r]*sz1[z];
+	  }
+	  if (r > 0) {
+	    v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
+	    eps_sum += eps_dr[z][r-1]*s2[r];
+	  } else {
+	    v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	    eps_sum += eps_dr[z][r]*s1[r];
+	  }
 
+	} else if (bulk[z][r] == 1) {    // interpolated radial edge of point contact
+	  v_sum = v[old][z+1][r]*eps_dz[z][r]*sz1[z] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
+	    v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*frrc[z];
+	  eps_sum = eps_dz[z][r]*sz1[z] + eps_dr[z][r]*s1[r] + eps_dr[z][r-1]*s2[r]*frrc[z];
+	  if (z > 0) {
+	    v_sum += v[old][z-1][r]*eps_dz[z-1][r]*sz2[z];
+	    eps_sum += eps_dz[z-1][r]*sz2[z];
 	  } else {
-	    printf(" ERROR! bulk = %d undefined for (z,r) = (%d,%d)\n",
-		   bulk[z][r], z, r);
-	    return 1;
+	    v_sum += v[old][z+1][r]*eps_dz[z][r]*sz1[z];  // reflection symm around z=0
+	    eps_sum += eps_dz[z][r]*sz1[z];
+	  }
+	} else if (bulk[z][r] == 2) {    // interpolated z edge of point contact
+	  v_sum = v[old][z+1][r]*eps_dz[z][r]*sz1[z] + v[old][z][r+1]*eps_dr[z][r]*s1[r] +
+	    v[old][z-1][r]*eps_dz[z-1][r]*sz2[z]*fLC;
+	  eps_sum = eps_dz[z][r]*sz1[z] + eps_dr[z][r]*s1[r] + eps_dz[z-1][r]*sz2[z]*fLC;
+	  if (r > 0) {
+	    v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
+	    eps_sum += eps_dr[z][r-1]*s2[r];
+	  } else {
+	    v_sum += v[old][z][r+1]*eps_dr[z][r]*s1[r];  // reflection symm around r=0
+	    eps_sum += eps_dr[z][r]*s1[r];
+	  }
+	  if (z == LC && bulk[z-1][r] == 1) {
+	    v_sum += v[old][z][r-1]*eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
+	    eps_sum += eps_dr[z][r-1]*s2[r]*(frrc[z]-1.0);
+	  }
+
+	} else if (bulk[z][r] == 3) {   // pinched-off
+	  if (bulk[z+1][r] == 0) {
+	    pinched_sum1 += v[old][z+1][r]*eps_dz[z][r]*sz1[z];
+	    pinched_sum2 += eps_dz[z][r]*sz1[z];
+	  }
+	  if (bulk[z][r+1] == 0) {
+	    pinched_sum1 += v[old][z][r+1]*eps_dr[z][r]*s1[r];
+	    pinched_sum2 += eps_dr[z][r]*s1[r];
+	  }
+	  if (z > 0 && bulk[z-1][r] == 0) {
+	    pinched_sum1 += v[old][z-1][r]*eps_dz[z-1][r]*sz2[z];
+	    pinched_sum2 += eps_dz[z-1][r]*sz2[z];
 	  }
-	  if (bulk[z][r] != 3) {
-	    mean = v_sum / eps_sum;
+	  if (r > 0 && bulk[z][r-1] == 0) {
+	    pinched_sum1 += v[old][z][r-1]*eps_dr[z][r-1]*s2[r];
+	    pinched_sum2 += eps_dr[z][r-1]*s2[r];
+	  }
+	  v_sum = pinched_sum1;
+	  eps_sum = pinched_sum2;
+
+	} else {
+	  printf(" ERROR! bulk = %d undefined for (z,r) = (%d,%d)\n",
+		 bulk[z][r], z, r);
+	  return -1;
+	}
+	if (bulk[z][r] != 3) {
+	  mean = v_sum / eps_sum;
+	  v[new][z][r] = mean;
+	  dif = v[old][z][r] - v[new][z][r];
+	  if (dif < 0.0f) dif = -dif;
+	  sum_dif += dif;
+	  if (max_dif < dif) max_dif = dif;
+	}
+      }
+    }
+
+    if (pinched_sum2 > 0.1) {
+      mean = pinched_sum1 / pinched_sum2;
+      for (z=0; z<L; z++) {
+	for (r=0; r<R; r++) {
+	  if (bulk[z][r] == 3) {
 	    v[new][z][r] = mean;
 	    dif = v[old][z][r] - v[new][z][r];
 	    if (dif < 0.0f) dif = -dif;
@@ -992,51 +1411,376 @@ int main(int argc, char **argv)
 	  }
 	}
       }
+    }
 
-      if (pinched_sum2 > 0.1) {
-	mean = pinched_sum1 / pinched_sum2;
-	for (z=0; z<L; z++) {
-	  for (r=0; r<R; r++) {
-	    if (bulk[z][r] == 3) {
-	      v[new][z][r] = mean;
-	      dif = v[old][z][r] - v[new][z][r];
-	      if (dif < 0.0f) dif = -dif;
-	      sum_dif += dif;
-	      if (max_dif < dif) max_dif = dif;
-	    }
+    // report results for some iterations
+    if (!quiet &&
+	(iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0))
+      printf("%5d %d %d %.10f %.10f ; %.10f %.10f\n",
+	     iter, old, new, max_dif, sum_dif/(float) (L*R),
+	     v[new][L/2][R/2], v[new][L-5][R-5]);
+    if (max_dif < 0.0000000001) break;
+  }
+  *sum_dif_out = sum_dif;
+
+  return iter;
+}
+
+/* -------------------------------------------------------------------------
+   solution of the WP by preconditioned conjugate gradients
+
+   The WP equations are linear: for each free pixel i (bulk = 0, 1 or 2),
+      v_i * sum_k w_ik = sum_k w_ik * v_k
+   with the same weights w_ik as are used in the relaxation. Multiplying the
+   equation for pixel i by c_i = r (1/16 for r = 0, and halved at z = 0;
+   see cg_scale() for graded grids)
+   makes c_i*w_ik = c_k*w_ki, so that the system is symmetric positive-definite
+   once the fixed contact potentials are moved to the right-hand side.
+   Next to interpolated edges of the point contact a few pairs of weights
+   are still different; these are symmetrized by keeping the smaller one,
+   and the difference is removed from the diagonal so that each equation is
+   still a weighted mean of its neighbours.
+   The pinched-off region (bulk = 3) is a single floating unknown F, coupled
+   to its free neighbours through the same weights, with zero net flux.
+
+   The preconditioner is an incomplete Cholesky factorization IC(0) of the
+   pixel part of the matrix. It depends only on the grid and contacts, so it
+   is kept for each grid step and reused while bulk[][] does not change.
+   -------------------------------------------------------------------------
+*/
+static double **cg_ad, **cg_az, **cg_ar, **cg_af, **cg_b;  // matrix and right-hand side
+static double **cg_res, **cg_p, **cg_q, **cg_y;            // work arrays
+static double **ic_d[3];                    // IC(0) pivots, for each grid step
+static int    **ic_bulk[3], ic_L[3], ic_R[3]; // contacts and size for which they were calculated
+
+#define CG_FREE(z,r) (bulk[z][r] >= 0 && bulk[z][r] != 3)
+
+static double **cg_dgrid(void) {
+  double **a;
+  int    z;
+
+  if ((a = malloc((LL+1)*sizeof(*a))) == NULL) return NULL;
+  for (z=0; z<LL+1; z++) {
+    if ((a[z] = calloc(RR+1, sizeof(**a))) == NULL) return NULL;
+  }
+  return a;
+}
+
+/* cg_setup
+   malloc arrays for the conjugate-gradient WP solver, for the finest grid
+   returns 0 for success
+*/
+static int cg_setup(void) {
+  int i, z;
+
+  if ((cg_ad  = cg_dgrid()) == NULL || (cg_az = cg_dgrid()) == NULL ||
+      (cg_ar  = cg_dgrid()) == NULL || (cg_af = cg_dgrid()) == NULL ||
+      (cg_b   = cg_dgrid()) == NULL || (cg_res = cg_dgrid()) == NULL ||
+      (cg_p   = cg_dgrid()) == NULL || (cg_q  = cg_dgrid()) == NULL ||
+      (cg_y   = cg_dgrid()) == NULL) return 1;
+  for (i=0; i<3; i++) {
+    if ((ic_d[i] = cg_dgrid()) == NULL ||
+	(ic_bulk[i] = malloc((LL+1)*sizeof(*ic_bulk[i]))) == NULL) return 1;
+    for (z=0; z<LL+1; z++) {
+      if ((ic_bulk[i][z] = malloc((RR+1)*sizeof(**ic_bulk[i]))) == NULL) return 1;
+    }
+    ic_L[i] = ic_R[i] = 0;
+  }
+  return 0;
+}
+
+/* cg_scale
+   row scale c that makes the WP equations symmetric; this is the voxel
+   volume / 2pi in units of xtal_grid (r, or 1/16 for r = 0, on a uniform grid),
+   halved at r=0 and z=0 for the reflections folded into the weights
+*/
+static double cg_scale(int z, int r) {
+  double rp, rm, zp, zm;
+
+  rp = 0.5 * (double) (ir[r] + ir[r+1]);
+  rm = (r > 0 ? 0.5 * (double) (ir[r-1] + ir[r]) : 0.0);
+  zp = 0.5 * (double) (iz[z] + iz[z+1]);
+  zm = (z > 0 ? 0.5 * (double) (iz[z-1] + iz[z]) : (double) iz[z]);
+  return 0.5 * (rp*rp - rm*rm) * (zp - zm) * (r == 0 ? 0.5 : 1.0);
+}
+
+/* wp_weights
+   weights w[] of free pixel (z,r) to its neighbours at z+1, z-1, r+1, r-1,
+   exactly as used in wp_relax(), with reflections at r=0 and z=0 folded in
+*/
+static void wp_weights(int z, int r, double *w) {
+
+  w[0] = eps_dz[z][r]*sz1[z];
+  w[1] = (z > 0 ? eps_dz[z-1][r]*sz2[z] : 0);
+  w[2] = eps_dr[z][r]*s1[r];
+  w[3] = (r > 0 ? eps_dr[z][r-1]*s2[r] : 0);
+  if (bulk[z][r] == 1) {            // interpolated radial edge of point contact
+    w[3] *= frrc[z];
+    if (z == 0) w[0] *= 2.0;
+  } else if (bulk[z][r] == 2) {     // interpolated z edge of point contact
+    w[1] *= fLC;
+    if (z == LC && z > 0 && bulk[z-1][r] == 1) w[3] *= frrc[z];
+    if (r == 0) w[2] *= 2.0;
+  } else {
+    if (z == 0) w[0] *= 2.0;        // reflection symm around z=0
+    if (r == 0) w[2] *= 2.0;        // reflection symm around r=0
+  }
+}
+
+/* cg_matvec
+   q = A p, for the pixels and for the floating pinched-off region
+*/
+static void cg_matvec(double **p, double pF, double AFF, double **q, double *qF) {
+  double t;
+  int    z, r;
+
+  *qF = AFF * pF;
+  for (z=0; z<L; z++) {
+    for (r=0; r<R; r++) {
+      if (!CG_FREE(z,r)) {
+	q[z][r] = 0;
+	continue;
+      }
+      t = cg_ad[z][r]*p[z][r] - cg_az[z][r]*p[z+1][r] - cg_ar[z][r]*p[z][r+1] -
+	  cg_af[z][r]*pF;
+      if (z > 0) t -= cg_az[z-1][r]*p[z-1][r];
+      if (r > 0) t -= cg_ar[z][r-1]*p[z][r-1];
+      q[z][r] = t;
+      *qF -= cg_af[z][r]*p[z][r];
+    }
+  }
+}
+
+/* cg_precond
+   y = M^-1 res, with M = (D + Lo) D^-1 (D + Lo^T) the IC(0) factorization
+   and a diagonal preconditioner for the floating region
+*/
+static void cg_precond(double **d, double resF, double AFF, double *yF) {
+  double t;
+  int    z, r;
+
+  for (z=0; z<L; z++) {
+    for (r=0; r<R; r++) {
+      if (!CG_FREE(z,r)) continue;
+      t = cg_res[z][r];
+      if (z > 0) t += cg_az[z-1][r]*cg_y[z-1][r];
+      if (r > 0) t += cg_ar[z][r-1]*cg_y[z][r-1];
+      cg_y[z][r] = t / d[z][r];
+    }
+  }
+  for (z=L-1; z>=0; z--) {
+    for (r=R-1; r>=0; r--) {
+      if (!CG_FREE(z,r)) continue;
+      cg_y[z][r] += (cg_az[z][r]*cg_y[z+1][r] + cg_ar[z][r]*cg_y[z][r+1]) / d[z][r];
+    }
+  }
+  *yF = (AFF > 0 ? resF / AFF : 0);
+}
+
+/* wp_pcg
+   solve for the WP on the current grid by preconditioned conjugate gradients,
+   starting from the potential in v[new], for up to max_its iterations
+   returns the number of iterations, or -1 on error
+*/
+static int wp_pcg(int istep, int max_its, float *sum_dif_out) {
+  double w[4], w2[4], c, c2, a, a2, m, t;
+  double AFF = 0, F = 0, resF = 0, pF, qF, yF, rho, rho_old, alpha, pq;
+  double max_dif, sum_dif = 0, **d = ic_d[istep];
+  int    z, r, zz, rr, k, iter, nF = 0, reuse;
+  static int dz[4] = {1, -1, 0, 0}, dr[4] = {0, 0, 1, -1};
+
+  /* set up the symmetric matrix and right-hand side */
+  for (z=0; z<L+1; z++) {
+    for (r=0; r<R+1; r++) {
+      cg_ad[z][r] = cg_az[z][r] = cg_ar[z][r] = cg_af[z][r] = cg_b[z][r] = 0;
+      cg_p[z][r] = cg_y[z][r] = 0;
+      if (bulk[z][r] == 3) {
+	F += v[new][z][r];
+	nF++;
+      }
+    }
+  }
+  if (nF > 0) F /= (double) nF;
+  for (z=0; z<L; z++) {
+    for (r=0; r<R; r++) {
+      if (!CG_FREE(z,r)) continue;
+      wp_weights(z, r, w);
+      c = cg_scale(z, r);
+      cg_ad[z][r] += c * (w[0] + w[1] + w[2] + w[3]);
+      for (k=0; k<4; k++) {
+	if (w[k] == 0) continue;
+	zz = z + dz[k];
+	rr = r + dr[k];
+	a = c * w[k];
+	if (bulk[zz][rr] < 0) {              // contact
+	  cg_b[z][r] += a * v[new][zz][rr];
+	} else if (bulk[zz][rr] == 3) {      // pinched-off region
+	  cg_af[z][r] += a;
+	  AFF += a;
+	} else if (k == 0 || k == 2) {       // free pixel at z+1 or r+1
+	  wp_weights(zz, rr, w2);
+	  c2 = cg_scale(zz, rr);
+	  a2 = c2 * w2[k+1];
+	  m = (a < a2 ? a : a2);
+	  cg_ad[z][r]   -= a - m;
+	  cg_ad[zz][rr] -= a2 - m;
+	  if (k == 0) {
+	    cg_az[z][r] = m;
+	  } else {
+	    cg_ar[z][r] = m;
 	  }
 	}
       }
+    }
+  }
 
-      // report results for some iterations
-      if (iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0)
-	printf("%5d %d %d %.10f %.10f ; %.10f %.10f\n",
-	       iter, old, new, max_dif, sum_dif/(float) (L*R),
-	       v[new][L/2][R/2], v[new][L-5][R-5]);
-      if (max_dif < 0.0000000001) break;
-    }
-    printf(">> %d %.16f\n\n", iter, sum_dif);
-    if (setup.verbosity >= CHATTY) {
-      t1 = time(NULL);
-      printf(" ^^^^^^^^^^^^^ %d (%d) s elapsed ^^^^^^^^^^^^^^\n",
-	     (int) (t1 - t0), (int) (t1 - t2));
-      t2 = t1;
+  /* IC(0) factorization, unless it is already known for these contacts */
+  reuse = (ic_L[istep] == L && ic_R[istep] == R);
+  for (z=0; z<L && reuse; z++) {
+    for (r=0; r<R; r++) {
+      if (ic_bulk[istep][z][r] != bulk[z][r]) {
+	reuse = 0;
+	break;
+      }
+    }
+  }
+  if (!reuse) {
+    for (z=0; z<L; z++) {
+      for (r=0; r<R; r++) {
+	ic_bulk[istep][z][r] = bulk[z][r];
+	d[z][r] = 1;
+	if (!CG_FREE(z,r)) continue;
+	t = cg_ad[z][r];
+	if (z > 0) t -= cg_az[z-1][r]*cg_az[z-1][r] / d[z-1][r];
+	if (r > 0) t -= cg_ar[z][r-1]*cg_ar[z][r-1] / d[z][r-1];
+	if (t <= 0) {
+	  printf(" ERROR! IC(0) factorization failed at (z,r) = (%d,%d)\n", z, r);
+	  ic_L[istep] = 0;
+	  return -1;
+	}
+	d[z][r] = t;
+      }
+    }
+    ic_L[istep] = L;
+    ic_R[istep] = R;
+  } else if (!quiet) {
+    printf("Reusing preconditioner for grid %d x %d\n", L, R);
+  }
+
+  /* conjugate gradients */
+  cg_matvec(v[new], F, AFF, cg_q, &qF);
+  for (z=0; z<L; z++) {
+    for (r=0; r<R; r++) {
+      cg_res[z][r] = (CG_FREE(z,r) ? cg_b[z][r] - cg_q[z][r] : 0);
+    }
+  }
+  resF = -qF;
+  cg_precond(d, resF, AFF, &yF);
+  rho = resF * yF;
+  for (z=0; z<L; z++) {
+    for (r=0; r<R; r++) {
+      cg_p[z][r] = cg_y[z][r];
+      rho += cg_res[z][r] * cg_y[z][r];
     }
-    if (istep == 0) max_its /= MAX_ITS_FACTOR;
   }
+  pF = yF;
+
+  for (iter=0; iter<max_its; iter++) {
+    // convergence check; |res/diagonal| is the change a relaxation step would make
+    max_dif = sum_dif = (AFF > 0 ? fabs(resF / AFF) : 0);
+    for (z=0; z<L; z++) {
+      for (r=0; r<R; r++) {
+	if (!CG_FREE(z,r)) continue;
+	t = fabs(cg_res[z][r] / cg_ad[z][r]);
+	sum_dif += t;
+	if (max_dif < t) max_dif = t;
+      }
+    }
+    if (!quiet &&
+	(iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0))
+      printf("%5d %.10f %.10f ; %.10f %.10f\n",
+	     iter, max_dif, sum_dif/(float) (L*R),
+	     v[new][L/2][R/2], v[new][L-5][R-5]);
+    if (max_dif < 0.0000000001 || rho == 0) break;
+
+    cg_matvec(cg_p, pF, AFF, cg_q, &qF);
+    pq = pF * qF;
+    for (z=0; z<L; z++) {
+      for (r=0; r<R; r++) pq += cg_p[z][r] * cg_q[z][r];
+    }
+    alpha = rho / pq;
+    for (z=0; z<L; z++) {
+      for (r=0; r<R; r++) {
+	if (!CG_FREE(z,r)) continue;
+	v[new][z][r]  += alpha * cg_p[z][r];
+	cg_res[z][r]  -= alpha * cg_q[z][r];
+      }
+    }
+    F    += alpha * pF;
+    resF -= alpha * qF;
+
+    cg_precond(d, resF, AFF, &yF);
+    rho_old = rho;
+    rho = resF * yF;
+    for (z=0; z<L; z++) {
+      for (r=0; r<R; r++) rho += cg_res[z][r] * cg_y[z][r];
+    }
+    for (z=0; z<L; z++) {
+      for (r=0; r<R; r++) cg_p[z][r] = cg_y[z][r] + (rho / rho_old) * cg_p[z][r];
+    }
+    pF = yF + (rho / rho_old) * pF;
+  }
+
+  // copy the solution to both potential arrays
+  for (z=0; z<L+1; z++) {
+    for (r=0; r<R+1; r++) {
+      if (bulk[z][r] == 3 && AFF > 0) v[new][z][r] = F;
+      v[1-new][z][r] = v[new][z][r];
+    }
+  }
+  *sum_dif_out = sum_dif;
 
-  /* --------------------- calculate capacitance ---------------------
+  return iter;
+}
+
+/* save_level
+   save the potential on the current grid to save[][], to warm-start the next
+   relaxation; if diff != 0, also replace v[1] by its change since the previous
+   save, so that it is the change that gets interpolated to the next finer grid
+*/
+static void save_level(double **save, int diff) {
+  double f;
+  int    z, r;
+
+  for (z=0; z<L+1; z++) {
+    for (r=0; r<R+1; r++) {
+      f = v[new][z][r];
+      if (diff) v[1][z][r] -= save[z][r];
+      save[z][r] = f;
+    }
+  }
+}
+
+/* capacitance
+   calculate the capacitance in pF from the weighting potential in v[new]
      1/2 * epsilon * integral(E^2) = 1/2 * C * V^2
      so    C = epsilon * integral(E^2) / V^2
      V = 1 volt
-  */
-  printf("Calculating integrals of weighting field\n");
-  esum = esum2 = j = 0;
+   also returns an alternative value from the integral of the field over
+   the surface of the point contact in alt_cap, or -1 if that cannot be used
+*/
+static double capacitance(float grid, double *alt_cap) {
+  double esum = 0, esum2 = 0, pi=3.14159, Epsilon=(8.85*16.0/1000.0);  // permittivity of Ge in pF/mm
+  float  E_r, E_z;
+  int    r, z, dr, dz, j = 0;
+
   for (z=0; z<L; z++) {
     for (r=1; r<R; r++) {
-      E_r = eps_dr[z][r]/16.0 * (v[new][z][r] - v[new][z][r+1])/(0.1*grid);
-      E_z = eps_dz[z][r]/16.0 * (v[new][z][r] - v[new][z+1][r])/(0.1*grid);
-      esum += (E_r*E_r + E_z*E_z) * (double) r;
+      dr = ir[r+1] - ir[r];  // grid steps in units of grid; 1 unless graded
+      dz = iz[z+1] - iz[z];
+      E_r = eps_dr[z][r]/16.0 * (v[new][z][r] - v[new][z][r+1])/(0.1*grid*(float) dr);
+      E_z = eps_dz[z][r]/16.0 * (v[new][z][r] - v[new][z+1][r])/(0.1*grid*(float) dz);
+      esum += (E_r*E_r + E_z*E_z) * (double) (ir[r]*dr*dz);
       /*
       if ((z <= LC && r == rrc[z]) ||
 	  (z == LC && r <= rrc[z]) ||
@@ -1057,43 +1801,520 @@ int main(int argc, char **argv)
   // 0.01 converts (V/cm)^2 to (V/mm)^2, pow() converts to grid^3 to mm3
   esum2 *= 2.0 * pi * 0.1 * Epsilon * pow(grid, 2.0);
   // 0.1 converts (V/cm) to (V/mm),  grid^2 to  mm2
-  printf("\n  >>  Calculated capacitance at %.0f V: %.3lf pF\n", BV, esum);
-  if (j==0) {
-    printf("  >>  Alternative calculation of capacitance: %.3lf pF\n\n", esum2);
+  *alt_cap = (j == 0 ? esum2 : -1);
+
+  return esum;
+}
+
+/* find_depletion
+   search for the lowest bias at which the detector is fully depleted,
+   starting from the bracket [0, BV] and doubling BV if needed;
+   the bracket is bisected, and each relaxation is warm-started from the
+   potentials at the two previous biases (see ev_calc())
+   (the undepleted volume is too far from linear in the bias, and too coarsely
+   quantized near depletion, for secant steps on it to beat bisection)
+   returns the depletion voltage in depl_volts, and the potential of any
+   pinch-off bubble just below depletion in pinch_volts (zero if none)
+   returns 0 for success
+*/
+static int find_depletion(MJD_Siggen_Setup *setup, float BV, float *depl_volts, float *pinch_volts) {
+  float  lo = 0, hi = BV, V, sign = 1;
+  int    n = 0, warm = 0;
+
+  if (setup->impurity_z0 > 0) sign = -1;  // report voltages for n-type as negative
+  *depl_volts = *pinch_volts = 0;
+  if (BV < DEPL_VOLTS_PREC) hi = BV = 1000;
+  printf("\nSearching for depletion voltage...\n");
+  quiet = (setup->verbosity < CHATTY);
+
+  for (V = hi; ; ) {
+    if (ev_calc(setup, V, warm)) return 1;
+    warm = 1;
+    n++;
+    if (fully_depleted) {
+      printf(" %3d  bias %7.1f V: fully depleted\n", n, sign*V);
+      hi = V;
+    } else {
+      printf(" %3d  bias %7.1f V: undepleted volume %9.2f mm3", n, sign*V, undepleted_vol);
+      if (pinched_off) printf(", pinch-off bubble at %.0f V", sign*bubble_volts);
+      printf("\n");
+      lo = V;
+      *pinch_volts = (pinched_off ? bubble_volts : 0);
+      if (V >= hi) {  // not yet bracketed
+	if (n > DEPL_MAX_DOUBLE) {
+	  printf("ERROR: Detector is not depleted at %.0f V\n", sign*V);
+	  quiet = 0;
+	  return 1;
+	}
+	hi = V = 2.0f*V;
+	continue;
+      }
+    }
+    if (hi - lo <= DEPL_VOLTS_PREC) break;
+    V = 0.5f * (lo + hi);  // next bias to try
+  }
+  quiet = 0;
+
+  *depl_volts = sign * hi;
+  printf("\nDepletion voltage: %.0f V (+- %.1f V), after %d relaxations\n",
+	 *depl_volts, 0.5f*(hi - lo), n);
+  if (*pinch_volts > 0.0f) {
+    *pinch_volts *= sign;
+    printf("Detector depletes by pinch-off; bubble at %.0f V potential just below depletion\n\n",
+	   *pinch_volts);
   } else {
-    printf("\n");
+    printf("No pinch-off just below depletion\n\n");
   }
 
-  if (WP == 1) {
-    // write WP values to output file
-    if (!(file = fopen(setup.wp_name, "w"))) {
-      printf("ERROR: Cannot open file %s for weighting potential...\n", setup.wp_name);
+  return 0;
+}
+
+/* cv_sweep
+   calculate the capacitance as a function of bias, from step_volts up to BV
+   in steps of step_volts; at each bias the undepleted region is treated as
+   part of the point contact for the WP, and both the EV and WP relaxations
+   are warm-started from those at the previous bias
+   once the detector is fully depleted the WP, and so the capacitance, no longer change
+   the results are written to the file capacitance.txt
+   returns 0 for success
+*/
+static int cv_sweep(MJD_Siggen_Setup *setup, float BV, float step_volts, char *config_file_name) {
+  double C = 0, C2 = -1;
+  float  V, sign = 1;
+  int    n, was_depleted = 0;
+  FILE   *file;
+
+  if (setup->impurity_z0 > 0) sign = -1;  // report voltages for n-type as negative
+  if (!(file = fopen("capacitance.txt", "w"))) {
+    printf("ERROR: Cannot open file capacitance.txt for C(V)...\n");
+    return 1;
+  }
+  report_config(file, config_file_name);
+  fprintf(file, "#\n## bias (V), C (pF), alternative C (pF), undepleted volume (mm3), pinch-off\n");
+
+  printf("\nCalculating capacitance vs. bias in steps of %.1f V...\n"
+	 "   bias (V)    C (pF)  undepleted (mm3)\n", step_volts);
+  quiet = (setup->verbosity < CHATTY);
+  for (n=1; ; n++) {
+    V = (float) n * step_volts;
+    if (V > BV) V = BV;
+    if (ev_calc(setup, V, n > 1)) return 1;
+    if (!fully_depleted || !was_depleted) {
+      if (wp_calc(setup, n > 1)) return 1;
+      C = capacitance(setup->xtal_grid, &C2);
+    }
+    was_depleted = fully_depleted;
+    printf(" %10.1f %9.3f %12.2f%s\n",
+	   sign*V, C, undepleted_vol, (pinched_off ? "  pinch-off" : ""));
+    fprintf(file, "%10.1f %9.4f %9.4f %12.3f %d\n",
+	    sign*V, C, C2, undepleted_vol, pinched_off);
+    if (V >= BV) break;
+  }
+  fclose(file);
+  quiet = 0;
+  printf("Wrote capacitance vs. bias to file capacitance.txt\n\n");
+
+  return 0;
+}
+
+/* -------------------------------------------------------------------------
+   3-D fields and weighting potential on a Cartesian grid (-3 option)
+
+   For detectors that are not axially symmetric: the point contact can be
+   displaced from the crystal axis by (pc_x_offset, pc_y_offset), and the
+   impurity can vary across the crystal (impurity_x_gradient). The outer
+   contact, taper, wrap-around, ditch and well are as for the (r,z) calculation.
+   The grid has a uniform size xtal_grid. Where the detector is symmetric
+   under x -> -x or y -> -y, the grid covers only x >= 0 or y >= 0, with
+   reflection symmetry at the plane x = 0 or y = 0 (fold3d = FOLD_X, FOLD_Y);
+   a centred point contact with no x gradient needs only one quadrant.
+   The potential is found by red-black successive over-relaxation. The edges
+   of the point contact are not interpolated between grid points, and no
+   pinch-off bubbles are tracked; undepleted points are set to zero volts,
+   and are treated as part of the point contact for the WP.
+
+   The grid points are stored as [x][y][z], z fastest, which is also the order
+   of the lines in the output files and of the 3-D field grid in fields.c.
+   -------------------------------------------------------------------------
+*/
+static int    NX3, NY3, NZ3;     // dimensions of the 3-D grid
+static int    fold3d;            // FOLD_X | FOLD_Y for mirrored axes
+static float  x03, y03;          // position of the first 3-D grid point, in mm
+static double *v3;               // potential
+static float  *rho3;             // charge density term in the relaxation, for the EV
+static float  *eps3;             // permittivity
+static signed char *bulk3;       // -1 for outside contact, 1 for point contact, 0 for Ge, 2 for vacuum
+static char   *undep3;           // set to 1 for undepleted points
+
+#define I3(i,j,k) (((i)*NY3 + (j))*NZ3 + (k))
+
+/* pc_radius3
+   radius of the (optionally bulletized) point contact at height z, in mm,
+   as for rrc[] in grid_setup()
+*/
+static float pc_radius3(MJD_Siggen_Setup *setup, float z) {
+  float a, b, c;
+
+  if (!setup->bulletize_PC) return setup->pc_radius;
+  if (z > setup->pc_length) z = setup->pc_length;
+  if (setup->pc_length <= setup->pc_radius) {  // use LC as bulletization radius
+    a = setup->pc_radius - setup->pc_length;
+    c = setup->pc_length*setup->pc_length - z*z;
+    if (c < 0.0) c = 0;
+    return a + sqrt(c);
+  }
+  // use RC as bulletization radius
+  a = setup->pc_length - setup->pc_radius;
+  if (z <= a) return setup->pc_radius;
+  b = z - a;
+  c = setup->pc_radius*setup->pc_radius - b*b;
+  if (c < 0.0) c = 0;
+  return sqrt(c);
+}
+
+/* point_type3
+   classify the grid point at (x, y, z) mm, for grid size grid:
+   returns -1 for the outside (HV) contact, 1 for the point contact,
+   2 for vacuum in the ditch, and 0 for Ge
+*/
+static int point_type3(MJD_Siggen_Setup *setup, float x, float y, float z, float grid) {
+  float r, rp, rt, ro, tol = 0.01f * grid;
+
+  r  = sqrt(x*x + y*y);
+  rt = setup->xtal_radius - setup->taper_length;  // inner radius of taper
+  ro = setup->wrap_around_radius;
+  if (ro <= 0.0 || ro >= setup->xtal_radius) ro = rt;
+
+  if (z >= setup->xtal_length - tol ||
+      r >= setup->xtal_radius - tol ||
+      r >= z + rt - tol ||            // taper
+      (setup->hole_length > 0 && r <= setup->hole_radius + tol &&
+       z >= setup->xtal_length - setup->hole_length - tol) ||  // ICPC well
+      (z < tol && r >= ro - tol))     // wrap-around
+    return -1;
+  rp = sqrt((x - setup->pc_x_offset)*(x - setup->pc_x_offset) +
+            (y - setup->pc_y_offset)*(y - setup->pc_y_offset));
+  if (setup->pc_radius > 0 && z <= setup->pc_length + 0.5f*grid &&
+      rp <= pc_radius3(setup, z) + 0.5f*grid)
+    return 1;
+  if (z < setup->ditch_depth && r < ro && r >= ro - setup->ditch_thickness)
+    return 2;
+  return 0;
+}
+
+/* relax3
+   relaxation of the 3-D potential v3 with over-relaxation factor omega;
+   for the EV (wp = 0), includes the charge in rho3 and sets undep3[] for
+   points that would go below zero volts; for the WP (wp = 1), the
+   undepleted points are fixed along with the contacts
+   returns the number of iterations
+*/
+static int relax3(int wp, double omega, int max_its) {
+  double eps_sum, v_sum, e, vn, dif, max_dif;
+  int    i, j, k, n, m, iter, color, di, dj, dk;
+
+  for (iter=0; iter<max_its; iter++) {
+    max_dif = 0;
+    for (color=0; color<2; color++) {
+      for (i=0; i<NX3; i++) {
+	for (j=0; j<NY3; j++) {
+	  k = (i + j + color) & 1;
+	  n = I3(i,j,k);
+	  for (; k<NZ3-1; k+=2, n+=2) {
+	    if (bulk3[n] == -1 || bulk3[n] == 1 || (wp && undep3[n])) continue;
+	    /* neighbours in -x, -y and -z are reflected at a fold and at z = 0;
+	       contacts fill the edges of the grid, so +x, +y, +z are always there */
+	    di = (i > 0 ? -NY3*NZ3 : NY3*NZ3);
+	    dj = (j > 0 ? -NZ3 : NZ3);
+	    dk = (k > 0 ? -1 : 1);
+	    v_sum = eps_sum = 0;
+#define NB(d) { m = n + (d); e = eps3[n] + eps3[m]; v_sum += e*v3[m]; eps_sum += e; }
+	    NB(NY3*NZ3); NB(di);
+	    NB(NZ3);     NB(dj);
+	    NB(1);       NB(dk);
+#undef NB
+	    vn = v_sum / eps_sum;
+	    if (!wp) {
+	      vn += rho3[n];
+	      undep3[n] = 0;
+	      if (vn < 0) {
+		vn = 0;
+		if (bulk3[n] == 0) undep3[n] = 1;
+	      }
+	    }
+	    vn = v3[n] + omega * (vn - v3[n]);
+	    if (!wp && vn < 0) vn = 0;
+	    dif = fabs(vn - v3[n]);
+	    if (max_dif < dif) max_dif = dif;
+	    v3[n] = vn;
+	  }
+	}
+      }
+    }
+    if (!quiet && (iter < 10 || (iter < 600 && iter%100 == 0) || iter%1000 == 0))
+      printf("%5d %.10f\n", iter, max_dif);
+    if (max_dif < (wp ? 1e-9 : 1e-6)) break;
+  }
+  if (!quiet) printf("\n>> %d %.10f\n\n", iter, max_dif);
+  return iter;
+}
+
+/* capacitance3
+   capacitance of the point contact from the energy in the 3-D weighting field
+*/
+static double capacitance3(float grid) {
+  double esum = 0, dv, w, Epsilon=(8.85*16.0/1000.0);  // permittivity of Ge in pF/mm
+  int    i, j, k, n, m, d, axis;
+
+  for (i=0; i<NX3; i++) {
+    for (j=0; j<NY3; j++) {
+      for (k=0; k<NZ3; k++) {
+	n = I3(i,j,k);
+	for (axis=0; axis<3; axis++) {
+	  if ((axis == 0 && i == NX3-1) || (axis == 1 && j == NY3-1) || (axis == 2 && k == NZ3-1))
+	    continue;
+	  d = (axis == 0 ? NY3*NZ3 : (axis == 1 ? NZ3 : 1));
+	  m = n + d;
+	  dv = v3[n] - v3[m];
+	  // links lying in a symmetry plane or at z = 0 are shared with the mirror image
+	  w = (eps3[n] + eps3[m]) / 32.0;
+	  if ((fold3d & FOLD_X) && i == 0 && axis != 0) w *= 0.5;
+	  if ((fold3d & FOLD_Y) && j == 0 && axis != 1) w *= 0.5;
+	  if (k == 0 && axis != 2) w *= 0.5;
+	  esum += w * dv*dv;
+	}
+      }
+    }
+  }
+  if (fold3d & FOLD_X) esum *= 2.0;
+  if (fold3d & FOLD_Y) esum *= 2.0;
+  return esum * Epsilon * grid;
+}
+
+/* field3_calc
+   calculate the potential, field and (if WP != 0) weighting potential on a
+   3-D grid, and write them to the field_name and wp_name files
+   returns 0 for success
+*/
+static int field3_calc(MJD_Siggen_Setup *setup, float BV, int WV, int WP, char *config_file_name) {
+  float  grid = setup->xtal_grid, x, y, z, r, Ex, Ey, Ez, rmax, mx, quad;
+  double e_over_E, S, omega, undep_vol = 0;
+  int    i, j, k, n, m, nx, nmax, max_its, type;
+  FILE   *file;
+
+  /* the grid extends at least to the outside contact, which then fills its edges */
+  nx  = (int) ceil(setup->xtal_radius/grid - 0.01) + 1;
+  NZ3 = (int) ceil(setup->xtal_length/grid - 0.01) + 1;
+  mx = setup->impurity_x_gradient;
+  if (setup->impurity_z0 > 0) mx = -mx;  // n-type; the sign of N and M has already been swapped
+  fold3d = 0;
+  if (setup->pc_x_offset == 0 && mx == 0) fold3d |= FOLD_X;
+  if (setup->pc_y_offset == 0) fold3d |= FOLD_Y;
+  NX3 = (fold3d & FOLD_X ? nx : 2*nx - 1);
+  NY3 = (fold3d & FOLD_Y ? nx : 2*nx - 1);
+  x03 = (fold3d & FOLD_X ? 0 : -(nx-1)*grid);
+  y03 = (fold3d & FOLD_Y ? 0 : -(nx-1)*grid);
+  printf("3-D grid: %d x %d x %d, grid size %.4f mm, fold %d\n", NX3, NY3, NZ3, grid, fold3d);
+  if (setup->pc_x_offset != 0 || setup->pc_y_offset != 0)
+    printf("Point contact centre at (x, y) = (%.2f, %.2f) mm\n",
+	   setup->pc_x_offset, setup->pc_y_offset);
+  if (graded) printf("Note: the 3-D grid is not graded; using xtal_grid everywhere\n");
+  if ((double) NX3 * (double) NY3 * (double) NZ3 > 2.0e8) {
+    printf("Error: Crystal size divided by grid size is too large for 3-D fields!\n");
+    return 1;
+  }
+  n = NX3 * NY3 * NZ3;
+  if ((v3     = malloc(n*sizeof(*v3)))     == NULL ||
+      (rho3   = malloc(n*sizeof(*rho3)))   == NULL ||
+      (eps3   = malloc(n*sizeof(*eps3)))   == NULL ||
+      (bulk3  = malloc(n*sizeof(*bulk3)))  == NULL ||
+      (undep3 = calloc(n, sizeof(*undep3))) == NULL) {
+    printf("Malloc failed\n");
+    return 1;
+  }
+
+  /*  e/espilon * volume of voxel in mm3 / surface area of voxel in mm2
+      for 1 mm2, charge units 1e10 e/cm3, espilon = 16*epsilon0 */
+  e_over_E = 11.31 * grid*grid / 6.0;
+  S = setup->impurity_surface * e_over_E / grid;
+  rmax = setup->xtal_radius;
+  for (i=0; i<NX3; i++) {
+    x = x03 + i*grid;
+    for (j=0; j<NY3; j++) {
+      y = y03 + j*grid;
+      r = sqrt(x*x + y*y);
+      for (k=0; k<NZ3; k++) {
+	z = k*grid;
+	n = I3(i,j,k);
+	bulk3[n] = type = point_type3(setup, x, y, z, grid);
+	eps3[n] = (type == 2 ? 1 : 16);  // permittivity inside vacuum and Ge
+	rho3[n] = 0;
+	if (type == -1) {
+	  v3[n] = BV;
+	} else if (type == 1) {
+	  v3[n] = 0;
+	} else {
+	  // initial guess at the potential, as for the (r,z) grid
+	  v3[n] = BV * (z / setup->xtal_length + (1.0 - z / setup->xtal_length) * r / rmax);
+	  if (type == 0) {
+	    quad = 1.0 - (z - setup->xtal_length/2.0) * (z - setup->xtal_length/2.0) /
+	      (setup->xtal_length * setup->xtal_length / 4.0);
+	    rho3[n] = (N + 0.1 * M * z + 0.1 * mx * x + setup->impurity_quadratic * quad) * e_over_E;
+	    if (setup->impurity_rpower > 0.1) {
+	      rho3[n] = rho3[n] * (1.0 + (setup->impurity_radial_mult - 1.0f) *
+				   pow(r/rmax, setup->impurity_rpower)) +
+		setup->impurity_radial_add * e_over_E * pow(r/rmax, setup->impurity_rpower);
+	    }
+	  }
+	}
+      }
+    }
+  }
+  // passivated surfaces at z = 0 and next to the ditch
+  for (i=0; i<NX3-1; i++) {
+    for (j=0; j<NY3-1; j++) {
+      for (k=0; k<NZ3-1; k++) {
+	n = I3(i,j,k);
+	if (bulk3[n] != 0) continue;
+	if (k == 0 ||
+	    bulk3[n + NY3*NZ3] == 2 || (i > 0 && bulk3[n - NY3*NZ3] == 2) ||
+	    bulk3[n + NZ3] == 2 || (j > 0 && bulk3[n - NZ3] == 2) ||
+	    bulk3[n + 1] == 2 || bulk3[n - 1] == 2)
+	  rho3[n] += S;
+      }
+    }
+  }
+
+  /* optimum over-relaxation factor for the size of the (unfolded) grid */
+  nmax = NZ3;
+  if (nmax < 2*nx) nmax = 2*nx;
+  omega = 2.0 / (1.0 + sin(3.14159 / (double) nmax));
+  max_its = MAX_ITS;
+  if (setup->max_iterations > 0) max_its = setup->max_iterations;
+  printf("Calculating 3-D potential; over-relaxation factor %.4f\n", omega);
+  relax3(0, omega, max_its);
+
+  fully_depleted = 1;
+  for (n=0; n<NX3*NY3*NZ3; n++) {
+    if (undep3[n]) {
+      fully_depleted = 0;
+      undep_vol += 1.0;
+    }
+  }
+  if (fold3d & FOLD_X) undep_vol *= 2.0;
+  if (fold3d & FOLD_Y) undep_vol *= 2.0;
+  undep_vol *= grid*grid*grid;
+  if (fully_depleted) {
+    printf("Detector is fully depleted.\n");
+  } else {
+    printf("Detector is not fully depleted.\n"
+	   "Undepleted volume: about %.1f mm3\n", undep_vol);
+  }
+
+  if (WV) {
+    // swap voltages back to negative for n-type material
+    if (setup->impurity_z0 > 0) {
+      for (n=0; n<NX3*NY3*NZ3; n++) v3[n] = -v3[n];
+    }
+    if (!(file = fopen(setup->field_name, "w"))) {
+      printf("ERROR: Cannot open file %s for electric field...\n", setup->field_name);
       return 1;
     } else {
-      printf("Writing weighting potential to file %s\n", setup.wp_name);
+      printf("Writing 3-D electric field data to file %s\n", setup->field_name);
     }
-    /* copy configuration parameters to output file */
     report_config(file, config_file_name);
     fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", BV);
     if (fully_depleted) {
       fprintf(file, "# Detector is fully depleted.\n");
     } else {
       fprintf(file, "# Detector is not fully depleted.\n");
-      if (bubble_volts > 0.0f) fprintf(file, "# Pinch-off bubble at %.0f V potential\n", bubble_volts);
     }
-    fprintf(file, "#\n## r (mm), z (mm), WP\n");
-    for (r=0; r<R+1; r++) {
-      for (z=0; z<L+1; z++) {
-	fprintf(file, "%7.2f %7.2f %10.6f\n",
-		((float) r)*grid,  ((float) z)*grid, v[new][z][r]);
+    fprintf(file, "# 3-D grid: %d x %d x %d, step %.4f mm, fold %d\n", NX3, NY3, NZ3, grid, fold3d);
+    fprintf(file, "#\n## x (mm), y (mm), z (mm), V (V),  E (V/cm), E_x (V/cm), E_y (V/cm), E_z (V/cm)\n");
+    for (i=0; i<NX3; i++) {
+      for (j=0; j<NY3; j++) {
+	for (k=0; k<NZ3; k++) {
+	  n = I3(i,j,k);
+	  // central differences, one-sided at the edges and zero on a symmetry plane
+	  m = NY3*NZ3;
+	  if (i == 0) {
+	    Ex = (fold3d & FOLD_X ? 0 : (v3[n] - v3[n+m])/(0.1*grid));
+	  } else if (i == NX3-1) {
+	    Ex = (v3[n-m] - v3[n])/(0.1*grid);
+	  } else {
+	    Ex = (v3[n-m] - v3[n+m])/(0.2*grid);
+	  }
+	  m = NZ3;
+	  if (j == 0) {
+	    Ey = (fold3d & FOLD_Y ? 0 : (v3[n] - v3[n+m])/(0.1*grid));
+	  } else if (j == NY3-1) {
+	    Ey = (v3[n-m] - v3[n])/(0.1*grid);
+	  } else {
+	    Ey = (v3[n-m] - v3[n+m])/(0.2*grid);
+	  }
+	  if (k == 0) {
+	    Ez = (v3[n] - v3[n+1])/(0.1*grid);
+	  } else if (k == NZ3-1) {
+	    Ez = (v3[n-1] - v3[n])/(0.1*grid);
+	  } else {
+	    Ez = (v3[n-1] - v3[n+1])/(0.2*grid);
+	  }
+	  fprintf(file, "%7.2f %7.2f %7.2f %7.1f %7.1f %7.1f %7.1f %7.1f\n",
+		  x03 + i*grid, y03 + j*grid, k*grid, v3[n],
+		  sqrt(Ex*Ex + Ey*Ey + Ez*Ez), Ex, Ey, Ez);
+	}
+	fprintf(file, "\n");
       }
-      fprintf(file, "\n");
     }
     fclose(file);
   }
 
+  if (WP == 0) return 0;
+  /* weighting potential for the point contact, with the undepleted region
+     treated as part of the contact */
+  for (n=0; n<NX3*NY3*NZ3; n++) {
+    if (bulk3[n] == 1 || undep3[n]) {
+      v3[n] = 1;
+    } else if (bulk3[n] == -1) {
+      v3[n] = 0;
+    } else {
+      v3[n] = 0.5;
+    }
+  }
+  printf("Calculating 3-D weighting potential\n");
+  relax3(1, omega, max_its);
+  printf("\n  >>  Calculated capacitance at %.0f V: %.3lf pF\n\n",
+	 BV, capacitance3(grid));
+
+  if (!(file = fopen(setup->wp_name, "w"))) {
+    printf("ERROR: Cannot open file %s for weighting potential...\n", setup->wp_name);
+    return 1;
+  } else {
+    printf("Writing 3-D weighting potential to file %s\n", setup->wp_name);
+  }
+  report_config(file, config_file_name);
+  fprintf(file, "#\n# HV bias in fieldgen: %.1f V\n", BV);
+  if (fully_depleted) {
+    fprintf(file, "# Detector is fully depleted.\n");
+  } else {
+    fprintf(file, "# Detector is not fully depleted.\n");
+  }
+  fprintf(file, "# 3-D grid: %d x %d x %d, step %.4f mm, fold %d\n", NX3, NY3, NZ3, grid, fold3d);
+  fprintf(file, "#\n## x (mm), y (mm), z (mm), WP\n");
+  for (i=0; i<NX3; i++) {
+    for (j=0; j<NY3; j++) {
+      for (k=0; k<NZ3; k++) {
+	fprintf(file, "%7.2f %7.2f %7.2f %10.6f\n",
+		x03 + i*grid, y03 + j*grid, k*grid, v3[I3(i,j,k)]);
+      }
+      fprintf(file, "\n");
+    }
+  }
+  fclose(file);
+
   return 0;
 }
+#undef I3
 
 int report_config(FILE *fp_out, char *config_file_name) {
 
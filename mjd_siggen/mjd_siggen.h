@@ -26,6 +26,49 @@
 /* enum to identify cylindrical or cartesian coords */
 #define CYL 0
 #define CART 1
+/* bits of fold3; a folded 3-D field grid covers only coordinates >= 0
+   along that axis, and is mirrored to give the field at negative values */
+#define FOLD_X 1
+#define FOLD_Y 2
+#define FOLD_Z 4
+/* parameters of the forward-mode sensitivities from make_signal_sens(): starting
+   point, impurity interpolation, hole mobility (see set_hole_params()) and trapping */
+#define SENS_X         0
+#define SENS_Y         1
+#define SENS_Z         2
+#define SENS_AVG_IMP   3
+#define SENS_IMP_GRAD  4
+#define SENS_H100_MU0  5
+#define SENS_H100_BETA 6
+#define SENS_H100_E0   7
+#define SENS_H111_MU0  8
+#define SENS_H111_BETA 9
+#define SENS_H111_E0   10
+#define SENS_TRAP      11
+#define SENS_NPAR      12
+
+/* number of geometry parameters that setup->geom_sd depends on */
+#define GEOM_NKEY 16
+
+/* storage class of the last-point caches in fields.c, so that each thread
+   calculating signals (see mc_events.c) has its own; mc_events.c uses a single
+   thread if NO_THREADS is defined, as it is on Windows (no POSIX threads) and
+   where there is no thread-local storage */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#ifndef NO_THREADS
+#define NO_THREADS
+#endif
+#endif
+#if defined(_WIN32) && !defined(NO_THREADS)
+#define NO_THREADS
+#endif
 
 float sqrtf(float x);
 float fminf(float x, float y);
@@ -66,13 +109,27 @@ typedef struct {
   float k0_3;
 } velocity_params;
 
+/* one recorded step of a drift path; see path_step */
+typedef struct {
+  float t;      // time since the start of the drift, in ns
+  float r, z;   // position, in mm
+  float v;      // drift speed, in mm/ns
+  float wp;     // point-contact weighting potential; -1 where not calculated (outside the field grid)
+} path_record;
+
 /* setup parameters data structure */
 typedef struct {
   // general
   int verbosity;              // 0 = terse, 1 = normal, 2 = chatty/verbose
   int velocity_type;          // 0 = David, 1 = Ben
 
-  // geometry
+  // geometry; one description covers the detector families:
+  //   PPC:   point contact (pc_*), with optional taper and top bulletization
+  //   BEGe:  as PPC, plus a wrap-around outer contact and ditch
+  //   ICPC:  as PPC, plus a well (hole_*) in the top, part of the outer contact
+  //   coax:  the inner contact is a bore of radius pc_radius from the bottom,
+  //          with pc_length = xtal_length for a true (open-ended) coax
+  //   see detector_geometry.c
   float xtal_length;          // z length
   float xtal_radius;          // radius
   float top_bullet_radius;    // bulletization radius at top of crystal
@@ -83,10 +140,16 @@ typedef struct {
   float wrap_around_radius;   // wrap-around radius for BEGes. Set to zero for ORTEC
   float ditch_depth;          // depth of ditch next to wrap-around for BEGes. Set to zero for ORTEC
   float ditch_thickness;      // width of ditch next to wrap-around for BEGes. Set to zero for ORTEC
+  float hole_length;          // depth of the central well from the top of an ICPC; zero for none
+  float hole_radius;          // radius of the central well
   float Li_thickness;         // depth of full-charge-collection boundary for Li contact
+  float pc_x_offset;          // x position of the point contact centre, for 3-D fields only
+  float pc_y_offset;          // y position of the point contact centre, for 3-D fields only
 
   // electric fields & weighing potentials
   float xtal_grid;            // grid size in mm for field files (either 0.5 or 0.1 mm)
+  float xtal_grid_max;        // max grid size in mm for a graded grid; 0 for a uniform grid
+  float xtal_grid_grade;      // increase in graded grid size per mm of distance from PC/ditch
   float impurity_z0;          // net impurity concentration at Z=0, in 1e10 e/cm3
   float impurity_gradient;    // net impurity gradient, in 1e10 e/cm4
   float impurity_quadratic;   // net impurity difference from linear, at z=L/2, in 1e10 e/cm3
@@ -94,6 +157,7 @@ typedef struct {
   float impurity_radial_add;  // additive radial impurity at outside radius, in 1e10 e/cm3
   float impurity_radial_mult; // multiplicative radial impurity at outside radius (neutral=1.0)
   float impurity_rpower;      // power for radial impurity increase with radius
+  float impurity_x_gradient;  // net impurity gradient along x, in 1e10 e/cm4, for 3-D fields only
   float xtal_HV;              // detector bias for fieldgen, in Volts
   int   max_iterations;       // maximum number of iterations to use in mjd_fieldgen
   int   write_field;          // set to 1 to write V and E to output file, 0 otherwise
@@ -123,13 +187,35 @@ typedef struct {
   float rmin, rmax, rstep;
   float zmin, zmax, zstep;
   int   rlen, zlen;           // dimensions of efld and wpot arrays
+  float *r_grid, *z_grid;     // grid coordinates for graded grids; NULL for uniform rstep/zstep
+  int   *r_grid_lookup, *z_grid_lookup; // grid index at or below each fine bin, for graded grids
+  float r_lookup_step, z_lookup_step;   // bin sizes of the graded-grid lookup tables
+  int   field_grid_gen;       // generation of the (r,z) field grid, new for each grid set up
+  float *field3;              // 3-D grid of (E_x, E_y, E_z, WP) at each point, as [x][y][z][4];
+                              //   NULL to use the (r,z) efld and wpot arrays
+  int   xlen3, ylen3, zlen3;  // dimensions of the 3-D grid
+  float xmin3, ymin3, zmin3;  // position of the first 3-D grid point, in mm
+  float step3;                // 3-D grid size, in mm
+  int   fold3;                // FOLD_X | FOLD_Y | FOLD_Z for axes on which the 3-D grid is mirrored
+  float *geom_sd;             // signed distance to the detector surface on a uniform (r,z) grid, see geometry_setup()
+  int   geom_rlen, geom_zlen; // dimensions of geom_sd
+  float geom_key[GEOM_NKEY];  // geometry parameters that geom_sd was calculated for
   int   v_lookup_len;
-  struct velocity_lookup *v_lookup;
+  struct velocity_lookup *v_lookup;       // drift velocity table, corrected for the temperature
+  struct velocity_lookup *v_lookup_raw;   // drift velocity table as read, at REF_TEMP
+  double v_temp_par[2][4];    // (mu_0, power, B, Theta) of the temperature correction, for electrons, holes
+  int   v_table_len;          // v_lookup resampled on a uniform |E| grid, see resample_velocity_table()
+  float v_table_step;         // field step of v_table, in V/cm
+  float *v_table;             // its coefficients, as [holes, electrons][coefficient][v_table_len]
   velocity_params* v_params;
+  float *h_table;             // field-magnitude terms of the velocity_type 1 hole model, see resample_hole_params()
+  int   h_table_ok;           // set when h_table is for the current v_params; cleared while they are perturbed
 
   float *efld_r;
   float *efld_z;
   float *wpot;
+  float *wpot_extra;          // WPs of other electrodes, [r][z][n] or [x][y][z][n]; see set_wpot_extra()
+  int   num_wpot_extra;       // number n of WPs in wpot_extra
 
   float imp_grad;
   float avg_imp;
@@ -150,6 +236,9 @@ typedef struct {
 
   // data for calc_signal.c
   point *dpath_e, *dpath_h;      // electron and hole drift paths
+  int   path_step;               // record every path_step-th step in the drift paths; 0 for no paths
+  int   path_len_e, path_len_h;  // number of points recorded in the drift paths by the last calculation
+  path_record *dpath_rec_e, *dpath_rec_h; // (t, r, z, |v|, wp) for each point of the drift paths, or NULL
   float initial_vel, final_vel;  // initial and final drift velocities for charges collected to PC
   float dv_dE;     // derivative of drift velocity with field ((mm/ns) / (V/cm))
   float v_over_E;  // ratio of drift velocity to field ((mm/ns) / (V/cm))
@@ -158,6 +247,9 @@ typedef struct {
   double trap_constant; // in us
   double release_constant; // in ns
   float initial_wpot;
+  int   drift_steps;   // time steps (from 0) that the last drift_charge() added current to
+  float *sig_work;     // work arrays of get_signal() and get_signals(); NULL until first used
+  int   sig_work_tsteps, sig_work_nsig, sig_work_used;  // their size, and steps to clear
 } MJD_Siggen_Setup;
 
 
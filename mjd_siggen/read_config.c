@@ -25,7 +25,13 @@ int read_config(char *config_file_name, MJD_Siggen_Setup *setup) {
     "wrap_around_radius",
     "ditch_depth",
     "ditch_thickness",
+    "hole_length",
+    "hole_radius",
     "Li_thickness",
+    "pc_x_offset",
+    "pc_y_offset",
+    "xtal_grid_max",    // must come before xtal_grid
+    "xtal_grid_grade",
     "xtal_grid",
     "impurity_z0",
     "impurity_gradient",
@@ -34,6 +40,7 @@ int read_config(char *config_file_name, MJD_Siggen_Setup *setup) {
     "impurity_radial_add",
     "impurity_radial_mult",
     "impurity_rpower",
+    "impurity_x_gradient",
     "xtal_HV",
     "drift_name",
     "field_name",
@@ -141,8 +148,20 @@ int read_config(char *config_file_name, MJD_Siggen_Setup *setup) {
 	  setup->ditch_depth = fi;
 	} else if (strstr(key_word[i], "ditch_thickness")) {
 	  setup->ditch_thickness = fi;
+	} else if (strstr(key_word[i], "hole_length")) {
+	  setup->hole_length = fi;
+	} else if (strstr(key_word[i], "hole_radius")) {
+	  setup->hole_radius = fi;
 	} else if (strstr(key_word[i], "Li_thickness")) {
 	  setup->Li_thickness = fi;
+	} else if (strstr(key_word[i], "pc_x_offset")) {
+	  setup->pc_x_offset = fi;
+	} else if (strstr(key_word[i], "pc_y_offset")) {
+	  setup->pc_y_offset = fi;
+	} else if (strstr(key_word[i], "xtal_grid_max")) {
+	  setup->xtal_grid_max = fi;
+	} else if (strstr(key_word[i], "xtal_grid_grade")) {
+	  setup->xtal_grid_grade = fi;
 	} else if (strstr(key_word[i], "xtal_grid")) {
 	  setup->xtal_grid = fi;
 	} else if (strstr(key_word[i], "impurity_z0")) {
@@ -159,6 +178,8 @@ int read_config(char *config_file_name, MJD_Siggen_Setup *setup) {
 	  setup->impurity_radial_mult = fi;
 	} else if (strstr(key_word[i], "impurity_rpower")) {
 	  setup->impurity_rpower = fi;
+	} else if (strstr(key_word[i], "impurity_x_gradient")) {
+	  setup->impurity_x_gradient = fi;
 	} else if (strstr(key_word[i], "xtal_HV")) {
 	  setup->xtal_HV = fi;
 	} else if (strstr(key_word[i], "drift_name")) {
@@ -0,0 +1,403 @@
+/* siggen_bench.c -- microbenchmark of the signal calculation
+ *
+ * Times nearest_field_grid_index(), wpotential(), drift_velocity(),
+ * make_signal() and get_signal() over sets of points near the point contact,
+ * in the bulk, in the top outer corner and along the taper, as a baseline
+ * against which to judge changes to these hot paths. Each timing is repeated,
+ * and the median, minimum and spread (median absolute deviation) are reported,
+ * per call and, for the drifts, per time step of the drift.
+ *
+ * The fields are read from the mjd_fieldgen output files named by field_name
+ * and wp_name in the config file, on the (r,z) grid of xtal_grid; if they cannot
+ * be read, or with -s 1, smooth synthetic fields are used instead.
+ *
+ * Build with
+ *    python setup.py build_bench
+ * or
+ *    cc -O2 -Imjd_siggen -o siggen_bench mjd_siggen/siggen_bench.c mjd_siggen/calc_signal.c \
+ *       mjd_siggen/cyl_point.c mjd_siggen/detector_geometry.c mjd_siggen/point.c \
+ *       mjd_siggen/read_config.c mjd_siggen/siggen_helpers.c -lm
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+/* for the static nearest_field_grid_index(); fields.c is not linked separately */
+#include "fields.c"
+#include "calc_signal.h"
+#include "detector_geometry.h"
+
+int read_velocity_table(struct velocity_lookup** v_lookup_p, MJD_Siggen_Setup *setup);
+
+#define HOLE_CHARGE 1.0
+#define ELECTRON_CHARGE -1.0
+#define MIN_SAMPLE_NS 5e6   // shortest timed sample; cheap functions loop over the points until this long
+#define NSETS 4
+#define NFUNCS 7
+
+enum {F_GRID_INDEX, F_WPOT, F_VEL_E, F_VEL_H, F_SIG_E, F_SIG_H, F_GET_SIGNAL};
+static const char *func_name[NFUNCS] = {"nearest_field_grid_index", "wpotential",
+                                        "drift_velocity (e)", "drift_velocity (h)",
+                                        "make_signal (e)", "make_signal (h)", "get_signal"};
+static const char *set_name[NSETS] = {"near-PC", "bulk", "corner", "taper"};
+
+static int    bench_setup(char *config_file_name, int synthetic, MJD_Siggen_Setup *setup);
+static int    read_fieldgen_fields(MJD_Siggen_Setup *setup);
+static void   synthetic_fields(MJD_Siggen_Setup *setup);
+static int    sample_points(int set, int n, point *pts, MJD_Siggen_Setup *setup);
+static double run_pass(int func, point *pts, cyl_pt *cyl, int n, float *signal, MJD_Siggen_Setup *setup);
+static double now_ns(void);
+static int    cmp_double(const void *a, const void *b);
+
+static volatile float sink;    // keeps the timed results from being optimized away
+static unsigned int   seed = 12345;
+
+int main(int argc, char **argv)
+{
+  MJD_Siggen_Setup setup;
+
+  /* --- default values, over-ridden by the command-line options --- */
+  int   npts = 1000;     // points in each set
+  int   reps = 9;        // timed samples of each function and set
+  int   synthetic = -1;  // -1: fieldgen fields if they can be read, else synthetic
+                         //  0: fieldgen fields only;  1: synthetic fields
+  /* ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  ---  --- */
+
+  char   config_file_name[256] = "";
+  point  *pts;
+  cyl_pt *cyl;
+  float  *signal;
+  double *t, med, tmin, mad, steps, loops, pass_ns;
+  long   nsteps[NFUNCS];
+  int    i, j, k, f, s, n;
+
+  if (argc%2 != 1) {
+    printf("Possible options:\n"
+	   "      -c config_file_name\n"
+	   "      -n points_per_set  (default 1000)\n"
+	   "      -r repetitions     (default 9)\n"
+	   "      -s {0,1}    (fieldgen/synthetic fields; default fieldgen if readable)\n");
+    return 1;
+  }
+  for (i=1; i<argc-1; i+=2) {
+    if (strstr(argv[i], "-c")) {
+      strncpy(config_file_name, argv[i+1], sizeof(config_file_name)-1);
+    } else if (strstr(argv[i], "-n")) {
+      npts = atoi(argv[i+1]);
+    } else if (strstr(argv[i], "-r")) {
+      reps = atoi(argv[i+1]);
+    } else if (strstr(argv[i], "-s")) {
+      synthetic = atoi(argv[i+1]);
+    } else {
+      printf("ERROR: Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (config_file_name[0] == '\0') {
+    printf("ERROR: No config file given (-c config_file_name)\n");
+    return 1;
+  }
+  if (npts < 1) npts = 1;
+  if (reps < 1) reps = 1;
+  if (bench_setup(config_file_name, synthetic, &setup) != 0) return 1;
+
+  pts    = malloc(npts*sizeof(*pts));
+  cyl    = malloc(npts*sizeof(*cyl));
+  signal = malloc(setup.time_steps_calc*sizeof(*signal));
+  t      = malloc(reps*sizeof(*t));
+  if (pts == NULL || cyl == NULL || signal == NULL || t == NULL) {
+    error("malloc failed in main\n");
+    return 1;
+  }
+
+  printf("\n%-8s %-25s %11s %11s %6s %9s %12s\n", "set", "function",
+         "median ns", "min ns", "MAD %", "ns/step", "calls/s");
+  for (s = 0; s < NSETS; s++) {
+    n = sample_points(s, npts, pts, &setup);
+    if (n == 0) {
+      printf("%-8s no points inside the detector\n", set_name[s]);
+      continue;
+    }
+    for (i = 0; i < n; i++) cyl[i] = cart_to_cyl(pts[i]);
+
+    /* number of drift steps for each point, for ns/step */
+    memset(nsteps, 0, sizeof(nsteps));
+    for (i = 0; i < n; i++) {
+      make_signal(pts[i], signal, ELECTRON_CHARGE, &setup);
+      nsteps[F_SIG_E] += setup.drift_steps;
+      make_signal(pts[i], signal, HOLE_CHARGE, &setup);
+      nsteps[F_SIG_H] += setup.drift_steps;
+    }
+    nsteps[F_GET_SIGNAL] = nsteps[F_SIG_E] + nsteps[F_SIG_H];
+
+    for (f = 0; f < NFUNCS; f++) {
+      /* warm-up pass, which also sets how many passes make up a sample */
+      pass_ns = run_pass(f, pts, cyl, n, signal, &setup);
+      loops = (pass_ns < MIN_SAMPLE_NS) ? ceil(MIN_SAMPLE_NS/(pass_ns + 1.0)) : 1;
+      for (k = 0; k < reps; k++) {
+        t[k] = 0;
+        for (j = 0; j < loops; j++) t[k] += run_pass(f, pts, cyl, n, signal, &setup);
+        t[k] /= loops*n;   // ns per call
+      }
+      qsort(t, reps, sizeof(*t), cmp_double);
+      med = t[reps/2];
+      tmin = t[0];
+      for (k = 0; k < reps; k++) t[k] = fabs(t[k] - med);
+      qsort(t, reps, sizeof(*t), cmp_double);
+      mad = t[reps/2];
+      steps = (double) nsteps[f]/n;
+      printf("%-8s %-25s %11.1f %11.1f %6.2f", set_name[s], func_name[f], med, tmin, 100.0*mad/med);
+      if (steps > 0) printf(" %9.2f", med/steps);
+      else printf(" %9s", "-");
+      printf(" %12.0f\n", 1e9/med);
+    }
+  }
+  printf("\ncalls/s of get_signal is waveforms/s; ns/step is per step of the drift(s)\n");
+
+  free(pts);
+  free(cyl);
+  free(signal);
+  free(t);
+  return 0;
+}
+
+/* bench_setup
+   reads the config file and sets up the velocity tables, hole model and
+   fields as pysiggen's Siggen does, for a single (r,z) field
+   returns 0 for success
+*/
+static int bench_setup(char *config_file_name, int synthetic, MJD_Siggen_Setup *setup) {
+  struct velocity_lookup *raw;
+  int    n;
+
+  if (read_config(config_file_name, setup)) return -1;
+  setup->rmin  = 0;
+  setup->rmax  = setup->xtal_radius;
+  setup->rstep = setup->xtal_grid;
+  setup->zmin  = 0;
+  setup->zmax  = setup->xtal_length;
+  setup->zstep = setup->xtal_grid;
+  setup->rlen  = lrintf((setup->rmax - setup->rmin)/setup->rstep) + 1;
+  setup->zlen  = lrintf((setup->zmax - setup->zmin)/setup->zstep) + 1;
+  setup->ntsteps_out = setup->time_steps_calc /
+    lrintf(setup->step_time_out/setup->step_time_calc);
+  setup->path_step = 0;
+
+  if ((raw = malloc(21*sizeof(*raw))) == NULL ||
+      (setup->v_params = malloc(sizeof(*setup->v_params))) == NULL) {
+    error("malloc failed in bench_setup\n");
+    return -1;
+  }
+  if (read_velocity_table(&raw, setup) != 0) return -1;
+  if ((setup->v_lookup = malloc(setup->v_lookup_len*sizeof(*setup->v_lookup))) == NULL) {
+    error("malloc failed in bench_setup\n");
+    return -1;
+  }
+  setup->v_lookup_raw = raw;
+  if (set_velocity_temps(setup->xtal_temp, setup->xtal_temp, setup) != 0) return -1;
+  /* pysiggen's defaults: Reggiani hole mobilities (Bruyneel NIMA 2006) */
+  setup->velocity_type = 1;
+  set_hole_params(66333., 0.744, 181., 107270., 0.580, 100., setup);
+  set_k0_params(9.2652, -26.3467, 29.6137, -12.3689, setup);
+
+  /* a single field, with no impurity or point-contact interpolation */
+  setup->num_grads = setup->num_imps = setup->num_pcrad = setup->num_pclen = 1;
+  setup->imp_grad_step = setup->avg_imp_step = setup->pcrad_step = setup->pclen_step = 1;
+  setup->min_imp_grad = setup->min_avg_imp = setup->imp_grad = setup->avg_imp = 0;
+  setup->min_pcrad = setup->pc_radius;
+  setup->min_pclen = setup->pc_length;
+  n = setup->rlen*setup->zlen;
+  if ((setup->efld_r = calloc(n, sizeof(float))) == NULL ||
+      (setup->efld_z = calloc(n, sizeof(float))) == NULL ||
+      (setup->wpot   = calloc(n, sizeof(float))) == NULL) {
+    error("malloc failed in bench_setup\n");
+    return -1;
+  }
+  if (synthetic != 1 && read_fieldgen_fields(setup) == 0) {
+    printf("Fields from %s and %s\n", setup->field_name, setup->wp_name);
+  } else if (synthetic == 0) {
+    return -1;
+  } else {
+    synthetic_fields(setup);
+    printf("Synthetic fields\n");
+  }
+  printf("%.1f x %.1f mm detector, %d x %d field grid of %.2f mm, "
+         "%d time steps of %.2f ns\n", setup->xtal_radius, setup->xtal_length,
+         setup->rlen, setup->zlen, setup->xtal_grid,
+         setup->time_steps_calc, setup->step_time_calc);
+  return geometry_setup(setup);
+}
+
+/* read_fieldgen_fields
+   reads E_r, E_z and the WP from mjd_fieldgen's (r,z) output files,
+   with lines of (r, z, V, |E|, E_r, E_z) and (r, z, WP)
+   returns 0 for success
+*/
+static int read_fieldgen_fields(MJD_Siggen_Setup *setup) {
+  char  line[MAX_LINE], *cp;
+  float r, z, v, eabs, er, ez, wp;
+  int   i, j, n = 0;
+  FILE  *fp;
+
+  if ((fp = fopen(setup->field_name, "r")) == NULL) return -1;
+  while (fgets(line, MAX_LINE, fp) != NULL) {
+    for (cp = line; *cp == ' ' || *cp == '\t'; cp++);
+    if (*cp == '#' || sscanf(cp, "%f %f %f %f %f %f", &r, &z, &v, &eabs, &er, &ez) != 6) continue;
+    i = lrintf((r - setup->rmin)/setup->rstep);
+    j = lrintf((z - setup->zmin)/setup->zstep);
+    if (i < 0 || i >= setup->rlen || j < 0 || j >= setup->zlen) continue;
+    setup->efld_r[i*setup->zlen + j] = er;
+    setup->efld_z[i*setup->zlen + j] = ez;
+    n++;
+  }
+  fclose(fp);
+  if (n == 0) return -1;
+
+  n = 0;
+  if ((fp = fopen(setup->wp_name, "r")) == NULL) return -1;
+  while (fgets(line, MAX_LINE, fp) != NULL) {
+    for (cp = line; *cp == ' ' || *cp == '\t'; cp++);
+    if (*cp == '#' || sscanf(cp, "%f %f %f", &r, &z, &wp) != 3) continue;
+    i = lrintf((r - setup->rmin)/setup->rstep);
+    j = lrintf((z - setup->zmin)/setup->zstep);
+    if (i < 0 || i >= setup->rlen || j < 0 || j >= setup->zlen) continue;
+    setup->wpot[i*setup->zlen + j] = wp;
+    n++;
+  }
+  fclose(fp);
+  return (n > 0) ? 0 : -1;
+}
+
+/* synthetic_fields
+   fills in a field pointing at the point contact, of 300 V/cm in the bulk
+   rising to about 10 kV/cm at the contact, and a WP falling off as 1/d
+   with the distance d from the contact
+*/
+static void synthetic_fields(MJD_Siggen_Setup *setup) {
+  float r, z, d, a, e;
+  int   i, j;
+
+  a = setup->pc_radius > setup->pc_length ? setup->pc_radius : setup->pc_length;
+  if (a < setup->xtal_grid) a = setup->xtal_grid;
+  for (i = 0; i < setup->rlen; i++) {
+    for (j = 0; j < setup->zlen; j++) {
+      r = setup->rmin + i*setup->rstep;
+      z = setup->zmin + j*setup->zstep;
+      d = sqrt(r*r + z*z);
+      if (d < 0.1*a) d = 0.1*a;
+      e = 300.0 + 9700.0*(a/(a + d))*(a/(a + d));
+      setup->efld_r[i*setup->zlen + j] = -e*r/d;
+      setup->efld_z[i*setup->zlen + j] = -e*z/d;
+      setup->wpot[i*setup->zlen + j] = (d < a) ? 1.0 : a/d;
+    }
+  }
+}
+
+/* sample_points
+   puts n points of set (near-PC, bulk, corner or taper) in pts, uniformly
+   distributed in phi and in the (r,z) region of the set, inside the detector
+   returns the number of points found
+*/
+static int sample_points(int set, int n, point *pts, MJD_Siggen_Setup *setup) {
+  float  R = setup->xtal_radius, L = setup->xtal_length, T = setup->taper_length;
+  float  r0, r1, z0, z1, u;
+  cyl_pt c;
+  point  pt;
+  long   tries;
+  int    i = 0;
+
+  for (tries = 0; i < n && tries < 1000L*n; tries++) {
+    u = rand_r(&seed)/(RAND_MAX + 1.0);
+    switch (set) {
+    case 0:    // near the point contact
+      r0 = 0; r1 = setup->pc_radius + 3.0;
+      z0 = 0; z1 = setup->pc_length + 3.0;
+      break;
+    case 1:    // bulk
+      r0 = 0.25*R; r1 = 0.75*R;
+      z0 = 0.25*L; z1 = 0.75*L;
+      break;
+    case 2:    // top outer corner, far from the point contact
+      r0 = R - 3.0; r1 = R;
+      z0 = L - 3.0; z1 = L;
+      break;
+    default:   // within 1.5 mm of the taper, or of the bottom outer corner
+      z0 = 0; z1 = (T > 0) ? T : 3.0;
+      r1 = (T > 0) ? R - T + u*z1 : R;
+      r0 = r1 - ((T > 0) ? 1.5 : 3.0);
+      break;
+    }
+    c.z   = (set == 3) ? u*z1 : z0 + u*(z1 - z0);
+    c.r   = r0 + (r1 - r0)*sqrt(rand_r(&seed)/(RAND_MAX + 1.0));
+    c.phi = 2.0*M_PI*rand_r(&seed)/(RAND_MAX + 1.0);
+    if (c.r < 0) continue;
+    pt = cyl_to_cart(c);
+    if (outside_detector(pt, setup)) continue;
+    pts[i++] = pt;
+  }
+  if (i < n) printf("%s: only %d of %d points found inside the detector\n", set_name[set], i, n);
+  return i;
+}
+
+/* run_pass
+   calls function func once for each of the n points
+   returns the time taken, in ns
+*/
+static double run_pass(int func, point *pts, cyl_pt *cyl, int n, float *signal, MJD_Siggen_Setup *setup) {
+  cyl_int_pt ipt;
+  vector v;
+  float  wp, acc = 0;
+  double t0;
+  int    i;
+
+  t0 = now_ns();
+  switch (func) {
+  case F_GRID_INDEX:
+    for (i = 0; i < n; i++) acc += nearest_field_grid_index(cyl[i], &ipt, setup) + ipt.r;
+    break;
+  case F_WPOT:
+    for (i = 0; i < n; i++) {
+      wpotential(pts[i], &wp, setup);
+      acc += wp;
+    }
+    break;
+  case F_VEL_E:
+  case F_VEL_H:
+    for (i = 0; i < n; i++) {
+      drift_velocity(pts[i], (func == F_VEL_H) ? HOLE_CHARGE : ELECTRON_CHARGE, &v, setup);
+      acc += v.x;
+    }
+    break;
+  case F_SIG_E:
+  case F_SIG_H:
+    for (i = 0; i < n; i++) {
+      make_signal(pts[i], signal, (func == F_SIG_H) ? HOLE_CHARGE : ELECTRON_CHARGE, setup);
+      acc += signal[0];
+    }
+    break;
+  default:
+    for (i = 0; i < n; i++) {
+      get_signal(pts[i], signal, setup);
+      acc += signal[setup->ntsteps_out - 1];
+    }
+    break;
+  }
+  t0 = now_ns() - t0;
+  sink = acc;
+  return t0;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9*ts.tv_sec + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
@@ -4,13 +4,18 @@
 #include <stdlib.h>
 #include <math.h>
 
-int read_velocity_table(struct velocity_lookup* v_lookup, MJD_Siggen_Setup *setup){
+/* read_velocity_table
+   read the drift velocity table into *v_lookup (malloc()'ed, of at least 21 rows),
+   which is realloc()'ed as needed, and its temperature correction parameters;
+   see set_velocity_temps() in fields.c for the temperature correction
+*/
+int read_velocity_table(struct velocity_lookup** v_lookup_p, MJD_Siggen_Setup *setup){
 
   int vlook_sz = 0;
   char  line[MAX_LINE], *c;
   FILE  *fp;
   int   v_lookup_len;
-  struct velocity_lookup *tmp;
+  struct velocity_lookup *tmp, *v_lookup = *v_lookup_p;
   
   double be=1.3e7, bh=1.2e7, thetae=200.0, thetah=200.0;  // parameters for temperature correction
   double pwre=-1.680, pwrh=-2.398, mue=5.66e7, muh=1.63e9; //     adopted for Ge   DCR Feb 2015
@@ -46,7 +51,7 @@ int read_velocity_table(struct velocity_lookup* v_lookup, MJD_Siggen_Setup *setu
 	fclose(fp);
 	return -1;
       }
-      v_lookup = tmp;
+      v_lookup = *v_lookup_p = tmp;
     }
     if (sscanf(line, "%f %f %f %f %f %f %f", 
 	       &v_lookup[v_lookup_len].e,
@@ -102,103 +107,21 @@ int read_velocity_table(struct velocity_lookup* v_lookup, MJD_Siggen_Setup *setu
       fclose(fp);
       return -1;
     }
-    v_lookup = tmp;
+    v_lookup = *v_lookup_p = tmp;
     vlook_sz = v_lookup_len;
   }
   TELL_NORMAL("Drift velocity table has %d rows of data\n", v_lookup_len);
   fclose(fp);
   
   setup->v_lookup_len = v_lookup_len;
+  setup->v_temp_par[0][0] = mue;
+  setup->v_temp_par[0][1] = pwre;
+  setup->v_temp_par[0][2] = be;
+  setup->v_temp_par[0][3] = thetae;
+  setup->v_temp_par[1][0] = muh;
+  setup->v_temp_par[1][1] = pwrh;
+  setup->v_temp_par[1][2] = bh;
+  setup->v_temp_par[1][3] = thetah;
   
   return 0;
 }
-
-
-int temperature_modify_velocity_table(float e_temp, float h_temp, struct velocity_lookup* v_lookup_saved, struct velocity_lookup* modified_v_lookup, MJD_Siggen_Setup *setup){
- /*
-    apply temperature dependence to mobilities;
-    see drift_velocities.doc and tempdep.c
-    The drift velocity reduces at higher temperature due to the increasing of
-    scattering with the lattice vibration. We used a model by M. Ali Omar and
-    L. Reggiani (Solid-State Electronics Vol. 30, No. 12 (1987) 1351) to
-    calculate the temperature dependence.
-  */
-  /* electrons */
-  
-
-  int   i;
-  int vlook_sz = setup->v_lookup_len;
-  struct velocity_lookup  v, v0;
-
-  float sumb_e, sumc_e, sumb_h, sumc_h;
-  double be=1.3e7, bh=1.2e7, thetae=200.0, thetah=200.0;  // parameters for temperature correction
-  double pwre=-1.680, pwrh=-2.398, mue=5.66e7, muh=1.63e9; //     adopted for Ge   DCR Feb 2015
-  double mu_0_1, mu_0_2, v_s_1, v_s_2, E_c_1, E_c_2, e, f;
-  
-  TELL_NORMAL("Adjusting mobilities for temperature, from %.1f to %.1f\n", REF_TEMP, setup->xtal_temp);
-  TELL_CHATTY("Index  field  vel_factor\n");
-  mu_0_1 = mue * pow(REF_TEMP, pwre);
-  v_s_1 = be * sqrt(tanh(0.5 * thetae / REF_TEMP));
-  E_c_1 = v_s_1 / mu_0_1;
-  mu_0_2 = mue * pow(e_temp, pwre);
-  v_s_2 = be * sqrt(tanh(0.5 * thetae / e_temp));
-  E_c_2 = v_s_2 / mu_0_2;
-  
-  
-  for (i = 0; i < vlook_sz; i++){
-    e = v_lookup_saved[i].e;
-    if (e < 1) continue;
-    f = (v_s_2 * (e/E_c_2) / sqrt(1.0 + (e/E_c_2) * (e/E_c_2))) /
-        (v_s_1 * (e/E_c_1) / sqrt(1.0 + (e/E_c_1) * (e/E_c_1)));
-    modified_v_lookup[i].e100 = v_lookup_saved[i].e100*f;
-    modified_v_lookup[i].e110 = v_lookup_saved[i].e110*f;
-    modified_v_lookup[i].e111 = v_lookup_saved[i].e111*f;
-    TELL_CHATTY("%2d %5.0f %f\n", i, e, f);
-  }
-
-  /* holes */
-  mu_0_1 = muh * pow(REF_TEMP, pwrh);
-  v_s_1 = bh * sqrt(tanh(0.5 * thetah / REF_TEMP));
-  E_c_1 = v_s_1 / mu_0_1;
-  mu_0_2 = muh * pow(h_temp, pwrh);
-  v_s_2 = bh * sqrt(tanh(0.5 * thetah / h_temp));
-  E_c_2 = v_s_2 / mu_0_2;
-  for (i = 0; i < vlook_sz; i++){
-    e = v_lookup_saved[i].e;
-    if (e < 1) continue;
-    f = (v_s_2 * (e/E_c_2) / sqrt(1.0 + (e/E_c_2) * (e/E_c_2))) /
-        (v_s_1 * (e/E_c_1) / sqrt(1.0 + (e/E_c_1) * (e/E_c_1)));
-    modified_v_lookup[i].h100 = v_lookup_saved[i].h100*f;
-    modified_v_lookup[i].h110 = v_lookup_saved[i].h110*f;
-    modified_v_lookup[i].h111 = v_lookup_saved[i].h111*f;
-    TELL_CHATTY("%2d %5.0f %f\n", i, e, f);
-  }
-  /* end of temperature correction */
-
-  for (i = 0; i < vlook_sz; i++){
-    v = modified_v_lookup[i];
-    modified_v_lookup[i].ea =  0.5 * v.e100 -  4 * v.e110 +  4.5 * v.e111;
-    modified_v_lookup[i].eb = -2.5 * v.e100 + 16 * v.e110 - 13.5 * v.e111;
-    modified_v_lookup[i].ec =  3.0 * v.e100 - 12 * v.e110 +  9.0 * v.e111;
-    modified_v_lookup[i].ha =  0.5 * v.h100 -  4 * v.h110 +  4.5 * v.h111;
-    modified_v_lookup[i].hb = -2.5 * v.h100 + 16 * v.h110 - 13.5 * v.h111;
-    modified_v_lookup[i].hc =  3.0 * v.h100 - 12 * v.h110 +  9.0 * v.h111;
-  }
-  modified_v_lookup[0].ebp = modified_v_lookup[0].ecp = modified_v_lookup[0].hbp = modified_v_lookup[0].hcp = 0.0;
-  sumb_e = sumc_e = sumb_h = sumc_h = 0.0;
-  
-  for (i = 1; i < vlook_sz; i++){
-    v0 = modified_v_lookup[i-1];
-    v = modified_v_lookup[i];
-    sumb_e += (v.e - v0.e)*(v0.eb+v.eb)/2;
-    sumc_e += (v.e - v0.e)*(v0.ec+v.ec)/2;
-    sumb_h += (v.e - v0.e)*(v0.hb+v.hb)/2;
-    sumc_h += (v.e - v0.e)*(v0.hc+v.hc)/2;
-    modified_v_lookup[i].ebp = sumb_e/v.e;
-    modified_v_lookup[i].ecp = sumc_e/v.e;
-    modified_v_lookup[i].hbp = sumb_h/v.e;
-    modified_v_lookup[i].hcp = sumc_h/v.e;
-  }
-  return 0;
-
-}
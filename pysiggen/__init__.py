@@ -2,7 +2,13 @@
 
 __version__ = "0.7.11"
 
-__all__ = ["Detector", "Siggen"]
+__all__ = ["Detector", "Siggen", "SignalLibrary", "build_signal_library",
+           "WaveformSurrogate", "build_surrogate", "read_hits", "event_signals",
+           "write_event_signals", "WaveformWriter", "WaveformReader"]
 
 from .detector_model import Detector
 from ._pysiggen import Siggen
+from .signal_library import SignalLibrary, build_signal_library
+from .surrogate import WaveformSurrogate, build_surrogate
+from .mc_events import read_hits, event_signals, write_event_signals
+from .waveform_store import WaveformWriter, WaveformReader
@@ -4,10 +4,11 @@ from cpython.mem cimport PyMem_Malloc, PyMem_Realloc, PyMem_Free
 
 from libc.stdlib cimport malloc, free
 from libc.math cimport fmod, floor, lrint
-from libc.string cimport strcpy, memset
+from libc.string cimport strcpy, memset, memcpy
 
 import numpy as np
 import cython
+from collections import OrderedDict
 cimport numpy as np
 cimport csiggen
 
@@ -15,8 +16,18 @@ from numpy import float32
 from numpy cimport float32_t
 
 cdef extern from "siggen_helpers.c":
-    int read_velocity_table(csiggen.velocity_lookup* v_lookup, csiggen.MJD_Siggen_Setup *setup)
-    int temperature_modify_velocity_table(float e_temp, float h_temp, csiggen.velocity_lookup* v_lookup_saved,  csiggen.velocity_lookup* modified_v_lookup, csiggen.MJD_Siggen_Setup *setup)
+    int read_velocity_table(csiggen.velocity_lookup** v_lookup, csiggen.MJD_Siggen_Setup *setup)
+
+#parameters of Siggen.MakeSignalSens, in the order of the SENS_* constants in mjd_siggen.h
+SENS_PARAMS = ("x", "y", "z", "avg_imp", "imp_grad", "h_100_mu0", "h_100_beta", "h_100_e0",
+               "h_111_mu0", "h_111_beta", "h_111_e0", "trap_constant")
+
+#Siggen.GetSnapshot layout: magic, uint32 (SNAPSHOT_VERSION, setup_layout_key(), size of the setup
+#structure, v_lookup_len, floats in v_table, floats in h_table), then the setup structure, v_params,
+#the velocity table as read and corrected for the temperature, v_table and h_table; only valid for a
+#build of the extension with the same layout key. Bump SNAPSHOT_VERSION when this layout changes.
+SNAPSHOT_MAGIC = b"SGSNAP01"
+SNAPSHOT_VERSION = 2
 
 cdef class Siggen:
 
@@ -28,11 +39,31 @@ cdef class Siggen:
   cdef float* sum
   cdef float* tmp
 
+  #graded field grid coordinates, kept alive while siggen points to them
+  cdef object fRGrid
+  cdef object fZGrid
+  cdef object fField3
+  cdef object fWpotExtra
+
+  #signal cache (see EnableCache); every setter bumps fGeneration, which empties it
+  cdef unsigned long fGeneration
+  cdef unsigned long fCacheGeneration
+  cdef object fCache
+  cdef int fCacheSize
+  cdef double fCacheQuantum
+  cdef long fCacheHits
+  cdef long fCacheMisses
+
 
 #  cdef csiggen.point* pDpath_e
 #  cdef csiggen.point* pDpath_h
 
-  def __init__(self, conffilename="", timeStepLength=-1., numTimeSteps=-1, savedConfig=None):
+  def __init__(self, conffilename="", timeStepLength=-1., numTimeSteps=-1, savedConfig=None, snapshot=None):
+
+    if snapshot is not None:
+      #everything as it was when GetSnapshot was called, without reading any files
+      self.c_restore_snapshot(snapshot)
+      return
 
     if savedConfig is not None:
       self.SetConfiguration(savedConfig)
@@ -62,6 +93,9 @@ cdef class Siggen:
 #        self.set_calc_time_step_length(timeStepLength)
         self.set_time_step_number(numTimeSteps)
 
+    #the uniform field grid, with a generation of its own for the field lookup caches
+    csiggen.set_field_grid(NULL, 0, NULL, 0, &self.fSiggenData)
+
     self.fSiggenData.dpath_e = <csiggen.point *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(csiggen.point));
     self.fSiggenData.dpath_h = <csiggen.point *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(csiggen.point));
 
@@ -85,14 +119,21 @@ cdef class Siggen:
       PyMem_Free(self.fSiggenData.dpath_h)
     if self.fSiggenData.v_params is not NULL:
       PyMem_Free(self.fSiggenData.v_params)
+    PyMem_Free(self.fSiggenData.dpath_rec_e)
+    PyMem_Free(self.fSiggenData.dpath_rec_h)
     if self.fVelocityFileData is not NULL:
-      PyMem_Free(self.fVelocityFileData)
+      free(self.fVelocityFileData)
     if self.fVelocityTempData is not NULL:
       PyMem_Free(self.fVelocityTempData)
     if self.sum is not NULL:
       PyMem_Free(self.sum)
     if self.tmp is not NULL:
       PyMem_Free(self.tmp)
+    free(self.fSiggenData.v_table)
+    free(self.fSiggenData.h_table)
+    free(self.fSiggenData.geom_sd)
+    free(self.fSiggenData.sig_work)
+    csiggen.set_field_grid(NULL, 0, NULL, 0, &self.fSiggenData)
 
 
   # cdef reinit_from_saved_state(self):
@@ -122,8 +163,46 @@ cdef class Siggen:
     return csiggen.get_signal( pt, signal, &self.fSiggenData)
 
   def GetSignal(self, float x, float y, float z, np.ndarray[float, ndim=1, mode="c"] input not None):
+    if self.fCache is not None:
+      return self.c_cached_signal(x, y, z, input, 0., False)
     return self.c_get_signal(x,y,z, &input[0])
 
+  def GetSignals(self, float x, float y, float z, np.ndarray[float, ndim=2, mode="c"] input not None):
+    #signals on the point contact (row 0) and on each electrode set with SetExtraWpots (rows 1..K), from one drift
+    cdef csiggen.point pt
+    if input.shape[0] != 1 + self.fSiggenData.num_wpot_extra or input.shape[1] != self.fSiggenData.ntsteps_out:
+      raise ValueError("Signal array must have shape ({0}, {1})".format(1 + self.fSiggenData.num_wpot_extra, self.fSiggenData.ntsteps_out))
+    pt.x = x
+    pt.y = y
+    pt.z = z
+    return csiggen.get_signals(pt, &input[0,0], &self.fSiggenData)
+
+  def GetEventSignals(self, event_id, x, y, z, energy, float cluster_size=0., int nthreads=1):
+    #summed signals of multi-site events, from their hits (event_id[i], x[i], y[i], z[i], energy[i]);
+    #each signal as from GetSignal, scaled by the hit energy. Hits of an event closer than cluster_size (mm)
+    #are merged first. The events are calculated in nthreads threads (in one on Windows, see mjd_siggen.h).
+    #returns (event ids, signals[number of events, output length], number of failed hits of each event)
+    cdef np.ndarray[float, ndim=2, mode="c"] pos, sig
+    cdef np.ndarray[float, ndim=1, mode="c"] en
+    cdef np.ndarray[int, ndim=1, mode="c"] first, nfailed
+    cdef int nevents, ret
+    ids, inv = np.unique(np.asarray(event_id), return_inverse=True)
+    order = np.argsort(inv, kind="mergesort")
+    pos = np.ascontiguousarray(np.column_stack((x, y, z))[order], dtype=np.float32)
+    en = np.ascontiguousarray(np.asarray(energy)[order], dtype=np.float32)
+    first = np.searchsorted(inv[order], np.arange(len(ids) + 1)).astype(np.intc)
+    nevents = len(ids)
+    sig = np.zeros((nevents, self.fSiggenData.ntsteps_out), dtype=np.float32)
+    nfailed = np.zeros(nevents, dtype=np.intc)
+    if nevents == 0:
+      return ids, sig, nfailed
+    with nogil:
+      ret = csiggen.get_event_signals(<csiggen.point *> &pos[0,0], &en[0], &first[0], nevents, cluster_size,
+                                      &sig[0,0], &nfailed[0], nthreads, &self.fSiggenData)
+    if ret != 0:
+      raise MemoryError()
+    return ids, sig, nfailed
+
   @cython.boundscheck(False)
   @cython.wraparound(False)
   cdef c_make_signal(self, float x, float y, float z, float* signal, float charge):
@@ -143,20 +222,154 @@ cdef class Siggen:
 
 
   def MakeSignal(self, float x, float y, float z, np.ndarray[float, ndim=1, mode="c"] input not None, float charge):
+    if self.fCache is not None:
+      return self.c_cached_signal(x, y, z, input, charge, True)
     return  self.c_make_signal(x,y,z, &input[0], charge)
 
-  def GetLastDriftPath(self, charge):
+  cdef c_cached_signal(self, float x, float y, float z, np.ndarray[float, ndim=1, mode="c"] input, float charge, bint make):
+    #LRU lookup of GetSignal (make False) or MakeSignal results, keyed on the point rounded to fCacheQuantum
+    #each entry holds the signal calculated into a zeroed array and the last-drift values read after it
+    #(initial_wpot, initial_vel, final_vel, final_charge_size, dv_dE, v_over_E, drift_steps); the signal is copied into input (GetSignal) or added to it (MakeSignal)
+    cdef np.ndarray[float, ndim=1, mode="c"] sig
+    if self.fSiggenData.path_step > 0:
+      #drift paths are not kept in the cache
+      if make:
+        return self.c_make_signal(x,y,z, &input[0], charge)
+      return self.c_get_signal(x,y,z, &input[0])
+
+    if self.fCacheGeneration != self.fGeneration:
+      self.fCache.clear()
+      self.fCacheGeneration = self.fGeneration
+
+    key = (lrint(x/self.fCacheQuantum), lrint(y/self.fCacheQuantum), lrint(z/self.fCacheQuantum), charge, make, input.shape[0])
+    entry = self.fCache.pop(key, None)
+    if entry is not None:
+      self.fCacheHits += 1
+      flag, sig, last = entry
+      (self.fSiggenData.initial_wpot, self.fSiggenData.initial_vel, self.fSiggenData.final_vel,
+       self.fSiggenData.final_charge_size, self.fSiggenData.dv_dE, self.fSiggenData.v_over_E,
+       self.fSiggenData.drift_steps) = last
+    else:
+      self.fCacheMisses += 1
+      sig = np.zeros(input.shape[0], dtype=np.float32)
+      if make:
+        flag = self.c_make_signal(x,y,z, &sig[0], charge)
+      else:
+        flag = self.c_get_signal(x,y,z, &sig[0])
+      last = (self.fSiggenData.initial_wpot, self.fSiggenData.initial_vel, self.fSiggenData.final_vel,
+              self.fSiggenData.final_charge_size, self.fSiggenData.dv_dE, self.fSiggenData.v_over_E,
+              self.fSiggenData.drift_steps)
+      if len(self.fCache) >= self.fCacheSize:
+        self.fCache.popitem(last=False)
+    self.fCache[key] = (flag, sig, last)
+
+    if make:
+      input += sig
+    elif flag != -1:
+      #get_signal leaves the array alone for points outside the detector
+      input[:] = sig
+    return flag
+
+  def EnableCache(self, max_entries=1024, quantum=1E-4):
+    #keep the last max_entries results of GetSignal/MakeSignal (one float array each), for points equal to
+    #within quantum (mm); any setter empties the cache, but changes made directly to arrays passed to
+    #SetActiveEfld etc. do not, so call ClearCache after those. max_entries = 0 turns the cache off
+    #a cache hit restores get_initial_wpot and the other last-drift values of the setup (initial and final
+    #velocity, final charge size, dv_dE, v_over_E, drift steps), but not the drift paths, so the
+    #cache is bypassed while SetDriftPathRecording is on. MakeSignal adds the cached signal to its array
+    if max_entries <= 0:
+      self.fCache = None
+      return
+    self.fCache = OrderedDict()
+    self.fCacheSize = max_entries
+    self.fCacheQuantum = quantum
+    self.fCacheGeneration = self.fGeneration
+    self.fCacheHits = 0
+    self.fCacheMisses = 0
+
+  def ClearCache(self):
+    self.fGeneration += 1
+
+  def GetCacheStats(self):
+    #(hits, misses, hit rate, entries) since EnableCache
+    if self.fCache is None:
+      return (0, 0, 0., 0)
+    calls = self.fCacheHits + self.fCacheMisses
+    return (self.fCacheHits, self.fCacheMisses, self.fCacheHits/float(calls) if calls > 0 else 0., len(self.fCache))
+
+  def GetGeneration(self):
+    #number of setter calls so far; equal values mean no setter was called in between
+    return self.fGeneration
+
+  def MakeSignalSens(self, float x, float y, float z, np.ndarray[float, ndim=1, mode="c"] input not None,
+                     np.ndarray[float, ndim=2, mode="c"] dsignal not None, float charge):
+    #MakeSignal, and its derivatives with respect to the parameters in SENS_PARAMS, in the rows of dsignal
+    #(shape (len(SENS_PARAMS), calculation length)); (r,z) fields only, not cached
     cdef csiggen.point pt
+    cdef int n = self.fSiggenData.time_steps_calc
+    if input.shape[0] != n or dsignal.shape[0] != len(SENS_PARAMS) or dsignal.shape[1] != n:
+      raise ValueError("Signal arrays must have shapes ({0},) and ({1}, {0})".format(n, len(SENS_PARAMS)))
+    pt.x = x
+    pt.y = y
+    pt.z = z
+    flag = csiggen.make_signal_sens(pt, &input[0], &dsignal[0,0], charge, &self.fSiggenData)
+    np.cumsum(input, out=input)
+    np.cumsum(dsignal, axis=1, out=dsignal)
+    return flag
 
-    pos = np.zeros((self.fSiggenData.time_steps_calc, 3))
-    for i in range(self.fSiggenData.time_steps_calc):
-      if charge == 1:
-        pt = self.fSiggenData.dpath_h[i]
-      elif charge == -1:
-        pt = self.fSiggenData.dpath_e[i]
-      pos[i,:] = (pt.x, pt.y,pt.z)
+  def MakeSignalJacobian(self, float x, float y, float z, params, deltas, float charge):
+    #MakeSignal and its forward-difference derivatives with respect to params (names from SENS_PARAMS),
+    #with steps deltas, from one call that drifts all 1 + len(params) charges in lockstep
+    #returns (signal, jacobian[len(params), calculation length]), or None if any drift fails
+    cdef csiggen.point pt
+    cdef np.ndarray[int, ndim=1, mode="c"] par = np.array([SENS_PARAMS.index(p) for p in params], dtype=np.intc)
+    cdef np.ndarray[float, ndim=1, mode="c"] delta = np.ascontiguousarray(deltas, dtype=np.float32)
+    cdef np.ndarray[float, ndim=2, mode="c"] sig
+    if len(par) == 0 or len(par) != len(delta) or np.any(delta == 0):
+      raise ValueError("Need one nonzero delta for each parameter")
+    sig = np.zeros((1 + len(par), self.fSiggenData.time_steps_calc), dtype=np.float32)
+    pt.x = x
+    pt.y = y
+    pt.z = z
+    if csiggen.make_signal_fd(pt, &sig[0,0], len(par), &par[0], &delta[0], charge, &self.fSiggenData) != 0:
+      return None
+    np.cumsum(sig, axis=1, out=sig)
+    return sig[0], (sig[1:] - sig[0])/delta[:,None]
+
+  def SetDriftPathRecording(self, step=1, records=False):
+    #record every step-th point of the drift paths in the following signal calculations, for GetLastDriftPath,
+    #and with records also (t, r, z, |v|, wp) at each point, for GetLastDriftRecords; step = 0 (the default)
+    #records nothing, and costs nothing
+    PyMem_Free(self.fSiggenData.dpath_rec_e)
+    PyMem_Free(self.fSiggenData.dpath_rec_h)
+    self.fSiggenData.dpath_rec_e = self.fSiggenData.dpath_rec_h = NULL
+    self.fSiggenData.path_len_e = self.fSiggenData.path_len_h = 0
+    self.fSiggenData.path_step = max(step, 0)
+    if step > 0 and records:
+      self.fSiggenData.dpath_rec_e = <csiggen.path_record *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(csiggen.path_record))
+      self.fSiggenData.dpath_rec_h = <csiggen.path_record *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(csiggen.path_record))
+      if self.fSiggenData.dpath_rec_e is NULL or self.fSiggenData.dpath_rec_h is NULL:
+        raise MemoryError()
 
-    return pos
+  def GetLastDriftPath(self, charge):
+    #(x, y, z) of the recorded points of the hole (charge 1) or electron (charge -1) drift path of the
+    #last calculation, one row per point; empty unless turned on with SetDriftPathRecording
+    cdef csiggen.point *path = self.fSiggenData.dpath_h if charge == 1 else self.fSiggenData.dpath_e
+    cdef int n = self.fSiggenData.path_len_h if charge == 1 else self.fSiggenData.path_len_e
+    if n == 0:
+      return np.zeros((0, 3))
+    return np.array(<float[:n, :3]> <float *> path, dtype=np.float64)
+
+  def GetLastDriftRecords(self, charge):
+    #(t, r, z, |v|, wp) at the points of GetLastDriftPath, one row per point, or None if not turned on with
+    #SetDriftPathRecording(records=True); wp is -1 outside the field grid
+    cdef csiggen.path_record *rec = self.fSiggenData.dpath_rec_h if charge == 1 else self.fSiggenData.dpath_rec_e
+    cdef int n = self.fSiggenData.path_len_h if charge == 1 else self.fSiggenData.path_len_e
+    if rec is NULL:
+      return None
+    if n == 0:
+      return np.zeros((0, 5), dtype=np.float32)
+    return np.array(<float[:n, :5]> <float *> rec)
 
   def ChargeCloudCorrect(self, np.ndarray[float, ndim=1, mode="c"] input not None, charge_cloud_size):
     self.c_charge_cloud_correction(&input[0], charge_cloud_size)
@@ -203,26 +416,34 @@ cdef class Siggen:
     return self.fSiggenData.ntsteps_out
   def GetCalculationTimeStep(self):
       return self.fSiggenData.step_time_calc
+  def GetOutputTimeStep(self):
+      return self.fSiggenData.step_time_out
 
   cpdef set_time_step_length(self, float timeStepLength):
+    self.fGeneration += 1
     if timeStepLength < self.fSiggenData.step_time_calc:
       # print "Also reducing time step calc to %f" % timeStepLength
       self.fSiggenData.step_time_calc = timeStepLength;
     self.fSiggenData.step_time_out = timeStepLength
 
   cpdef set_calc_time_step_length(self, float timeStepOutLength):
+      self.fGeneration += 1
       self.fSiggenData.step_time_calc = timeStepOutLength;
 
   cpdef set_time_step_number(self, int waveformLength):
+    self.fGeneration += 1
     self.fSiggenData.ntsteps_out = waveformLength;
     self.fSiggenData.time_steps_calc = waveformLength * np.int(self.fSiggenData.step_time_out/self.fSiggenData.step_time_calc);
 
   cpdef set_velocity_type(self, int veloType):
+      self.fGeneration += 1
       self.fSiggenData.velocity_type = veloType;
 
   cpdef set_trap_constant(self, double trap_constant):
+      self.fGeneration += 1
       self.fSiggenData.trap_constant = trap_constant;
   cpdef set_release_constant(self, double release_constant):
+      self.fGeneration += 1
       self.fSiggenData.release_constant = release_constant;
   cpdef get_release_constant(self):
     return self.fSiggenData.release_constant
@@ -232,51 +453,26 @@ cdef class Siggen:
   cpdef set_hole_params(self, h_100_mu0, h_100_beta, h_100_e0, h_111_mu0, h_111_beta, h_111_e0):
 #      print "setting hole params"
 #      print "velo type is %d" % self.fSiggenData.velocity_type
+      self.fGeneration += 1
       csiggen.set_hole_params(h_100_mu0, h_100_beta, h_100_e0, h_111_mu0, h_111_beta, h_111_e0, &self.fSiggenData)
 
   cpdef set_k0_params(self, k0_0, k0_1, k0_2, k0_3):
+      self.fGeneration += 1
       csiggen.set_k0_params(k0_0, k0_1, k0_2, k0_3, &self.fSiggenData)
 
   cdef c_read_velocity_table(self):
     #read in the drift velocity table
     if self.fVelocityFileData is NULL:
       self.fVelocityFileData = <csiggen.velocity_lookup* > malloc(21*sizeof(csiggen.velocity_lookup))
-    read_velocity_table(self.fVelocityFileData, &self.fSiggenData)
+    read_velocity_table(&self.fVelocityFileData, &self.fSiggenData)
 
-    #and copy the current version of it to an unsaved array w/ a hard copy
-    if self.fVelocityTempData is NULL:
-#      print "about to malloc the velocity adjustment with length %d" % self.fSiggenData.v_lookup_len
-      self.fVelocityTempData = <csiggen.velocity_lookup* > PyMem_Malloc(self.fSiggenData.v_lookup_len*sizeof(csiggen.velocity_lookup))
-#    else:
-#      print "about to realloc the velocity adjustment with length %d" % self.fSiggenData.v_lookup_len
-#      self.fVelocityTempData = <csiggen.velocity_lookup* > PyMem_Realloc(self.fVelocityTempData, self.fSiggenData.v_lookup_len*sizeof(self.fVelocityTempData))
-
-#    print "about to copy the velocity adjustment table with length %d" % self.fSiggenData.v_lookup_len
-    for i in range(self.fSiggenData.v_lookup_len):
-#      print "copying index %d..." % i
-#      print self.fVelocityFileData[i].e
-
-      self.fVelocityTempData[i].e =     self.fVelocityFileData[i].e
-      self.fVelocityTempData[i].e100 =  self.fVelocityFileData[i].e100
-      self.fVelocityTempData[i].e110 =  self.fVelocityFileData[i].e110
-      self.fVelocityTempData[i].e111 =  self.fVelocityFileData[i].e111
-      self.fVelocityTempData[i].h100 =  self.fVelocityFileData[i].h100
-      self.fVelocityTempData[i].h110 =  self.fVelocityFileData[i].h110
-      self.fVelocityTempData[i].h111 =  self.fVelocityFileData[i].h111
-      self.fVelocityTempData[i].ea =    self.fVelocityFileData[i].ea
-      self.fVelocityTempData[i].eb =    self.fVelocityFileData[i].eb
-      self.fVelocityTempData[i].ec =    self.fVelocityFileData[i].ec
-      self.fVelocityTempData[i].ebp =   self.fVelocityFileData[i].ebp
-      self.fVelocityTempData[i].ecp =   self.fVelocityFileData[i].ecp
-      self.fVelocityTempData[i].ha =    self.fVelocityFileData[i].ha
-      self.fVelocityTempData[i].hb =    self.fVelocityFileData[i].hb
-      self.fVelocityTempData[i].hc =    self.fVelocityFileData[i].hc
-      self.fVelocityTempData[i].hbp =   self.fVelocityFileData[i].hbp
-      self.fVelocityTempData[i].hcp =   self.fVelocityFileData[i].hcp
-      self.fVelocityTempData[i].hcorr = self.fVelocityFileData[i].hcorr
-      self.fVelocityTempData[i].ecorr = self.fVelocityFileData[i].ecorr
+    #and keep it, to be corrected for the temperature (in SetTemperature) into a separate array
+    self.fVelocityTempData = <csiggen.velocity_lookup* > PyMem_Realloc(self.fVelocityTempData, self.fSiggenData.v_lookup_len*sizeof(csiggen.velocity_lookup))
+    self.fSiggenData.v_lookup_raw = self.fVelocityFileData
+    self.fSiggenData.v_lookup = self.fVelocityTempData
 
   cpdef ReadVelocityTable(self):
+    self.fGeneration += 1
     self.c_read_velocity_table()
 
   def ReadCorrectedVelocity(self):
@@ -306,17 +502,20 @@ cdef class Siggen:
       # print self.fVelocityTempData[i].ecorr
 
   def SetTemperature(self, h_temp, e_temp=0):
+    self.fGeneration += 1
     self.fSiggenData.xtal_temp = h_temp
     if e_temp == 0:
       e_temp = h_temp
-    temperature_modify_velocity_table(e_temp, h_temp, self.fVelocityFileData, self.fVelocityTempData, &self.fSiggenData)
-    self.fSiggenData.v_lookup = self.fVelocityTempData
+    #in memory, from the table read by ReadVelocityTable
+    csiggen.set_velocity_temps(e_temp, h_temp, &self.fSiggenData)
 
   def SetPointContact(self, pcRad, pcLen):
+    self.fGeneration += 1
     self.fSiggenData.pc_radius = pcRad
     self.fSiggenData.pc_length = pcLen
 
   def SetPointContactParams(self, pcrad_step, pcrad_min, pclen_step, pclen_min, num_pcrad, num_pclen):
+    self.fGeneration += 1
 
     self.fSiggenData.pcrad_step = pcrad_step
     self.fSiggenData.pclen_step = pclen_step
@@ -328,6 +527,7 @@ cdef class Siggen:
     self.fSiggenData.num_pclen = num_pclen
 
   def SetGradParams(self, imp_grad_step, imp_grad_min, avg_imp_step, avg_imp_min, num_grads, num_imps):
+    self.fGeneration += 1
     self.fSiggenData.imp_grad_step = imp_grad_step
     self.fSiggenData.min_imp_grad = imp_grad_min
 
@@ -338,6 +538,7 @@ cdef class Siggen:
     self.fSiggenData.num_imps = num_imps
 
   def SetGrads(self, imp_grad, avg_imp):
+    self.fGeneration += 1
     self.fSiggenData.imp_grad = imp_grad
     self.fSiggenData.avg_imp = avg_imp
 
@@ -345,16 +546,79 @@ cdef class Siggen:
     # for  (i) in range(self.fSiggenData.rlen):
     #   self.pWpot[i] = &input[0,0]
     # self.fSiggenData.wpot = self.pWpot
+    self.fGeneration += 1
     self.fSiggenData.efld_r = &arr_r[0,0,0,0,0,0]
     # self.fSiggenData.efld_r = &self.efld_r_ptr
 
     self.fSiggenData.efld_z = &arr_z[0,0,0,0,0,0]
     # self.fSiggenData.efld_z = &self.efld_z_ptr
 
+  def SetFieldGrid(self, r_grid=None, z_grid=None):
+    #graded grid coordinates (in mm) of the efld and wpot arrays; None to go back to the uniform xtal_grid
+    self.fGeneration += 1
+    cdef np.ndarray[float, ndim=1, mode="c"] r_arr
+    cdef np.ndarray[float, ndim=1, mode="c"] z_arr
+
+    if r_grid is None or z_grid is None:
+      csiggen.set_field_grid(NULL, 0, NULL, 0, &self.fSiggenData)
+      self.fRGrid = None
+      self.fZGrid = None
+      self.fSiggenData.rlen =   lrint((self.fSiggenData.rmax - self.fSiggenData.rmin)/self.fSiggenData.rstep) + 1;
+      self.fSiggenData.zlen =  lrint((self.fSiggenData.zmax - self.fSiggenData.zmin)/self.fSiggenData.zstep) + 1;
+      return
+
+    r_arr = np.ascontiguousarray(r_grid, dtype=np.float32)
+    z_arr = np.ascontiguousarray(z_grid, dtype=np.float32)
+    if csiggen.set_field_grid(&r_arr[0], len(r_arr), &z_arr[0], len(z_arr), &self.fSiggenData) != 0:
+      raise ValueError("Graded field grid coordinates must be increasing")
+    self.fRGrid = r_arr
+    self.fZGrid = z_arr
+
+  def SetField3D(self, field3=None, xmin=0., ymin=0., zmin=0., step=1., fold=0):
+    #3-D grid of (E_x, E_y, E_z, WP) with shape (nx, ny, nz, 4), first point at (xmin, ymin, zmin) and grid size step (in mm)
+    #fold is FOLD_X | FOLD_Y | FOLD_Z (1, 2, 4) for axes mirrored about zero; None to go back to the (r,z) fields
+    self.fGeneration += 1
+    cdef np.ndarray[float, ndim=4, mode="c"] arr
+
+    if field3 is None:
+      csiggen.set_field_3d(NULL, 0, 0, 0, 0., 0., 0., 0., 0, &self.fSiggenData)
+      self.fField3 = None
+      return
+
+    arr = np.ascontiguousarray(field3, dtype=np.float32)
+    if arr.shape[3] != 4 or csiggen.set_field_3d(&arr[0,0,0,0], arr.shape[0], arr.shape[1], arr.shape[2],
+                                                 xmin, ymin, zmin, step, fold, &self.fSiggenData) != 0:
+      raise ValueError("Invalid 3-D field grid")
+    self.fField3 = arr
+
+  def SetExtraWpots(self, wpots=None):
+    #weighting potentials of K other electrodes, with shape (rlen, zlen, K) for the (r,z) grid,
+    #or (nx, ny, nz, K) for the grid set by SetField3D; None to remove them
+    self.fGeneration += 1
+    cdef np.ndarray[float, ndim=1, mode="c"] arr
+
+    if wpots is None:
+      csiggen.set_wpot_extra(NULL, 0, &self.fSiggenData)
+      self.fWpotExtra = None
+      return
+
+    wpots = np.asarray(wpots)
+    if self.fSiggenData.field3 is not NULL:
+      grid_shape = (self.fSiggenData.xlen3, self.fSiggenData.ylen3, self.fSiggenData.zlen3)
+    else:
+      grid_shape = (self.fSiggenData.rlen, self.fSiggenData.zlen)
+    if wpots.shape[:-1] != grid_shape:
+      raise ValueError("Extra weighting potentials must have shape {0} + (K,)".format(grid_shape))
+    arr = np.ascontiguousarray(wpots, dtype=np.float32).ravel()
+    if csiggen.set_wpot_extra(&arr[0], wpots.shape[-1], &self.fSiggenData) != 0:
+      raise ValueError("Too many extra weighting potentials")
+    self.fWpotExtra = arr
+
   def SetActiveWpot(self, np.ndarray[float, ndim=4, mode="c"] input not None):
     # for  (i) in range(self.fSiggenData.rlen):
     # self.pWpot[i] = &input[i,0]
     # self.wp_ptr = &input[0,0]
+    self.fGeneration += 1
     self.fSiggenData.wpot = &input[0,0,0,0]
 
 
@@ -364,6 +628,7 @@ cdef class Siggen:
 
   def TestEField(self, imp_grad, avg_imp):
     # for  (i) in range(self.fSiggenData.rlen):
+    self.fGeneration += 1
     self.fSiggenData.imp_grad = imp_grad
     self.fSiggenData.avg_imp = avg_imp
 
@@ -405,6 +670,71 @@ cdef class Siggen:
     return self.fSiggenData.taper_length
   def GetTopBulletRadius(self):
     return self.fSiggenData.top_bullet_radius
+  def GetHoleDimensions(self):
+    return ( self.fSiggenData.hole_length, self.fSiggenData.hole_radius)
+
+  def IsInDetector(self, float r, float phi, float z):
+    #the geometry of detector_geometry.c, as used for the drift
+    cdef csiggen.point pt
+    pt.x = r*np.cos(phi)
+    pt.y = r*np.sin(phi)
+    pt.z = z
+    return not csiggen.outside_detector(pt, &self.fSiggenData)
+
+  def IsInDetectorArray(self, r, phi, z):
+    #IsInDetector for arrays of points; returns a boolean array of the broadcast shape of r, phi and z
+    cdef np.ndarray[float, ndim=1, mode="c"] ra, pa, za
+    cdef np.ndarray[np.uint8_t, ndim=1, mode="c"] mask
+    r, phi, z = np.broadcast_arrays(r, phi, z)
+    ra = np.ascontiguousarray(r, dtype=np.float32).ravel()
+    pa = np.ascontiguousarray(phi, dtype=np.float32).ravel()
+    za = np.ascontiguousarray(z, dtype=np.float32).ravel()
+    mask = np.empty(len(ra), dtype=np.uint8)
+    if len(ra) > 0:
+      csiggen.inside_detector_mask(&ra[0], &pa[0], &za[0], len(ra), &mask[0], &self.fSiggenData)
+    return mask.view(np.bool_).reshape(r.shape)
+
+  def SamplePoints(self, int n, phi_min=0., phi_max=2*np.pi, density=None, rng=None):
+    #(r, phi, z) arrays of n points drawn uniformly inside the detector, with phi_min <= phi < phi_max,
+    #or in proportion to density: an (nr, nz) array of the relative energy deposited in the cells of a
+    #uniform grid over 0 <= r <= rmax, 0 <= z <= zmax, and uniformly within each cell
+    #rng is a numpy RandomState or Generator (default: the numpy.random module)
+    cdef float rmax = self.fSiggenData.rmax, zmax = self.fSiggenData.zmax
+    cdef int have = 0, m, tries = 0
+    if rng is None:
+      rng = np.random
+    if density is not None:
+      density = np.asarray(density, dtype=np.float64)
+      if density.ndim != 2 or np.any(density < 0) or not density.sum() > 0:
+        raise ValueError("density must be a 2-D array of non-negative weights, not all zero")
+      nr, nz = density.shape
+      p = (density/density.sum()).ravel()
+    r_out = np.empty(n, dtype=np.float32)
+    phi_out = np.empty(n, dtype=np.float32)
+    z_out = np.empty(n, dtype=np.float32)
+    accept = 1.
+    while have < n:
+      m = int((n - have)/accept*1.1) + 64
+      if density is None:
+        r = rmax*np.sqrt(rng.uniform(0., 1., m))
+        z = rng.uniform(0., zmax, m)
+      else:
+        cell = rng.choice(len(p), m, p=p)
+        r0 = (cell // nz)*(rmax/nr)
+        r = np.sqrt(r0**2 + rng.uniform(0., 1., m)*((r0 + rmax/nr)**2 - r0**2))
+        z = ((cell % nz) + rng.uniform(0., 1., m))*(zmax/nz)
+      phi = rng.uniform(phi_min, phi_max, m)
+      inside = self.IsInDetectorArray(r, phi, z)
+      k = min(int(inside.sum()), n - have)
+      r_out[have:have+k] = r[inside][:k]
+      phi_out[have:have+k] = phi[inside][:k]
+      z_out[have:have+k] = z[inside][:k]
+      have += k
+      tries += m
+      if have == 0 and tries > 100000:
+        raise ValueError("No sampled points are inside the detector")
+      accept = max(have/float(tries), 1e-3)
+    return r_out, phi_out, z_out
 
   def FindDriftVelocity(self, float x, float y, float z):
     self.c_find_drift_velocity( x, y, z)
@@ -439,7 +769,11 @@ cdef class Siggen:
     siggenConfig["wrap_around_radius"]  = self.fSiggenData.wrap_around_radius;   # wrap-around radius for BEGes. Set to zero for ORTEC
     siggenConfig["ditch_depth"]  = self.fSiggenData.ditch_depth;          # depth of ditch next to wrap-around for BEGes. Set to zero for ORTEC
     siggenConfig["ditch_thickness"]  = self.fSiggenData.ditch_thickness;      # width of ditch next to wrap-around for BEGes. Set to zero for ORTEC
+    siggenConfig["hole_length"]  = self.fSiggenData.hole_length;          # depth of the central well from the top of an ICPC; zero for none
+    siggenConfig["hole_radius"]  = self.fSiggenData.hole_radius;          # radius of the central well
     siggenConfig["Li_thickness"]  = self.fSiggenData.Li_thickness;         # depth of full-charge-collection boundary for Li contact
+    siggenConfig["pc_x_offset"]  = self.fSiggenData.pc_x_offset;          # x position of the point contact centre, for 3-D fields only
+    siggenConfig["pc_y_offset"]  = self.fSiggenData.pc_y_offset;          # y position of the point contact centre, for 3-D fields only
 
     # electric fields & weighing potentials
     siggenConfig["xtal_grid"]  = self.fSiggenData.xtal_grid;            # grid size in mm for field files (either 0.5 or 0.1 mm)
@@ -456,7 +790,7 @@ cdef class Siggen:
     siggenConfig["write_WP"]  = self.fSiggenData.write_WP;             # set to 1 to calculate WP and write it to output file, 0 otherwise
     siggenConfig["bulletize_PC"]  = self.fSiggenData.bulletize_PC;         # set to 1 for inside of point contact hemispherical, 0 for cylindrical
 
-    siggenConfig["drift_name"] = str(self.fSiggenData.drift_name);
+    siggenConfig["drift_name"] = self.fSiggenData.drift_name.decode("utf-8");
 
     # signal calculation
     siggenConfig["xtal_temp"]  = self.fSiggenData.xtal_temp;            # crystal temperature in Kelvin
@@ -493,7 +827,101 @@ cdef class Siggen:
 
     return siggenConfig;
 
+  def GetSnapshot(self):
+    #the whole setup, with the drift velocity tables, as bytes for Siggen(snapshot=...); quicker to
+    #restore than GetSafeConfiguration, which re-reads the velocity table. The fields (SetActiveEfld
+    #etc.) are not included. A snapshot can only be restored by the same build of pysiggen.
+    cdef int v_len, h_len
+    cdef int nv = self.fSiggenData.v_lookup_len
+    cdef np.ndarray[np.uint32_t, ndim=1] head
+    csiggen.velocity_table_sizes(&self.fSiggenData, &v_len, &h_len)
+    if self.fSiggenData.v_lookup_raw is NULL or self.fSiggenData.v_lookup is NULL:
+      nv = 0
+    head = np.array([SNAPSHOT_VERSION, csiggen.setup_layout_key(), sizeof(csiggen.MJD_Siggen_Setup),
+                     nv, v_len, h_len], dtype=np.uint32)
+    parts = [SNAPSHOT_MAGIC, head.tobytes(),
+             (<char *> &self.fSiggenData)[:sizeof(csiggen.MJD_Siggen_Setup)],
+             (<char *> self.fSiggenData.v_params)[:sizeof(csiggen.velocity_params)]]
+    if nv > 0:
+      parts.append((<char *> self.fSiggenData.v_lookup_raw)[:nv*sizeof(csiggen.velocity_lookup)])
+      parts.append((<char *> self.fSiggenData.v_lookup)[:nv*sizeof(csiggen.velocity_lookup)])
+    if v_len > 0:
+      parts.append((<char *> self.fSiggenData.v_table)[:v_len*sizeof(float)])
+    if h_len > 0:
+      parts.append((<char *> self.fSiggenData.h_table)[:h_len*sizeof(float)])
+    return b"".join(parts)
+
+  cdef c_restore_snapshot(self, bytes snapshot):
+    cdef const char *p = snapshot
+    cdef int nv, v_len, h_len, nsize
+    cdef Py_ssize_t pos
+    if snapshot[:len(SNAPSHOT_MAGIC)] != SNAPSHOT_MAGIC or len(snapshot) < len(SNAPSHOT_MAGIC) + 24:
+      raise ValueError("Not a Siggen snapshot")
+    pos = len(SNAPSHOT_MAGIC)
+    version, key, nsize, nv, v_len, h_len = np.frombuffer(snapshot, dtype=np.uint32, count=6, offset=pos)
+    pos += 24
+    if version != SNAPSHOT_VERSION:
+      raise ValueError("Snapshot format {0} is not supported by this version of pysiggen (format {1})".format(version, SNAPSHOT_VERSION))
+    if (key != csiggen.setup_layout_key() or nsize != sizeof(csiggen.MJD_Siggen_Setup) or
+        len(snapshot) != pos + nsize + sizeof(csiggen.velocity_params) +
+                         2*nv*sizeof(csiggen.velocity_lookup) + (v_len + h_len)*sizeof(float)):
+      raise ValueError("Snapshot is from a different build of pysiggen")
+    memcpy(&self.fSiggenData, p + pos, nsize)
+    pos += nsize
+
+    #pointers of the saved setup are not valid here; the fields have to be set again
+    self.fSiggenData.r_grid = self.fSiggenData.z_grid = NULL
+    self.fSiggenData.r_grid_lookup = self.fSiggenData.z_grid_lookup = NULL
+    csiggen.set_field_grid(NULL, 0, NULL, 0, &self.fSiggenData)
+    self.fSiggenData.field3 = NULL
+    self.fSiggenData.efld_r = self.fSiggenData.efld_z = self.fSiggenData.wpot = NULL
+    self.fSiggenData.wpot_extra = NULL
+    self.fSiggenData.num_wpot_extra = 0
+    self.fSiggenData.geom_sd = NULL
+    self.fSiggenData.sig_work = NULL
+    self.fSiggenData.dpath_rec_e = self.fSiggenData.dpath_rec_h = NULL
+    self.fSiggenData.path_step = 0
+    self.fSiggenData.path_len_e = self.fSiggenData.path_len_h = 0
+    self.fSiggenData.v_lookup = self.fSiggenData.v_lookup_raw = NULL
+    self.fSiggenData.v_table = self.fSiggenData.h_table = NULL
+
+    self.fSiggenData.dpath_e = <csiggen.point *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(csiggen.point))
+    self.fSiggenData.dpath_h = <csiggen.point *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(csiggen.point))
+    self.fSiggenData.v_params = <csiggen.velocity_params *> PyMem_Malloc(sizeof(csiggen.velocity_params))
+    self.sum = <float *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(float))
+    self.tmp = <float *> PyMem_Malloc(self.fSiggenData.time_steps_calc*sizeof(float))
+    if (self.fSiggenData.dpath_e is NULL or self.fSiggenData.dpath_h is NULL or
+        self.fSiggenData.v_params is NULL or self.sum is NULL or self.tmp is NULL):
+      raise MemoryError()
+    memcpy(self.fSiggenData.v_params, p + pos, sizeof(csiggen.velocity_params))
+    pos += sizeof(csiggen.velocity_params)
+
+    if nv > 0:
+      #as from ReadVelocityTable, which allocates at least 21 rows
+      self.fVelocityFileData = <csiggen.velocity_lookup *> malloc(max(nv, 21)*sizeof(csiggen.velocity_lookup))
+      self.fVelocityTempData = <csiggen.velocity_lookup *> PyMem_Malloc(nv*sizeof(csiggen.velocity_lookup))
+      if self.fVelocityFileData is NULL or self.fVelocityTempData is NULL:
+        raise MemoryError()
+      memcpy(self.fVelocityFileData, p + pos, nv*sizeof(csiggen.velocity_lookup))
+      pos += nv*sizeof(csiggen.velocity_lookup)
+      memcpy(self.fVelocityTempData, p + pos, nv*sizeof(csiggen.velocity_lookup))
+      pos += nv*sizeof(csiggen.velocity_lookup)
+      self.fSiggenData.v_lookup_raw = self.fVelocityFileData
+      self.fSiggenData.v_lookup = self.fVelocityTempData
+    if v_len > 0:
+      self.fSiggenData.v_table = <float *> malloc(v_len*sizeof(float))
+      if self.fSiggenData.v_table is NULL:
+        raise MemoryError()
+      memcpy(self.fSiggenData.v_table, p + pos, v_len*sizeof(float))
+      pos += v_len*sizeof(float)
+    if h_len > 0:
+      self.fSiggenData.h_table = <float *> malloc(h_len*sizeof(float))
+      if self.fSiggenData.h_table is NULL:
+        raise MemoryError()
+      memcpy(self.fSiggenData.h_table, p + pos, h_len*sizeof(float))
+
   def SetConfiguration(self, siggenConfig):
+    self.fGeneration += 1
 
     self.fSiggenData.verbosity = siggenConfig["verbosity"];              # 0 = terse, 1 = normal, 2 = chatty/verbose
     self.fSiggenData.velocity_type = siggenConfig["velocity_type"];
@@ -508,7 +936,11 @@ cdef class Siggen:
     self.fSiggenData.wrap_around_radius = siggenConfig["wrap_around_radius"];   # wrap-around radius for BEGes. Set to zero for ORTEC
     self.fSiggenData.ditch_depth = siggenConfig["ditch_depth"];          # depth of ditch next to wrap-around for BEGes. Set to zero for ORTEC
     self.fSiggenData.ditch_thickness = siggenConfig["ditch_thickness"];      # width of ditch next to wrap-around for BEGes. Set to zero for ORTEC
+    self.fSiggenData.hole_length = siggenConfig.get("hole_length", 0.);    # depth of the central well from the top of an ICPC; zero for none
+    self.fSiggenData.hole_radius = siggenConfig.get("hole_radius", 0.);    # radius of the central well
     self.fSiggenData.Li_thickness = siggenConfig["Li_thickness"];         # depth of full-charge-collection boundary for Li contact
+    self.fSiggenData.pc_x_offset = siggenConfig.get("pc_x_offset", 0.);    # x position of the point contact centre, for 3-D fields only
+    self.fSiggenData.pc_y_offset = siggenConfig.get("pc_y_offset", 0.);    # y position of the point contact centre, for 3-D fields only
 
     # electric fields & weighing potentials
     self.fSiggenData.xtal_grid = siggenConfig["xtal_grid"];            # grid size in mm for field files (either 0.5 or 0.1 mm)
@@ -19,6 +19,13 @@ cdef extern from "cyl_point.h":
   ctypedef cyl_pt cyl_pt
 
 cdef extern from "mjd_siggen.h":
+  ctypedef struct path_record:
+    float t
+    float r
+    float z
+    float v
+    float wp
+
   cdef struct velocity_lookup:
     float e;
     float e100;
@@ -70,10 +77,16 @@ cdef extern from "mjd_siggen.h":
     float wrap_around_radius;   # wrap-around radius for BEGes. Set to zero for ORTEC
     float ditch_depth;          # depth of ditch next to wrap-around for BEGes. Set to zero for ORTEC
     float ditch_thickness;      # width of ditch next to wrap-around for BEGes. Set to zero for ORTEC
+    float hole_length;          # depth of the central well from the top of an ICPC; zero for none
+    float hole_radius;          # radius of the central well
     float Li_thickness;         # depth of full-charge-collection boundary for Li contact
+    float pc_x_offset;          # x position of the point contact centre, for 3-D fields only
+    float pc_y_offset;          # y position of the point contact centre, for 3-D fields only
 
     # electric fields & weighing potentials
     float xtal_grid;            # grid size in mm for field files (either 0.5 or 0.1 mm)
+    float xtal_grid_max;        # max grid size in mm for a graded grid; 0 for a uniform grid
+    float xtal_grid_grade;      # increase in graded grid size per mm of distance from PC/ditch
     float impurity_z0;          # net impurity concentration at Z=0, in 1e10 e/cm3
     float impurity_gradient;    # net impurity gradient, in 1e10 e/cm4
     float impurity_quadratic;   # net impurity difference from linear, at z=L/2, in 1e10 e/cm3
@@ -81,6 +94,7 @@ cdef extern from "mjd_siggen.h":
     float impurity_radial_add;  # additive radial impurity at outside radius, in 1e10 e/cm3
     float impurity_radial_mult; # multiplicative radial impurity at outside radius (neutral=1.0)
     float impurity_rpower;      # power for radial impurity increase with radius
+    float impurity_x_gradient;  # net impurity gradient along x, in 1e10 e/cm4, for 3-D fields only
     float xtal_HV;              # detector bias for fieldgen, in Volts
     int   max_iterations;       # maximum number of iterations to use in mjd_fieldgen
     int   write_field;          # set to 1 to write V and E to output file, 0 otherwise
@@ -110,12 +124,35 @@ cdef extern from "mjd_siggen.h":
     float rmin, rmax, rstep;
     float zmin, zmax, zstep;
     int   rlen, zlen;           # dimensions of efld and wpot arrays
+    float* r_grid;              # grid coordinates for graded grids; NULL for uniform rstep/zstep
+    float* z_grid;
+    int*  r_grid_lookup;        # grid index at or below each fine bin, for graded grids
+    int*  z_grid_lookup;
+    float r_lookup_step, z_lookup_step   # bin sizes of the graded-grid lookup tables
+    int   field_grid_gen        # generation of the (r,z) field grid, new for each grid set up
+    float* field3;              # 3-D grid of (E_x, E_y, E_z, WP) at each point; NULL for (r,z) fields
+    int   xlen3, ylen3, zlen3   # dimensions of the 3-D grid
+    float xmin3, ymin3, zmin3   # position of the first 3-D grid point, in mm
+    float step3                 # 3-D grid size, in mm
+    int   fold3                 # FOLD_X | FOLD_Y | FOLD_Z for axes on which the 3-D grid is mirrored
+    float *geom_sd              # signed distance to the detector surface on a uniform (r,z) grid, see geometry_setup()
+    int   geom_rlen, geom_zlen  # dimensions of geom_sd
+    float geom_key[16]          # geometry parameters that geom_sd was calculated for
     int   v_lookup_len;
-    velocity_lookup* v_lookup;
+    velocity_lookup* v_lookup;       # drift velocity table, corrected for the temperature
+    velocity_lookup* v_lookup_raw;   # drift velocity table as read, at REF_TEMP
+    double v_temp_par[2][4];    # (mu_0, power, B, Theta) of the temperature correction, for electrons, holes
+    int   v_table_len;          # v_lookup resampled on a uniform |E| grid, see resample_velocity_table()
+    float v_table_step;         # field step of v_table, in V/cm
+    float *v_table;             # its coefficients, as [holes, electrons][coefficient][v_table_len]
     velocity_params* v_params;
+    float *h_table;             # field-magnitude terms of the velocity_type 1 hole model, see resample_hole_params()
+    int   h_table_ok;           # set when h_table is for the current v_params; cleared while they are perturbed
     float* efld_r;
     float* efld_z;
     float* wpot;
+    float* wpot_extra;          # WPs of other electrodes, [r][z][n] or [x][y][z][n]; see set_wpot_extra()
+    int   num_wpot_extra        # number n of WPs in wpot_extra
 
     float imp_grad;
     float avg_imp;
@@ -137,6 +174,10 @@ cdef extern from "mjd_siggen.h":
     # data for calc_signal.c
     point *dpath_e
     point *dpath_h;      # electron and hole drift paths
+    int   path_step;               # record every path_step-th step in the drift paths; 0 for no paths
+    int   path_len_e, path_len_h;  # number of points recorded in the drift paths by the last calculation
+    path_record *dpath_rec_e
+    path_record *dpath_rec_h; # (t, r, z, |v|, wp) for each point of the drift paths, or NULL
     float initial_vel, final_vel;  # initial and final drift velocities for charges collected to PC
     float dv_dE;     # derivative of drift velocity with field ((mm/ns) / (V/cm))
     float v_over_E;  # ratio of drift velocity to field ((mm/ns) / (V/cm))
@@ -144,6 +185,9 @@ cdef extern from "mjd_siggen.h":
     double trap_constant; # in us
     double release_constant; # in ns
     float initial_wpot;
+    int   drift_steps;   # time steps (from 0) that the last drift_charge() added current to
+    float *sig_work;     # work arrays of get_signal() and get_signals(); NULL until first used
+    int   sig_work_tsteps, sig_work_nsig, sig_work_used;  # their size, and steps to clear
 
   int read_config(char *config_file_name, MJD_Siggen_Setup *setup);
 
@@ -154,6 +198,11 @@ cdef extern from "calc_signal.h":
   int signal_calc_init(char *config_file_name, MJD_Siggen_Setup *setup);
   int get_signal(point pt, float *signal, MJD_Siggen_Setup *setup)
   int make_signal(point pt, float *signal, float q, MJD_Siggen_Setup *setup)
+  int get_signals(point pt, float *signal, MJD_Siggen_Setup *setup)
+  int make_signals(point pt, float *signal, float q, MJD_Siggen_Setup *setup)
+  int make_signal_sens(point pt, float *signal, float *dsignal, float q, MJD_Siggen_Setup *setup)
+  int make_signal_fd(point pt, float *signal, int npert, const int *par, const float *delta,
+                     float q, MJD_Siggen_Setup *setup)
   int signal_calc_finalize(MJD_Siggen_Setup *setup);
   int rc_integrate(float *s_in, float *s_out, float tau, int time_steps);
   int drift_path_e(point **path, MJD_Siggen_Setup *setup);
@@ -161,14 +210,36 @@ cdef extern from "calc_signal.h":
   void tell(const char *format, ...);
   void error(const char *format, ...);
 
+cdef extern from "detector_geometry.h":
+  int outside_detector(point pt, MJD_Siggen_Setup *setup);
+  int outside_detector_cyl(cyl_pt pt, MJD_Siggen_Setup *setup);
+  int geometry_setup(MJD_Siggen_Setup *setup);
+  float detector_distance(point pt, MJD_Siggen_Setup *setup);
+  int inside_detector_mask(const float *r, const float *phi, const float *z, int n,
+                           unsigned char *mask, MJD_Siggen_Setup *setup);
+
+cdef extern from "mc_events.h":
+  int get_event_signals(const point *pos, const float *energy, const int *first, int nevents,
+                        float cluster_size, float *signal_out, int *nfailed, int nthreads,
+                        MJD_Siggen_Setup *setup) nogil
+
 cdef extern from "fields.h":
   int field_setup(MJD_Siggen_Setup *setup);
   int fields_finalize(MJD_Siggen_Setup *setup);
   int wpotential(point pt, float *wp, MJD_Siggen_Setup *setup);
   int drift_velocity(point pt, float q, vector *velocity, MJD_Siggen_Setup *setup);
   int read_fields(MJD_Siggen_Setup *setup);
+  int set_field_grid(float *r_grid, int rlen, float *z_grid, int zlen, MJD_Siggen_Setup *setup);
+  int set_wpot_extra(float *wpots, int n, MJD_Siggen_Setup *setup);
+  int set_field_3d(float *field3, int xlen, int ylen, int zlen, float xmin, float ymin, float zmin,
+                   float step, int fold, MJD_Siggen_Setup *setup);
+  int resample_velocity_table(MJD_Siggen_Setup *setup);
+  int set_velocity_temps(float e_temp, float h_temp, MJD_Siggen_Setup *setup);
   void set_temp(float temp, MJD_Siggen_Setup *setup);
   void set_hole_params(float h_100_mu0, float h_100_beta, float h_100_e0, float h_111_mu0, float h_111_beta, float h_111_e0, MJD_Siggen_Setup *setup);
+  int resample_hole_params(MJD_Siggen_Setup *setup);
+  void velocity_table_sizes(MJD_Siggen_Setup *setup, int *v_len, int *h_len);
+  unsigned int setup_layout_key();
   void set_k0_params(float k0_0, float k0_1, float k0_2, float k0_3, MJD_Siggen_Setup *setup);
   float get_wpot_by_index(int row, int col, int pcrad, int pclen,MJD_Siggen_Setup* setup );
   float get_efld_r_by_index(int row, int col, int grad, int imp, int pcrad, int pclen, MJD_Siggen_Setup* setup );
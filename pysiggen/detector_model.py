@@ -8,6 +8,7 @@ from scipy import  signal, interpolate, ndimage
 from scipy.stats import skewnorm
 from scipy.special import erf
 import numbers
+from collections import OrderedDict
 
 from ._pysiggen import Siggen
 
@@ -44,8 +45,9 @@ class Detector:
         self.taper_length = self.siggenInst.GetTaperLength()
         self.top_bullet_radius = self.siggenInst.GetTopBulletRadius()
 
-        #Just be real conservative, say anything <3 is in the PC (currently not fitting anything that close to the PC anyway)
-        (self.pcLen, self.pcRad) = 3,3#self.siggenInst.GetPointContactDimensions()
+        (self.pcLen, self.pcRad) = self.siggenInst.GetPointContactDimensions()
+        #positions are sampled in the wedge 0 <= phi <= max_phi
+        self.max_phi = np.pi/4
 
         # print "radius is %f, length is %f" % (self.detector_radius, self.detector_length)
 
@@ -68,6 +70,8 @@ class Detector:
         self.impAvgList = None
 
 
+        self.EnableChargeCache()
+
         self.trapping_rc = None
         self.rc_int_exp = None #antialiasing rc
         self.t0_padding = t0_padding
@@ -122,6 +126,14 @@ class Detector:
     if 'pcLenList' in data:
         self.pcLenList = data['pcLenList']
 
+    #graded field grids store the r and z coordinates (in mm) of the array rows and columns
+    self.rGrid = None
+    self.zGrid = None
+    if 'rGrid' in data and 'zGrid' in data:
+        self.rGrid = np.ascontiguousarray(data['rGrid'], dtype=np.float32)
+        self.zGrid = np.ascontiguousarray(data['zGrid'], dtype=np.float32)
+    self.siggenInst.SetFieldGrid(self.rGrid, self.zGrid)
+
     self.wpArray = wpArray
     self.efld_rArray = efld_rArray
     self.efld_zArray = efld_zArray
@@ -157,6 +169,19 @@ class Detector:
     # plt.imshow(self.efld_zArray[:,:,0,0])
     # plt.show()
 
+  def LoadFields3D(self, fieldFileName):
+    #3-D fields from an npz with field3 of shape (nx, ny, nz, 4) holding (E_x, E_y, E_z, WP),
+    #grid3 = [xmin, ymin, zmin, step] in mm, and fold3 (see convert_fieldgen_3d)
+    self.fieldFileName = fieldFileName
+
+    with np.load(fieldFileName) as data:
+      self.field3 = np.ascontiguousarray(data['field3'], dtype=np.float32)
+      self.grid3 = data['grid3']
+      self.fold3 = int(data['fold3'])
+
+    xmin, ymin, zmin, step = self.grid3
+    self.siggenInst.SetField3D(self.field3, xmin, ymin, zmin, step, self.fold3)
+
   def SetPointContact(self, pcrad, pclen):
       if pcrad < self.pcRadList[0] or pcrad > self.pcRadList[-1]:
           print( "pc rad {0} is out of range [{1},{2}]".format(pcrad, self.pcRadList[0], self.pcRadList[-1]) )
@@ -284,22 +309,20 @@ class Detector:
 
 ###########################################################################################################################
   def IsInDetector(self, r, phi, z):
-    taper_length = self.taper_length
-    if r > np.floor(self.detector_radius*10.)/10. or z > np.floor(self.detector_length*10.)/10.:
-      return 0
-    if r <0 or z <=0:
-      return 0
-    if z < taper_length and r > (self.detector_radius - taper_length + z):
-      return 0
-    if phi <0 or phi > np.pi/4:
-      return 0
-    if r**2/self.pcRad**2 + z**2/self.pcLen**2 < 1:
+    if r < 0 or phi < 0 or phi > self.max_phi:
       return 0
-    if (z > (self.detector_length - self.top_bullet_radius) ) and (r > (self.detector_radius - self.top_bullet_radius) ):
-      if np.sqrt( (z-self.detector_length  + self.top_bullet_radius)**2 + (r-self.detector_radius  + self.top_bullet_radius)**2) >= self.top_bullet_radius:
-          return 0
-
-    return 1
+    #the detector geometry is the one siggen drifts charges in
+    return int(self.siggenInst.IsInDetector(r, phi, z))
+
+  def IsInDetectorArray(self, r, phi, z):
+    #IsInDetector for arrays of points, as a boolean array
+    r, phi, z = np.broadcast_arrays(r, phi, z)
+    return (phi >= 0) & (phi <= self.max_phi) & self.siggenInst.IsInDetectorArray(r, phi, z)
+
+  def SamplePoints(self, n, density=None, rng=None):
+    #(r, phi, z) of n points inside the detector and the sampling wedge, uniform in volume
+    #or weighted by an (r,z) energy deposition histogram; see Siggen.SamplePoints
+    return self.siggenInst.SamplePoints(n, 0., self.max_phi, density, rng)
 ###########################################################################################################################
   def GetSimWaveform(self, r,phi,z,scale, switchpoint,  numSamples, smoothing=None):
     sig_wf = self.GetRawSiggenWaveform(r, phi, z)
@@ -362,26 +385,47 @@ class Detector:
         print( "(which is to say, everything on the calc side should be in 1 ns steps)" )
         exit(0)
 
-    hole_wf = self.MakeRawSiggenWaveform(r, phi, z, 1)
-    if hole_wf is None:
-      return None
+    #raw hole and electron signals only depend on the position and the siggen state (its generation),
+    #so they are reused when only the energy, switchpoint, smoothing or electronics change
+    key = (r, phi, z, self.t0_padding, self.siggenInst.GetGeneration())
+    charges = None
+    if self.charge_cache is not None:
+      charges = self.charge_cache.pop(key, None)
 
-    self.padded_siggen_data.fill(0.)
-    self.padded_siggen_data[self.t0_padding: -self.end_padding] += hole_wf[:]
-    self.padded_siggen_data[-self.end_padding:] = hole_wf[-1]
+    if charges is None:
+      hole_wf = self.MakeRawSiggenWaveform(r, phi, z, 1)
+      if hole_wf is None:
+        return None
 
+      self.padded_siggen_data.fill(0.)
+      self.padded_siggen_data[self.t0_padding: -self.end_padding] += hole_wf[:]
+      self.padded_siggen_data[-self.end_padding:] = hole_wf[-1]
 
-    #do charge untrapping (holes only)
-    self.FinishChargeRelease(self.padded_siggen_data, 1)
+      #do charge untrapping (holes only)
+      self.FinishChargeRelease(self.padded_siggen_data, 1)
 
-    #this is a comical mess of memory management
-    self.raw_siggen_data.fill(0)
+      #this is a comical mess of memory management
+      self.raw_siggen_data.fill(0)
 
-    electron_wf = self.MakeRawSiggenWaveform(r, phi, z, -1)
-    if electron_wf is  None:
-      return None
+      electron_wf = self.MakeRawSiggenWaveform(r, phi, z, -1)
+      if electron_wf is  None:
+        return None
+      charges = (self.padded_siggen_data.copy(), electron_wf.copy())
+    else:
+      self.padded_siggen_data[:] = charges[0]
+
+    if self.charge_cache is not None:
+      self.charge_cache[key] = charges
+      if len(self.charge_cache) > self.charge_cache_size:
+        self.charge_cache.popitem(last=False)
+    electron_wf = charges[1]
 
     return self.TurnChargesIntoSignal(electron_wf, self.padded_siggen_data, energy, switchpoint,  numSamples, h_smoothing, h_smoothing2, alignPoint, trapType, doMaxInterp, interpType, smoothType)
+###########################################################################################################################
+  def EnableChargeCache(self, max_events=16):
+    #number of events (positions) whose raw hole and electron signals MakeSimWaveform keeps; 0 to turn off
+    self.charge_cache_size = max_events
+    self.charge_cache = OrderedDict() if max_events > 0 else None
 ###########################################################################################################################
   def TurnChargesIntoSignal(self, electron_wf, hole_wf, energy, switchpoint,  numSamples, h_smoothing = None, h_smoothing2=None,
                             alignPoint="t0", trapType="holesOnly", doMaxInterp=True, interpType="linear", smoothType="gen_gaus"):
@@ -790,8 +834,10 @@ class Detector:
     # all our instance attributes. Always use the dict.copy()
     # method to avoid modifying the original state.
 
-    #manually do a deep copy of the velo data
+    #manually do a deep copy of the velo data; the snapshot restores quickest, but only in the
+    #same build of pysiggen, so keep the configuration too
     self.siggenSetup = self.siggenInst.GetSafeConfiguration()
+    self.siggenSnapshot = self.siggenInst.GetSnapshot()
 
     state = self.__dict__.copy()
     # Remove the unpicklable entries.
@@ -805,6 +851,7 @@ class Detector:
     del state['gradList']
     del state['pcLenList']
     del state['siggenInst']
+    del state['charge_cache']
 
     return state
 
@@ -814,11 +861,16 @@ class Detector:
     # Restore the previously opened file's state. To do so, we need to
     # reopen it and read from it until the line count is restored.
 
-    self.siggenInst =  Siggen(savedConfig=self.siggenSetup)
+    try:
+      self.siggenInst = Siggen(snapshot=self.siggenSnapshot)
+    except (AttributeError, ValueError):
+      self.siggenInst = Siggen(savedConfig=self.siggenSetup)
     self.siggenInst.set_velocity_type(1)
     self.raw_siggen_data = np.zeros( self.num_steps, dtype=np.dtype('f4'), order="C" )
     self.raw_charge_data = np.zeros( self.calc_length, dtype=np.dtype('f4'), order="C" )
     self.processed_siggen_data = np.zeros( self.wf_output_length, dtype=np.dtype('f4'), order="C" )
+    self.EnableChargeCache(getattr(self, 'charge_cache_size', 16))
+    self.max_phi = getattr(self, 'max_phi', np.pi/4)
 
     self.wp_function = None
     self.efld_r_function = None
@@ -842,6 +894,26 @@ class Detector:
 
     return (new_r, new_z)
 
+def convert_fieldgen_3d(evFileName, wpFileName, outFileName):
+    #combine the field and WP files written by mjd_fieldgen -3 1 into an npz for Detector.LoadFields3D
+    fold, step = 0, None
+    with open(evFileName) as f:
+      for line in f:
+        if line.startswith("# 3-D grid:"):
+          step = float(line.split("step")[1].split()[0])
+          fold = int(line.split("fold")[1])
+          break
+    ev = np.loadtxt(evFileName)
+    wp = np.loadtxt(wpFileName)
+
+    x, y, z = np.unique(ev[:,0]), np.unique(ev[:,1]), np.unique(ev[:,2])
+    if step is None: step = z[1] - z[0]
+    field3 = np.empty((len(x), len(y), len(z), 4), dtype=np.float32)
+    field3[...,:3] = ev[:,5:8].reshape(len(x), len(y), len(z), 3)
+    field3[...,3] = wp[:,3].reshape(len(x), len(y), len(z))
+
+    np.savez(outFileName, field3=field3, grid3=np.array([x[0], y[0], z[0], step]), fold3=fold)
+
 def find_nearest_idx(array,value):
     idx = np.searchsorted(array, value, side="left")
     if idx > 0 and (idx == len(array) or math.fabs(value - array[idx-1]) < math.fabs(value - array[idx])):
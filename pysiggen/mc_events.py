@@ -0,0 +1,53 @@
+#Signals of multi-site Monte-Carlo events: hit lists (event id, x, y, z, energy), e.g. from
+#Geant4, read from a text/CSV file or a binary dump and turned into summed waveforms with
+#Siggen.GetEventSignals, a block of events at a time
+
+import numpy as np
+from .waveform_store import WaveformWriter
+
+#record of a binary hit dump, as written by e.g. numpy.ndarray.tofile
+HIT_DTYPE = np.dtype([("event", "<i8"), ("x", "<f4"), ("y", "<f4"), ("z", "<f4"), ("energy", "<f4")])
+
+def read_hits(fileName, columns=(0, 1, 2, 3, 4), delimiter=None, skiprows=0, dtype=HIT_DTYPE):
+  #hits as a structured array with fields event, x, y, z, energy (HIT_DTYPE), sorted by event
+  #a .npy file or a raw binary file (.bin, .dat) of records of dtype; otherwise a text file with
+  #the event id, x, y, z (mm, detector frame) and energy in the given columns (comma-separated
+  #for .csv files, unless delimiter is given)
+  if fileName.endswith(".npy"):
+    raw = np.load(fileName, mmap_mode="r")
+  elif fileName.endswith(".bin") or fileName.endswith(".dat"):
+    raw = np.memmap(fileName, dtype=dtype, mode="r")
+  else:
+    if delimiter is None and fileName.endswith(".csv"): delimiter = ","
+    cols = np.loadtxt(fileName, delimiter=delimiter, skiprows=skiprows, usecols=columns, ndmin=2)
+    raw = np.empty(len(cols), dtype=HIT_DTYPE)
+    for i, name in enumerate(HIT_DTYPE.names):
+      raw[name] = cols[:, i]
+  hits = np.empty(len(raw), dtype=HIT_DTYPE)
+  for name in HIT_DTYPE.names:
+    hits[name] = raw[name]
+  return hits[np.argsort(hits["event"], kind="mergesort")]
+
+def event_signals(siggen, hits, events_per_block=10000, cluster_size=0., nthreads=1):
+  #generator of (event ids, signals, failed hit counts) for consecutive blocks of up to
+  #events_per_block events of hits (sorted by event, as from read_hits), so that the
+  #signals of a large simulation need not be held in memory at once
+  ev = hits["event"]
+  starts = np.flatnonzero(np.r_[True, ev[1:] != ev[:-1]])
+  for b in range(0, len(starts), events_per_block):
+    lo = starts[b]
+    hi = starts[b + events_per_block] if b + events_per_block < len(starts) else len(hits)
+    h = hits[lo:hi]
+    yield siggen.GetEventSignals(h["event"], h["x"], h["y"], h["z"], h["energy"],
+                                 cluster_size, nthreads)
+
+def write_event_signals(siggen, hits, fileName, events_per_block=10000, cluster_size=0., nthreads=1):
+  #event_signals of hits, streamed into a WaveformWriter file with the event ids
+  #returns the total number of failed hits
+  nfailed = 0
+  with WaveformWriter(fileName, siggen.GetOutputLength(), siggen.GetOutputTimeStep(),
+                      chunk_size=events_per_block) as out:
+    for ids, sig, nf in event_signals(siggen, hits, events_per_block, cluster_size, nthreads):
+      out.write(sig, ids)
+      nfailed += int(nf.sum())
+  return nfailed
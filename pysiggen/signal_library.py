@@ -0,0 +1,142 @@
+#Precomputed library of raw siggen signals on an (r, phi, z) grid, stored in a single
+#memory-mappable file, with interpolated lookup of the signal at any point
+
+import numpy as np
+import multiprocessing
+
+#file layout: magic, int32 (nr, nphi, nz, nt), float32 time step in ns, then the grid
+#coordinates (float64), t50 (float32) and valid flags (uint8) of each point, padding to
+#a multiple of 64 bytes, and the signals as float32 [r][phi][z][t]
+LIBRARY_MAGIC = b"SIGLIB01"
+LIBRARY_ALIGN = 64
+
+def fold_phi(phi):
+  #the crystal axes make the drift symmetric under rotations by pi/2 and reflections
+  #across phi = pi/4, so any phi maps into [0, pi/4]
+  phi = np.mod(phi, np.pi/2)
+  return np.where(phi > np.pi/4, np.pi/2 - phi, phi)
+
+def signal_t50(wf):
+  #time (in samples, interpolated) at which the signal first reaches half of its maximum
+  half = 0.5*np.amax(wf)
+  i = np.argmax(wf >= half)
+  if i == 0: return 0.
+  return i - 1 + (half - wf[i-1])/(wf[i] - wf[i-1])
+
+def grid_cell(grid, x):
+  #index of the lower grid point around x and weight of the upper one, or None outside the grid
+  if len(grid) == 1:
+    return (0, 0.) if x == grid[0] else None
+  if x < grid[0] or x > grid[-1]: return None
+  i = min(np.searchsorted(grid, x, side="right") - 1, len(grid) - 2)
+  return i, (x - grid[i])/(grid[i+1] - grid[i])
+
+def grid_corners(cells, valid):
+  #(weight, index) of the corners of the cell around a point with a nonzero weight and a valid
+  #entry; cells is a list of grid_cell results, one per axis; weights are normalized to 1
+  corners = [(1., ())]
+  for i, f in cells:
+    corners = [(w*wi, idx + (i + di,)) for w, idx in corners for di, wi in ((0, 1. - f), (1, f)) if wi > 0]
+  corners = [(w, idx) for w, idx in corners if valid[idx]]
+  wsum = sum(w for w, idx in corners)
+  return [(w/wsum, idx) for w, idx in corners]
+
+def _header_size(nr, nphi, nz):
+  n = len(LIBRARY_MAGIC) + 4*4 + 4 + 8*(nr + nphi + nz) + 5*nr*nphi*nz
+  return LIBRARY_ALIGN*((n + LIBRARY_ALIGN - 1)//LIBRARY_ALIGN)
+
+_build_detector = None
+
+def _library_slab(args):
+  #signals for one r of the grid; run in the worker processes
+  r, phi, z = args
+  det = _build_detector
+  wfs = np.zeros((len(phi), len(z), det.num_steps), dtype=np.float32)
+  valid = np.zeros((len(phi), len(z)), dtype=np.uint8)
+  for j in range(len(phi)):
+    for k in range(len(z)):
+      wf = det.GetRawSiggenWaveform(r, phi[j], z[k])
+      if wf is None: continue
+      wfs[j,k] = wf
+      valid[j,k] = 1
+  return wfs, valid
+
+def build_signal_library(detector, fileName, r, phi, z, processes=1):
+  #calculate the raw signals of detector (a Detector, with its fields loaded) at each point
+  #of the grid r x phi x z (mm, radians within [0, pi/4], mm), and write them to fileName;
+  #processes > 1 splits the r values over that many forked worker processes
+  global _build_detector
+  r, phi, z = [np.asarray(a, dtype=np.float64) for a in (r, phi, z)]
+  nr, nphi, nz, nt = len(r), len(phi), len(z), detector.num_steps
+  hsize = _header_size(nr, nphi, nz)
+
+  _build_detector = detector
+  tasks = [(ri, phi, z) for ri in r]
+  if processes > 1:
+    pool = multiprocessing.get_context("fork").Pool(processes)
+    slabs = pool.imap(_library_slab, tasks)
+  else:
+    pool = None
+    slabs = map(_library_slab, tasks)
+
+  t50 = np.zeros((nr, nphi, nz), dtype=np.float32)
+  valid = np.zeros((nr, nphi, nz), dtype=np.uint8)
+  with open(fileName, "wb") as f:
+    f.truncate(hsize + 4*nr*nphi*nz*nt)
+  signals = np.memmap(fileName, dtype=np.float32, mode="r+", offset=hsize, shape=(nr, nphi, nz, nt))
+  for i, (wfs, ok) in enumerate(slabs):
+    signals[i] = wfs
+    valid[i] = ok
+    for j in range(nphi):
+      for k in range(nz):
+        if ok[j,k]: t50[i,j,k] = signal_t50(wfs[j,k])
+  signals.flush()
+  del signals
+  if pool is not None:
+    pool.close()
+    pool.join()
+  _build_detector = None
+
+  with open(fileName, "r+b") as f:
+    f.write(LIBRARY_MAGIC)
+    np.array([nr, nphi, nz, nt], dtype=np.int32).tofile(f)
+    np.array([detector.siggenInst.GetOutputTimeStep()], dtype=np.float32).tofile(f)
+    for a in (r, phi, z): a.tofile(f)
+    t50.tofile(f)
+    valid.tofile(f)
+
+class SignalLibrary:
+  #read-only, memory-mapped signal library written by build_signal_library
+  def __init__(self, fileName):
+    with open(fileName, "rb") as f:
+      if f.read(len(LIBRARY_MAGIC)) != LIBRARY_MAGIC:
+        raise ValueError("{0} is not a signal library".format(fileName))
+      nr, nphi, nz, nt = np.fromfile(f, dtype=np.int32, count=4)
+      self.time_step = float(np.fromfile(f, dtype=np.float32, count=1)[0])
+      self.r = np.fromfile(f, dtype=np.float64, count=nr)
+      self.phi = np.fromfile(f, dtype=np.float64, count=nphi)
+      self.z = np.fromfile(f, dtype=np.float64, count=nz)
+      self.t50 = np.fromfile(f, dtype=np.float32, count=nr*nphi*nz).reshape(nr, nphi, nz)
+      self.valid = np.fromfile(f, dtype=np.uint8, count=nr*nphi*nz).reshape(nr, nphi, nz).astype(bool)
+    self.num_steps = int(nt)
+    self.signals = np.memmap(fileName, dtype=np.float32, mode="r", offset=_header_size(nr, nphi, nz),
+                             shape=(nr, nphi, nz, nt))
+    self.time = np.arange(nt, dtype=np.float64)
+
+  def GetWaveform(self, r, phi, z, output_array=None):
+    #signal at (r, phi, z), interpolated between the 8 surrounding library points;
+    #each is first shifted in time to the interpolated t50, so that the rise is not smeared
+    #returns None outside the library grid, or if no surrounding point has a signal
+    cells = [grid_cell(self.r, r), grid_cell(self.phi, fold_phi(phi)), grid_cell(self.z, z)]
+    if None in cells: return None
+    corners = grid_corners(cells, self.valid)
+    if len(corners) == 0: return None
+
+    t50 = sum(w*self.t50[idx] for w, idx in corners)
+    if output_array is None:
+      output_array = np.zeros(self.num_steps, dtype=np.float32)
+    else:
+      output_array.fill(0.)
+    for w, idx in corners:
+      output_array += w*np.interp(self.time - (t50 - self.t50[idx]), self.time, self.signals[idx])
+    return output_array
@@ -0,0 +1,88 @@
+#Reduced-order model of the raw siggen signals: a truncated SVD basis of the signals in one or
+#more signal libraries, with the basis coefficients of each library point interpolated over
+#(r, phi, z) and, optionally, over one detector parameter (e.g. impurity gradient)
+
+import numpy as np
+from .signal_library import fold_phi, grid_cell, grid_corners
+
+def build_surrogate(libraries, fileName, num_components=32, params=None):
+  #libraries: a SignalLibrary, or a list of them all on the same grid, calculated at the
+  #detector parameter values params (increasing); the signals are aligned on t50 (to the nearest
+  #sample, so that the alignment is exact at the library points) before the decomposition, and
+  #the model (an npz file) keeps the map of the shifts to undo it
+  if params is None: libraries = [libraries]
+  lib0 = libraries[0]
+  for lib in libraries[1:]:
+    if not (np.array_equal(lib.r, lib0.r) and np.array_equal(lib.phi, lib0.phi) and
+            np.array_equal(lib.z, lib0.z) and lib.num_steps == lib0.num_steps):
+      raise ValueError("signal libraries must share the same grid")
+
+  valid = np.array([lib.valid for lib in libraries])
+  t50 = np.array([lib.t50 for lib in libraries])
+  shift = np.round(t50 - np.median(t50[valid]))
+  time = lib0.time
+
+  wfs = np.empty((np.count_nonzero(valid), lib0.num_steps))
+  n = 0
+  for p, lib in enumerate(libraries):
+    for idx in zip(*np.nonzero(lib.valid)):
+      wfs[n] = np.interp(time + shift[p][idx], time, lib.signals[idx])
+      n += 1
+
+  mean = wfs.mean(axis=0)
+  u, sv, vt = np.linalg.svd(wfs - mean, full_matrices=False)
+  num_components = min(num_components, len(sv))
+  coeffs = np.zeros(valid.shape + (num_components,), dtype=np.float32)
+  coeffs[valid] = u[:, :num_components] * sv[:num_components]
+
+  np.savez(fileName, mean=mean.astype(np.float32), basis=vt[:num_components].astype(np.float32),
+           coeffs=coeffs, shift=shift, valid=valid, singular_values=sv,
+           r=lib0.r, phi=lib0.phi, z=lib0.z, params=np.zeros(1) if params is None else np.asarray(params, dtype=np.float64))
+
+class WaveformSurrogate:
+  #signals reconstructed as mean + coeffs . basis from a model written by build_surrogate
+  def __init__(self, fileName):
+    data = np.load(fileName)
+    self.mean = data["mean"]
+    self.basis = data["basis"]
+    self.coeffs = data["coeffs"]
+    self.shift = data["shift"]
+    self.valid = data["valid"]
+    self.singular_values = data["singular_values"]
+    self.r, self.phi, self.z, self.params = data["r"], data["phi"], data["z"], data["params"]
+    self.num_steps = self.mean.shape[0]
+    self.time = np.arange(self.num_steps, dtype=np.float64)
+
+  def GetNumComponents(self):
+    return self.basis.shape[0]
+
+  def GetExplainedVariance(self):
+    #fraction of the (aligned) signal variance kept by the basis
+    sv2 = self.singular_values**2
+    return np.sum(sv2[:self.GetNumComponents()])/np.sum(sv2)
+
+  def GetCoefficients(self, r, phi, z, param=None):
+    #(basis coefficients, time shift in samples) at the point, or None outside the grid or the detector
+    cells = [grid_cell(self.r, r), grid_cell(self.phi, fold_phi(phi)), grid_cell(self.z, z)]
+    cells.insert(0, grid_cell(self.params, self.params[0] if param is None or len(self.params) == 1 else param))
+    if None in cells: return None
+    corners = grid_corners(cells, self.valid)
+    if len(corners) == 0: return None
+
+    c = sum(w*self.coeffs[idx] for w, idx in corners)
+    shift = sum(w*self.shift[idx] for w, idx in corners)
+    return c, shift
+
+  def GetWaveform(self, r, phi, z, param=None, output_array=None):
+    #signal at (r, phi, z) (and detector parameter param, if the model has a parameter axis),
+    #or None outside the grid or the detector
+    res = self.GetCoefficients(r, phi, z, param)
+    if res is None: return None
+    c, shift = res
+
+    wf = self.mean + np.dot(c, self.basis)
+    shifted = np.interp(self.time - shift, self.time, wf)
+    if output_array is None:
+      return shifted.astype(np.float32)
+    output_array[:] = shifted
+    return output_array
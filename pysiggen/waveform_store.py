@@ -0,0 +1,143 @@
+#Append-only file of simulated waveforms, written in chunks as they are calculated (so that
+#memory use stays bounded however many there are) and read back through memory maps
+
+import threading
+import numpy as np
+
+#file layout: magic, int32 number of samples per waveform, float32 time step in ns, padding to
+#WAVEFORM_ALIGN bytes, then any number of chunks: chunk magic, int32 number of waveforms n,
+#int32 0, the int64 ids of the n waveforms and the waveforms as float32 [n][samples], padding to
+#a multiple of WAVEFORM_ALIGN bytes. A chunk cut short (e.g. by a crash) ends the file.
+WAVEFORM_MAGIC = b"SIGWFS01"
+CHUNK_MAGIC = b"WFCHUNK1"
+WAVEFORM_ALIGN = 64
+
+def _padded(n):
+  return WAVEFORM_ALIGN*((n + WAVEFORM_ALIGN - 1)//WAVEFORM_ALIGN)
+
+def _scan_chunks(f, fileName):
+  #(num_steps, time_step, [(offset of the ids, number of waveforms) of each whole chunk],
+  #end of the last whole chunk) of the open file f
+  f.seek(0, 2)
+  size = f.tell()
+  f.seek(0)
+  if f.read(len(WAVEFORM_MAGIC)) != WAVEFORM_MAGIC:
+    raise ValueError("{0} is not a waveform file".format(fileName))
+  num_steps = int(np.fromfile(f, dtype=np.int32, count=1)[0])
+  time_step = float(np.fromfile(f, dtype=np.float32, count=1)[0])
+  chunks = []
+  pos = _padded(len(WAVEFORM_MAGIC) + 8)
+  while pos + 16 <= size:
+    f.seek(pos)
+    if f.read(len(CHUNK_MAGIC)) != CHUNK_MAGIC: break
+    n = int(np.fromfile(f, dtype=np.int32, count=2)[0])
+    end = pos + _padded(16 + 8*n + 4*n*num_steps)
+    if end > size: break
+    chunks.append((pos + 16, n))
+    pos = end
+  return num_steps, time_step, chunks, pos
+
+class WaveformWriter:
+  #writes waveforms of num_steps samples to fileName (appending to it if append is True),
+  #chunk_size at a time; write() may be called from several threads at once
+  def __init__(self, fileName, num_steps, time_step=1., chunk_size=1024, append=False):
+    self.num_steps = int(num_steps)
+    self.chunk_size = int(chunk_size)
+    self.count = 0
+    self._lock = threading.Lock()
+    self._ids = np.zeros(self.chunk_size, dtype=np.int64)
+    self._wfs = np.zeros((self.chunk_size, self.num_steps), dtype=np.float32)
+    self._n = 0
+    if append:
+      self._file = open(fileName, "r+b")
+      steps, time_step, chunks, end = _scan_chunks(self._file, fileName)
+      if steps != self.num_steps:
+        raise ValueError("{0} holds waveforms of {1} samples, not {2}".format(fileName, steps, num_steps))
+      self.count = sum(n for offset, n in chunks)
+      self._file.truncate(end)
+      self._file.seek(end)
+    else:
+      self._file = open(fileName, "wb")
+      self._file.write(WAVEFORM_MAGIC)
+      np.array([self.num_steps], dtype=np.int32).tofile(self._file)
+      np.array([time_step], dtype=np.float32).tofile(self._file)
+      self._file.write(b"\0"*(_padded(len(WAVEFORM_MAGIC) + 8) - len(WAVEFORM_MAGIC) - 8))
+    self.time_step = time_step
+
+  def write(self, waveforms, ids=None):
+    #append waveforms (one per row, or a single one), with int ids (by default, their running
+    #count in the file); they reach the file once chunk_size have been collected, or on flush()
+    waveforms = np.asarray(waveforms, dtype=np.float32).reshape(-1, self.num_steps)
+    with self._lock:
+      if ids is None:
+        ids = np.arange(self.count, self.count + len(waveforms))
+      ids = np.asarray(ids, dtype=np.int64).reshape(-1)
+      if len(ids) != len(waveforms):
+        raise ValueError("Need one id for each waveform")
+      self.count += len(waveforms)
+      i = 0
+      while i < len(waveforms):
+        k = min(self.chunk_size - self._n, len(waveforms) - i)
+        self._ids[self._n:self._n+k] = ids[i:i+k]
+        self._wfs[self._n:self._n+k] = waveforms[i:i+k]
+        self._n += k
+        i += k
+        if self._n == self.chunk_size: self._write_chunk()
+
+  def flush(self):
+    with self._lock:
+      self._write_chunk()
+      self._file.flush()
+
+  def close(self):
+    if self._file is None: return
+    self.flush()
+    self._file.close()
+    self._file = None
+
+  def __enter__(self):
+    return self
+
+  def __exit__(self, *args):
+    self.close()
+
+  def _write_chunk(self):
+    n = self._n
+    if n == 0: return
+    self._file.write(CHUNK_MAGIC)
+    np.array([n, 0], dtype=np.int32).tofile(self._file)
+    self._ids[:n].tofile(self._file)
+    self._wfs[:n].tofile(self._file)
+    size = 16 + 8*n + 4*n*self.num_steps
+    self._file.write(b"\0"*(_padded(size) - size))
+    self._n = 0
+
+class WaveformReader:
+  #read-only access to a file written by WaveformWriter; each chunk is memory-mapped, so
+  #only the waveforms used are read from disk
+  def __init__(self, fileName):
+    with open(fileName, "rb") as f:
+      self.num_steps, self.time_step, chunks, end = _scan_chunks(f, fileName)
+    self.chunks = []
+    for offset, n in chunks:
+      mm = np.memmap(fileName, dtype=np.uint8, mode="r", offset=offset, shape=(8*n + 4*n*self.num_steps,))
+      self.chunks.append((mm[:8*n].view(np.int64), mm[8*n:].view(np.float32).reshape(n, self.num_steps)))
+    self._first = np.cumsum([0] + [len(ids) for ids, wfs in self.chunks])
+
+  def __len__(self):
+    return int(self._first[-1])
+
+  def __getitem__(self, i):
+    #the i-th waveform in the file
+    if i < 0: i += len(self)
+    if i < 0 or i >= len(self): raise IndexError("waveform index out of range")
+    c = np.searchsorted(self._first, i, side="right") - 1
+    return self.chunks[c][1][i - self._first[c]]
+
+  @property
+  def ids(self):
+    return np.concatenate([ids for ids, wfs in self.chunks]) if self.chunks else np.zeros(0, dtype=np.int64)
+
+  def iter_chunks(self):
+    #(ids, waveforms) of each chunk in turn, as memory-mapped arrays
+    return iter(self.chunks)
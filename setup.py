@@ -4,8 +4,10 @@ import os, sys, re
 
 try:
     from setuptools import setup, Extension
+    from setuptools.command.build_ext import build_ext
 except ImportError:
     from distutils.core import setup, Extension
+    from distutils.command.build_ext import build_ext
 
 
 if __name__ == "__main__":
@@ -18,8 +20,10 @@ if __name__ == "__main__":
 
     # Set up the C++-extension.
     libraries = []
+    # elsewhere mc_events.c runs in one thread (NO_THREADS, see mjd_siggen.h)
     if os.name == "posix":
         libraries.append("m")
+        libraries.append("pthread")
     include_dirs = [
         "pysiggen",
         "mjd_siggen",
@@ -31,6 +35,7 @@ if __name__ == "__main__":
         "cyl_point.c",
         "detector_geometry.c",
         "fields.c",
+        "mc_events.c",
         "mjd_fieldgen.c",
         "point.c",
         "read_config.c",
@@ -75,6 +80,34 @@ if __name__ == "__main__":
     extensions = cythonize([ext])
 
 
+    # The standalone microbenchmark of the signal calculation, built with the
+    # extension's compiler and flags: python setup.py build_bench
+    class build_bench(build_ext):
+        description = "build the siggen_bench microbenchmark into build/"
+
+        def run(self):
+            from distutils.ccompiler import new_compiler
+            from distutils.sysconfig import customize_compiler
+
+            cc = new_compiler(compiler=self.compiler, verbose=self.verbose,
+                              dry_run=self.dry_run, force=self.force)
+            customize_compiler(cc)
+            # siggen_bench.c includes fields.c itself
+            bench_src = [os.path.join("mjd_siggen", fn) for fn in [
+                "siggen_bench.c",
+                "calc_signal.c",
+                "cyl_point.c",
+                "detector_geometry.c",
+                "point.c",
+                "read_config.c",
+                "siggen_helpers.c",
+            ]]
+            objects = cc.compile(bench_src, output_dir=self.build_temp,
+                                 include_dirs=["mjd_siggen"])
+            cc.link_executable(objects, "siggen_bench", output_dir="build",
+                               libraries=libraries)
+
+
 setup(
     name="pysiggen",
     version=version,
@@ -85,4 +118,5 @@ setup(
           'numpy', 'scipy', 'matplotlib', 'cython'
       ],
     ext_modules=extensions,
+    cmdclass={"build_bench": build_bench},
 )